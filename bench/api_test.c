@@ -0,0 +1,324 @@
+/*
+** Checks the LXD API client against a stand-in LXD on a unix socket:
+**
+**   out/api_test -r out/v2
+**
+** The stand-in answers GET /1.0/containers with Content-Length, chunked and
+** close-delimited bodies, sent in pieces so that the client has to wait for
+** the rest of a chunk header or body, and is restarted under a kept-alive
+** connection. Each case checks the values of lxd.api and how many
+** connections and requests the stand-in saw, so a connection that should
+** have been reused or reopened shows up as well as a misread body.
+*/
+
+#include "../zabbix_module_lxd.c"
+#define ZABBIX_LXD_HARNESS_MODULE
+#include "harness.h"
+
+#define API_BODY        "{\"type\":\"sync\",\"status\":\"Success\",\"status_code\":200,\"metadata\":[" \
+                        "{\"name\":\"c1\",\"status\":\"Running\",\"state\":{\"pid\":4242}}," \
+                        "{\"name\":\"c2\",\"project\":\"p1\",\"status\":\"Stopped\",\"state\":{\"pid\":0}}]}"
+
+/* how the stand-in frames the next response */
+#define API_LENGTH      0
+#define API_CHUNKED     1
+#define API_SPLIT       2       /* chunked with the chunk size line sent in two pieces */
+#define API_CLOSE       3
+
+#define API_REQUEST     "GET " ZBX_LXD_API_CONTAINERS " HTTP/1.1\r\n"
+
+typedef struct
+{
+        char            path[108];
+        int             listener;
+        int             conn;
+        int             framing;
+        int             connections;
+        int             requests;
+        pthread_t       thread;
+        pthread_mutex_t lock;
+}
+api_server_t;
+
+static void     api_send(int fd, const char *data, size_t len)
+{
+        ssize_t n;
+
+        for (; 0 < len; data += n, len -= n)
+        {
+                if (0 >= (n = send(fd, data, len, MSG_NOSIGNAL)))
+                        return;
+        }
+}
+
+/* sends a part of the response and gives the client time to receive it alone */
+static void     api_piece(int fd, const char *data, size_t len)
+{
+        api_send(fd, data, len);
+        usleep(20000);
+}
+
+static void     api_respond(int fd, int framing)
+{
+        const char      *body = API_BODY;
+        size_t          len = strlen(body), half = len / 2;
+        char            buffer[256];
+
+        switch (framing)
+        {
+                case API_LENGTH:
+                        zbx_snprintf(buffer, sizeof(buffer), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                                        "Content-Length: %d\r\n\r\n", (int)len);
+                        api_piece(fd, buffer, strlen(buffer));
+                        api_piece(fd, body, half);
+                        api_send(fd, body + half, len - half);
+                        break;
+                case API_CHUNKED:
+                case API_SPLIT:
+                        zbx_strlcpy(buffer, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                                        "Transfer-Encoding: chunked\r\n\r\n", sizeof(buffer));
+                        api_piece(fd, buffer, strlen(buffer));
+                        zbx_snprintf(buffer, sizeof(buffer), "%x\r\n", (unsigned int)half);
+                        if (API_SPLIT == framing)
+                        {
+                                api_piece(fd, buffer, 1);
+                                api_piece(fd, buffer + 1, strlen(buffer) - 1);
+                        }
+                        else
+                                api_send(fd, buffer, strlen(buffer));
+                        api_send(fd, body, half);
+                        api_piece(fd, "\r\n", 2);
+                        zbx_snprintf(buffer, sizeof(buffer), "%x\r\n", (unsigned int)(len - half));
+                        api_send(fd, buffer, strlen(buffer));
+                        api_piece(fd, body + half, len - half);
+                        api_send(fd, "\r\n0\r\n\r\n", 7);
+                        break;
+                case API_CLOSE:
+                        zbx_strlcpy(buffer, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n",
+                                        sizeof(buffer));
+                        api_piece(fd, buffer, strlen(buffer));
+                        api_piece(fd, body, half);
+                        api_send(fd, body + half, len - half);
+                        break;
+        }
+}
+
+/* the stand-in LXD, serves one connection at a time until its listener is shut down */
+static void     *api_server(void *arg)
+{
+        api_server_t    *server = (api_server_t *)arg;
+        char            request[4096];
+        size_t          len;
+        ssize_t         n;
+        int             fd, framing;
+
+        while (-1 != (fd = accept(server->listener, NULL, NULL)))
+        {
+                pthread_mutex_lock(&server->lock);
+                server->conn = fd;
+                server->connections++;
+                pthread_mutex_unlock(&server->lock);
+
+                for (len = 0; 0 < (n = recv(fd, request + len, sizeof(request) - len - 1, 0));)
+                {
+                        len += n;
+                        request[len] = '\0';
+
+                        if (NULL == strstr(request, "\r\n\r\n"))
+                                continue;
+
+                        pthread_mutex_lock(&server->lock);
+                        server->requests++;
+                        framing = server->framing;
+                        pthread_mutex_unlock(&server->lock);
+
+                        len = 0;
+
+                        if (0 != strncmp(request, API_REQUEST, strlen(API_REQUEST)))
+                        {
+                                zbx_strlcpy(request, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n",
+                                                sizeof(request));
+                                api_send(fd, request, strlen(request));
+                                continue;
+                        }
+
+                        api_respond(fd, framing);
+
+                        if (API_CLOSE == framing)
+                                break;
+                }
+
+                pthread_mutex_lock(&server->lock);
+                server->conn = -1;
+                pthread_mutex_unlock(&server->lock);
+                close(fd);
+        }
+
+        return NULL;
+}
+
+static int      api_start(api_server_t *server)
+{
+        struct sockaddr_un      addr;
+
+        unlink(server->path);
+        server->conn = -1;
+        server->connections = 0;
+        server->requests = 0;
+        pthread_mutex_init(&server->lock, NULL);
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        zbx_strlcpy(addr.sun_path, server->path, sizeof(addr.sun_path));
+
+        if (-1 == (server->listener = socket(AF_UNIX, SOCK_STREAM, 0)) ||
+                        0 != bind(server->listener, (struct sockaddr *)&addr, sizeof(addr)) ||
+                        0 != listen(server->listener, 4))
+        {
+                fprintf(stderr, "cannot listen on %s: %s\n", server->path, strerror(errno));
+                return FAIL;
+        }
+
+        pthread_create(&server->thread, NULL, api_server, server);
+
+        return SUCCEED;
+}
+
+/* stops the stand-in like an LXD restart, the connection it serves is closed */
+static void     api_stop(api_server_t *server)
+{
+        shutdown(server->listener, SHUT_RDWR);
+
+        pthread_mutex_lock(&server->lock);
+        if (-1 != server->conn)
+                shutdown(server->conn, SHUT_RDWR);
+        pthread_mutex_unlock(&server->lock);
+
+        pthread_join(server->thread, NULL);
+        close(server->listener);
+        unlink(server->path);
+        pthread_mutex_destroy(&server->lock);
+}
+
+/* requests lxd.api values of both containers with the given framing, then checks what the stand-in saw */
+static int      api_case(api_server_t *server, const char *name, int framing, int connections, int requests)
+{
+        static const char       *items[][2] = {
+                {"lxd.api[c1,status]", "Running"},
+                {"lxd.api[c1,state/pid]", "4242"},
+                {"lxd.api[p1_c2,status]", "Stopped"},
+        };
+        AGENT_RESULT            result;
+        char                    buffer[64];
+        const char              *value;
+        size_t                  i;
+        int                     ret, failed = 0;
+
+        pthread_mutex_lock(&server->lock);
+        server->framing = framing;
+        pthread_mutex_unlock(&server->lock);
+
+        // a new request for every case, ApiTTL is at least a second
+        api.fetched = 0;
+
+        for (i = 0; i < sizeof(items) / sizeof(*items); i++)
+        {
+                ret = harness_call(items[i][0], &result);
+                value = harness_value(&result, buffer, sizeof(buffer));
+
+                if (SYSINFO_RET_OK != ret || 0 != strcmp(value, items[i][1]))
+                {
+                        printf("FAIL: %s: %s is \"%s\", expected \"%s\"\n", name, items[i][0], value,
+                                        items[i][1]);
+                        failed++;
+                }
+
+                harness_free(&result);
+        }
+
+        pthread_mutex_lock(&server->lock);
+        if (connections != server->connections || requests != server->requests)
+        {
+                printf("FAIL: %s: %d connections and %d requests, expected %d and %d\n", name,
+                                server->connections, server->requests, connections, requests);
+                failed++;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (0 == failed)
+                printf("api: %s: OK\n", name);
+
+        return failed;
+}
+
+static void     usage(const char *progname)
+{
+        fprintf(stderr, "usage: %s -r cgroup_root [-l log_level]\n", progname);
+        exit(EXIT_FAILURE);
+}
+
+int     main(int argc, char **argv)
+{
+        api_server_t    server;
+        char            dir[] = "/tmp/zabbix_lxd_api.XXXXXX", option[160], *config[1];
+        char            *root = NULL;
+        int             opt, failed = 0;
+
+        while (-1 != (opt = getopt(argc, argv, "r:l:")))
+        {
+                switch (opt)
+                {
+                        case 'r':
+                                root = optarg;
+                                break;
+                        case 'l':
+                                zbx_stub_log_level = atoi(optarg);
+                                break;
+                        default:
+                                usage(argv[0]);
+                }
+        }
+
+        if (NULL == root)
+                usage(argv[0]);
+
+        if (NULL == mkdtemp(dir))
+        {
+                fprintf(stderr, "cannot create a directory for the socket: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+        }
+
+        memset(&server, 0, sizeof(server));
+        zbx_snprintf(server.path, sizeof(server.path), "%s/unix.socket", dir);
+
+        if (SUCCEED != api_start(&server))
+                return EXIT_FAILURE;
+
+        zbx_snprintf(option, sizeof(option), "ApiSocket=%s", server.path);
+        config[0] = option;
+
+        if (SUCCEED != harness_init(root, config, 1, 3))
+        {
+                fprintf(stderr, "cannot load the module\n");
+                return EXIT_FAILURE;
+        }
+
+        // the connection is kept alive over the first three cases
+        failed += api_case(&server, "Content-Length", API_LENGTH, 1, 1);
+        failed += api_case(&server, "chunked", API_CHUNKED, 1, 2);
+        failed += api_case(&server, "split chunk header", API_SPLIT, 1, 3);
+        failed += api_case(&server, "close-delimited", API_CLOSE, 1, 4);
+        failed += api_case(&server, "reconnect after close", API_LENGTH, 2, 5);
+
+        // the kept-alive connection fails on the restarted server and is reopened once
+        api_stop(&server);
+        if (SUCCEED != api_start(&server))
+                return EXIT_FAILURE;
+        failed += api_case(&server, "server restart", API_LENGTH, 1, 1);
+
+        harness_uninit();
+        api_stop(&server);
+        rmdir(dir);
+
+        return (0 == failed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,274 @@
+/*
+** Calls every key of the module for every container of a fixture tree and
+** reports per key latency percentiles, throughput and allocations per call:
+**
+**   out/bench -r out/v1 -n 3
+**
+** Keys taking a container are called once per container and round, the others
+** ten times per round. Exits with failure when a call took longer than the
+** agent Timeout, i.e. the item would not have been supported.
+*/
+
+#include "harness.h"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+
+typedef struct
+{
+        const char      *key;
+        const char      *item;          /* with %s for the container name, or without */
+}
+zbx_bench_key_t;
+
+static const zbx_bench_key_t    bench_keys[] =
+{
+        {"lxd.discovery",       "lxd.discovery"},
+        {"lxd.all",             "lxd.all"},
+        {"lxd.up",              "lxd.up[%s]"},
+        {"lxd.lifecycle",       "lxd.lifecycle[%s]"},
+        {"lxd.mem",             "lxd.mem[%s,total_rss]"},
+        {"lxd.mem",             "lxd.mem[%s,working_set]"},
+        {"lxd.mem.events",      "lxd.mem.events[%s,oom_kill]"},
+        {"lxd.cpu",             "lxd.cpu[%s,user]"},
+        {"lxd.cpu.util",        "lxd.cpu.util[%s]"},
+        {"lxd.cpu.throttling",  "lxd.cpu.throttling[%s]"},
+        {"lxd.cpu.sampled",     "lxd.cpu.sampled[%s]"},
+        {"lxd.mem.sampled",     "lxd.mem.sampled[%s]"},
+        {"lxd.top",             "lxd.top[%s]"},
+        {"lxd.dev",             "lxd.dev[%s,blkio.throttle.io_service_bytes,Total]"},
+        {"lxd.dev.discovery",   "lxd.dev.discovery[%s]"},
+        {"lxd.dev.rate",        "lxd.dev.rate[%s]"},
+        {"lxd.net",             "lxd.net[%s,lo,rx_bytes]"},
+        {"lxd.net.discovery",   "lxd.net.discovery[%s]"},
+        {"lxd.pressure",        "lxd.pressure[%s,cpu]"},
+        {"lxd.stats",           "lxd.stats[%s]"},
+        {"lxd.age",             "lxd.age[%s]"},
+        {"lxd.api",             "lxd.api[%s,status]"},
+        {"lxd.module.stats",    "lxd.module.stats"},
+        {NULL}
+};
+
+typedef struct
+{
+        double          *latencies;     /* microseconds */
+        int             calls;
+        int             errors;
+        double          total;          /* seconds */
+        zbx_uint64_t    allocs;
+        char            *error;         /* first error message */
+}
+zbx_bench_stat_t;
+
+static int      bench_compare(const void *d1, const void *d2)
+{
+        double  v1 = *(const double *)d1, v2 = *(const double *)d2;
+
+        return (v1 < v2 ? -1 : v1 > v2);
+}
+
+static double   bench_percentile(const zbx_bench_stat_t *stat, int percent)
+{
+        int     i = (stat->calls * percent + 99) / 100 - 1;
+
+        return stat->latencies[0 > i ? 0 : i];
+}
+
+/* container names of a fixture tree, from the cpuset hierarchy or the cgroup2 root */
+static int      bench_containers(const char *root, char ***names)
+{
+        static const char       *prefix = "lxc.payload.";
+        char                    path[4096];
+        DIR                     *dir;
+        struct dirent           *d;
+        int                     n = 0, size = 0;
+
+        snprintf(path, sizeof(path), "%s/cpuset", root);
+
+        if (NULL == (dir = opendir(path)) && NULL == (dir = opendir(root)))
+                return 0;
+
+        while (NULL != (d = readdir(dir)))
+        {
+                if (0 != strncmp(d->d_name, prefix, strlen(prefix)))
+                        continue;
+
+                if (n == size)
+                        *names = realloc(*names, (size = 0 == size ? 1024 : size * 2) * sizeof(char *));
+
+                (*names)[n++] = strdup(d->d_name + strlen(prefix));
+        }
+
+        closedir(dir);
+
+        return n;
+}
+
+static void     bench_call(const char *item, zbx_bench_stat_t *stat)
+{
+        AGENT_RESULT    result;
+        zbx_uint64_t    allocs = zbx_stub_allocs;
+        double          started = harness_now(), elapsed;
+        char            buffer[64];
+        int             ret;
+
+        ret = harness_call(item, &result);
+        elapsed = harness_now() - started;
+
+        stat->allocs += zbx_stub_allocs - allocs;
+        stat->total += elapsed;
+        stat->latencies[stat->calls++] = elapsed * 1e6;
+
+        if (SYSINFO_RET_OK != ret)
+        {
+                if (0 == stat->errors++)
+                        stat->error = strdup(-1 == ret ? "unknown key" : harness_value(&result, buffer, sizeof(buffer)));
+        }
+
+        harness_free(&result);
+}
+
+static void     usage(const char *progname)
+{
+        fprintf(stderr, "usage: %s -r cgroup_root [-n rounds] [-c Key=Value]... [-t timeout] [-l log_level]\n",
+                        progname);
+        exit(EXIT_FAILURE);
+}
+
+int     main(int argc, char **argv)
+{
+        zbx_bench_stat_t        stats[sizeof(bench_keys) / sizeof(bench_keys[0])], *stat;
+        ZBX_METRIC              *metric;
+        char                    *root = NULL, *config[32], **names = NULL, item[256];
+        int                     opt, nconfig = 0, timeout = 3, rounds = 3, containers, round, i, k, slow = 0;
+        double                  cycle = 0, total = 0;
+        zbx_uint64_t            calls = 0;
+
+        while (-1 != (opt = getopt(argc, argv, "r:n:c:t:l:")))
+        {
+                switch (opt)
+                {
+                        case 'r':
+                                root = optarg;
+                                break;
+                        case 'n':
+                                rounds = atoi(optarg);
+                                break;
+                        case 'c':
+                                if (32 > nconfig)
+                                        config[nconfig++] = optarg;
+                                break;
+                        case 't':
+                                timeout = atoi(optarg);
+                                break;
+                        case 'l':
+                                zbx_stub_log_level = atoi(optarg);
+                                break;
+                        default:
+                                usage(argv[0]);
+                }
+        }
+
+        if (NULL == root || 1 > rounds)
+                usage(argv[0]);
+
+        if (0 == (containers = bench_containers(root, &names)))
+        {
+                fprintf(stderr, "no containers under %s\n", root);
+                return EXIT_FAILURE;
+        }
+
+        if (SUCCEED != harness_init(root, config, nconfig, timeout))
+        {
+                fprintf(stderr, "cannot load the module\n");
+                return EXIT_FAILURE;
+        }
+
+        for (metric = zbx_module_item_list(); NULL != metric->key; metric++)
+        {
+                for (k = 0; NULL != bench_keys[k].key; k++)
+                {
+                        if (0 == strcmp(bench_keys[k].key, metric->key))
+                                break;
+                }
+
+                if (NULL == bench_keys[k].key)
+                        fprintf(stderr, "warning: key %s is not benchmarked\n", metric->key);
+        }
+
+        for (k = 0; NULL != bench_keys[k].key; k++)
+        {
+                memset(&stats[k], 0, sizeof(stats[k]));
+                stats[k].latencies = malloc(sizeof(double) * (size_t)rounds *
+                                (NULL != strstr(bench_keys[k].item, "%s") ? containers : 10));
+        }
+
+        for (round = 0; round < rounds; round++)
+        {
+                for (k = 0; NULL != bench_keys[k].key; k++)
+                {
+                        if (NULL == strstr(bench_keys[k].item, "%s"))
+                        {
+                                for (i = 0; i < 10; i++)
+                                        bench_call(bench_keys[k].item, &stats[k]);
+
+                                continue;
+                        }
+
+                        for (i = 0; i < containers; i++)
+                        {
+                                snprintf(item, sizeof(item), bench_keys[k].item, names[i]);
+                                bench_call(item, &stats[k]);
+                        }
+                }
+        }
+
+        printf("%d containers, %d rounds, Timeout=%d\n\n", containers, rounds, timeout);
+        printf("%-58s %7s %6s %9s %9s %9s %9s %10s %8s\n", "item", "calls", "errors", "p50_us", "p95_us",
+                        "p99_us", "max_us", "calls/s", "allocs");
+
+        for (k = 0; NULL != bench_keys[k].key; k++)
+        {
+                stat = &stats[k];
+                qsort(stat->latencies, (size_t)stat->calls, sizeof(double), bench_compare);
+
+                printf("%-58s %7d %6d %9.1f %9.1f %9.1f %9.1f %10.0f %8.1f\n", bench_keys[k].item, stat->calls,
+                                stat->errors, bench_percentile(stat, 50), bench_percentile(stat, 95),
+                                bench_percentile(stat, 99), stat->latencies[stat->calls - 1],
+                                stat->calls / stat->total, (double)stat->allocs / stat->calls);
+
+                if (stat->latencies[stat->calls - 1] >= timeout * 1e6)
+                        slow++;
+
+                if (NULL != strstr(bench_keys[k].item, "%s"))
+                        cycle += stat->total / rounds;
+
+                calls += stat->calls;
+                total += stat->total;
+        }
+
+        printf("\n" ZBX_FS_UI64 " calls in %.3f s, %.0f calls/s\n", calls, total, calls / total);
+        printf("one poll of every per-container item of all %d containers: %.3f s\n", containers, cycle);
+
+        for (k = 0; NULL != bench_keys[k].key; k++)
+        {
+                if (0 != stats[k].errors)
+                        printf("%s: %d errors, first: %s\n", bench_keys[k].item, stats[k].errors, stats[k].error);
+
+                free(stats[k].latencies);
+                free(stats[k].error);
+        }
+
+        if (0 != slow)
+                printf("%d items took longer than Timeout\n", slow);
+
+        harness_uninit();
+
+        for (i = 0; i < containers; i++)
+                free(names[i]);
+
+        free(names);
+
+        return (0 == slow ? EXIT_SUCCESS : EXIT_FAILURE);
+}
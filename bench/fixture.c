@@ -0,0 +1,280 @@
+/*
+** Generates a cgroup tree of LXD containers for CgroupRoot, e.g.
+**
+**   out/fixture -v 1 -n 1000 out/v1
+**
+** v1 trees have cpuset, cpu,cpuacct (with cpu and cpuacct links), memory,
+** blkio and unified hierarchies, cgroup2 trees a single hierarchy with
+** cgroup.controllers. Every container gets the stat files the module reads
+** with realistic contents; values are pseudo-random but the same for the same
+** container number. cgroup.procs lists pid 1 so the process keys find a
+** process to read. -m sets memory.max of a cgroup2 root, as seen by an agent
+** in a memory limited container.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+typedef uint64_t        zbx_uint64_t;
+
+static char             *root;
+static const char       *driver = "lxc.payload.";
+static zbx_uint64_t     seed;
+static const char       *parent_limit;
+
+/* xorshift, deterministic per container */
+static zbx_uint64_t     fixture_random(zbx_uint64_t max)
+{
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        return (0 == max ? seed : seed % max);
+}
+
+static void     fixture_mkdir(const char *path)
+{
+        char    buffer[4096], *p;
+
+        snprintf(buffer, sizeof(buffer), "%s", path);
+
+        for (p = buffer + 1; '\0' != *p; p++)
+        {
+                if ('/' != *p)
+                        continue;
+
+                *p = '\0';
+                mkdir(buffer, 0755);
+                *p = '/';
+        }
+
+        if (0 != mkdir(buffer, 0755) && EEXIST != errno)
+        {
+                fprintf(stderr, "cannot create %s: %s\n", buffer, strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+}
+
+static void     fixture_file(const char *dir, const char *file, const char *fmt, ...)
+{
+        char    path[4096];
+        FILE    *f;
+        va_list args;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+        if (NULL == (f = fopen(path, "w")))
+        {
+                fprintf(stderr, "cannot write %s: %s\n", path, strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        va_start(args, fmt);
+        vfprintf(f, fmt, args);
+        va_end(args);
+
+        fclose(f);
+}
+
+/* directory of a container under a hierarchy, "" for the cgroup2 root */
+static void     fixture_dir(char *dir, size_t size, const char *hierarchy, const char *name)
+{
+        snprintf(dir, size, "%s/%s%s%s", root, hierarchy, '\0' != *hierarchy ? "/" : "", driver);
+        snprintf(dir + strlen(dir), size - strlen(dir), "%s", name);
+        fixture_mkdir(dir);
+        fixture_file(dir, "cgroup.procs", "1\n");
+}
+
+static void     fixture_pressure(const char *dir)
+{
+        static const char       *resources[] = {"cpu", "memory", "io"};
+        char                    file[32];
+        int                     i;
+
+        for (i = 0; i < 3; i++)
+        {
+                snprintf(file, sizeof(file), "%s.pressure", resources[i]);
+                fixture_file(dir, file, "some avg10=%d.%02d avg60=%d.%02d avg300=%d.%02d total=%lu\n"
+                                "full avg10=0.00 avg60=0.00 avg300=0.00 total=%lu\n",
+                                (int)fixture_random(5), (int)fixture_random(100), (int)fixture_random(5),
+                                (int)fixture_random(100), (int)fixture_random(5), (int)fixture_random(100),
+                                fixture_random(1000000000), fixture_random(1000000));
+        }
+}
+
+static void     fixture_v1(const char *name)
+{
+        zbx_uint64_t    rss = 16 * 1048576 + fixture_random(1024) * 1048576, cache = fixture_random(512) * 1048576,
+                        limit = (0 == fixture_random(2) ? 0x7ffffffffffff000 : 4096 * 1048576ULL),
+                        user = fixture_random(10000000), system = fixture_random(5000000),
+                        read = fixture_random(1ULL << 40), write = fixture_random(1ULL << 40);
+        char            dir[4096];
+
+        fixture_dir(dir, sizeof(dir), "cpuset", name);
+        fixture_file(dir, "cpuset.cpus", "0-3\n");
+        fixture_file(dir, "cpuset.effective_cpus", "0-3\n");
+
+        fixture_dir(dir, sizeof(dir), "cpu,cpuacct", name);
+        fixture_file(dir, "cpuacct.stat", "user %lu\nsystem %lu\n", user, system);
+        fixture_file(dir, "cpuacct.usage", "%lu\n", (user + system) * 10000000);
+        fixture_file(dir, "cpu.stat", "nr_periods %lu\nnr_throttled %lu\nthrottled_time %lu\n",
+                        fixture_random(100000), fixture_random(1000), fixture_random(1000000000));
+        fixture_file(dir, "cpu.cfs_quota_us", "%s\n", 0 == fixture_random(2) ? "-1" : "200000");
+        fixture_file(dir, "cpu.cfs_period_us", "100000\n");
+
+        fixture_dir(dir, sizeof(dir), "memory", name);
+        fixture_file(dir, "memory.stat",
+                        "cache %lu\nrss %lu\nrss_huge 0\nshmem %lu\nmapped_file %lu\ndirty %lu\nwriteback 0\n"
+                        "swap 0\npgpgin %lu\npgpgout %lu\npgfault %lu\npgmajfault %lu\ninactive_anon %lu\n"
+                        "active_anon %lu\ninactive_file %lu\nactive_file %lu\nunevictable 0\n"
+                        "hierarchical_memory_limit %lu\nhierarchical_memsw_limit %lu\n"
+                        "total_cache %lu\ntotal_rss %lu\ntotal_rss_huge 0\ntotal_shmem %lu\ntotal_mapped_file %lu\n"
+                        "total_dirty %lu\ntotal_writeback 0\ntotal_swap 0\ntotal_pgpgin %lu\ntotal_pgpgout %lu\n"
+                        "total_pgfault %lu\ntotal_pgmajfault %lu\ntotal_inactive_anon %lu\n"
+                        "total_active_anon %lu\ntotal_inactive_file %lu\ntotal_active_file %lu\n"
+                        "total_unevictable 0\n",
+                        cache, rss, cache / 16, cache / 4, cache / 64, rss / 1024, rss / 2048,
+                        rss / 256, rss / 65536, rss / 8, rss - rss / 8, cache / 2, cache - cache / 2, limit, limit,
+                        cache, rss, cache / 16, cache / 4, cache / 64, rss / 1024, rss / 2048, rss / 256,
+                        rss / 65536, rss / 8, rss - rss / 8, cache / 2, cache - cache / 2);
+        fixture_file(dir, "memory.usage_in_bytes", "%lu\n", rss + cache + 4096 * fixture_random(256));
+        fixture_file(dir, "memory.limit_in_bytes", "%lu\n", limit);
+        fixture_file(dir, "memory.oom_control", "oom_kill_disable 0\nunder_oom 0\noom_kill %lu\n",
+                        fixture_random(3));
+        fixture_file(dir, "memory.failcnt", "%lu\n", fixture_random(10));
+
+        fixture_dir(dir, sizeof(dir), "blkio", name);
+        fixture_file(dir, "blkio.throttle.io_service_bytes",
+                        "8:0 Read %lu\n8:0 Write %lu\n8:0 Sync %lu\n8:0 Async 0\n8:0 Discard 0\n8:0 Total %lu\n"
+                        "253:0 Read %lu\n253:0 Write %lu\n253:0 Sync %lu\n253:0 Async 0\n253:0 Discard 0\n"
+                        "253:0 Total %lu\nTotal %lu\n",
+                        read, write, read + write, read + write, read, write, read + write, read + write,
+                        2 * (read + write));
+        fixture_file(dir, "blkio.throttle.io_serviced",
+                        "8:0 Read %lu\n8:0 Write %lu\n8:0 Sync %lu\n8:0 Async 0\n8:0 Discard 0\n8:0 Total %lu\n"
+                        "253:0 Read %lu\n253:0 Write %lu\n253:0 Sync %lu\n253:0 Async 0\n253:0 Discard 0\n"
+                        "253:0 Total %lu\nTotal %lu\n",
+                        read / 4096, write / 4096, (read + write) / 4096, (read + write) / 4096, read / 4096,
+                        write / 4096, (read + write) / 4096, (read + write) / 4096, 2 * (read + write) / 4096);
+
+        fixture_dir(dir, sizeof(dir), "unified", name);
+        fixture_pressure(dir);
+}
+
+static void     fixture_v2(const char *name)
+{
+        zbx_uint64_t    anon = 16 * 1048576 + fixture_random(1024) * 1048576, file = fixture_random(512) * 1048576,
+                        user = fixture_random(100000000000), system = fixture_random(50000000000),
+                        read = fixture_random(1ULL << 40), write = fixture_random(1ULL << 40);
+        char            dir[4096];
+
+        fixture_dir(dir, sizeof(dir), "", name);
+        fixture_file(dir, "cpuset.cpus.effective", "0-3\n");
+        fixture_file(dir, "cpu.stat", "usage_usec %lu\nuser_usec %lu\nsystem_usec %lu\nnr_periods %lu\n"
+                        "nr_throttled %lu\nthrottled_usec %lu\n", user + system, user, system,
+                        fixture_random(100000), fixture_random(1000), fixture_random(1000000));
+        fixture_file(dir, "cpu.max", "%s 100000\n", 0 == fixture_random(2) ? "max" : "200000");
+        fixture_file(dir, "memory.stat",
+                        "anon %lu\nfile %lu\nkernel_stack %lu\npagetables %lu\npercpu %lu\nsock 0\nshmem %lu\n"
+                        "file_mapped %lu\nfile_dirty %lu\nfile_writeback 0\nswapcached 0\nanon_thp 0\nfile_thp 0\n"
+                        "shmem_thp 0\ninactive_anon %lu\nactive_anon %lu\ninactive_file %lu\nactive_file %lu\n"
+                        "unevictable 0\nslab_reclaimable %lu\nslab_unreclaimable %lu\nslab %lu\n"
+                        "workingset_refault_anon 0\nworkingset_refault_file %lu\nworkingset_activate_anon 0\n"
+                        "workingset_activate_file %lu\nworkingset_restore_anon 0\nworkingset_restore_file %lu\n"
+                        "workingset_nodereclaim 0\npgfault %lu\npgmajfault %lu\npgrefill 0\npgscan 0\npgsteal 0\n"
+                        "pgactivate %lu\npgdeactivate 0\npglazyfree 0\npglazyfreed 0\nthp_fault_alloc 0\n"
+                        "thp_collapse_alloc 0\n",
+                        anon, file, anon / 256, anon / 128, anon / 512, file / 16, file / 4, file / 64,
+                        anon / 8, anon - anon / 8, file / 2, file - file / 2, file / 32, file / 64,
+                        file / 32 + file / 64, file / 4096, file / 8192, file / 16384, anon / 256,
+                        anon / 65536, file / 4096);
+        fixture_file(dir, "memory.current", "%lu\n", anon + file + 4096 * fixture_random(256));
+        fixture_file(dir, "memory.max", "%s\n", 0 == fixture_random(2) ? "max" : "4294967296");
+        fixture_file(dir, "memory.swap.current", "0\n");
+        fixture_file(dir, "memory.events", "low 0\nhigh 0\nmax %lu\noom %lu\noom_kill %lu\n",
+                        fixture_random(10), fixture_random(3), fixture_random(3));
+        fixture_file(dir, "io.stat", "8:0 rbytes=%lu wbytes=%lu rios=%lu wios=%lu dbytes=0 dios=0\n"
+                        "253:0 rbytes=%lu wbytes=%lu rios=%lu wios=%lu dbytes=0 dios=0\n",
+                        read, write, read / 4096, write / 4096, read, write, read / 4096, write / 4096);
+        fixture_pressure(dir);
+}
+
+static void     usage(const char *progname)
+{
+        fprintf(stderr, "usage: %s [-v 1|2] [-n containers] [-d lxc.payload.|lxc.payload/|lxc/] [-m limit] dir\n", progname);
+        exit(EXIT_FAILURE);
+}
+
+int     main(int argc, char **argv)
+{
+        char    name[64], path[4096];
+        int     opt, version = 1, containers = 1000, i;
+
+        while (-1 != (opt = getopt(argc, argv, "v:n:d:m:")))
+        {
+                switch (opt)
+                {
+                        case 'v':
+                                version = atoi(optarg);
+                                break;
+                        case 'n':
+                                containers = atoi(optarg);
+                                break;
+                        case 'd':
+                                driver = optarg;
+                                break;
+                        case 'm':
+                                parent_limit = optarg;
+                                break;
+                        default:
+                                usage(argv[0]);
+                }
+        }
+
+        if (optind + 1 != argc || (1 != version && 2 != version))
+                usage(argv[0]);
+
+        root = argv[optind];
+        fixture_mkdir(root);
+
+        if (1 == version)
+        {
+                snprintf(path, sizeof(path), "%s/cpu,cpuacct", root);
+                fixture_mkdir(path);
+                snprintf(path, sizeof(path), "%s/cpu", root);
+                symlink("cpu,cpuacct", path);
+                snprintf(path, sizeof(path), "%s/cpuacct", root);
+                symlink("cpu,cpuacct", path);
+        }
+        else
+        {
+                fixture_file(root, "cgroup.controllers", "cpuset cpu io memory pids\n");
+                fixture_file(root, "cgroup.subtree_control", "cpuset cpu io memory pids\n");
+
+                // the tree is the cgroup namespace of a limited container, e.g. the agent in nested LXD
+                if (NULL != parent_limit)
+                        fixture_file(root, "memory.max", "%s\n", parent_limit);
+        }
+
+        for (i = 1; i <= containers; i++)
+        {
+                seed = 0x9e3779b97f4a7c15ULL * i;
+                snprintf(name, sizeof(name), "c%04d", i);
+
+                if (1 == version)
+                        fixture_v1(name);
+                else
+                        fixture_v2(name);
+        }
+
+        printf("%d containers of cgroup v%d under %s\n", containers, version, root);
+
+        return EXIT_SUCCESS;
+}
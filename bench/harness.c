@@ -0,0 +1,151 @@
+/*
+** Minimal agent side of the module interface, see harness.h.
+*/
+
+#include "harness.h"
+
+#include <time.h>
+
+/******************************************************************************
+ *                                                                            *
+ * Function: harness_init                                                     *
+ *                                                                            *
+ * Purpose: write the module configuration file and load the module          *
+ *                                                                            *
+ * Parameters: cgroup_root - [IN] CgroupRoot, NULL uses the mounted cgroups   *
+ *             config      - [IN] further Key=Value configuration lines       *
+ *             nconfig     - [IN] number of lines                             *
+ *             timeout     - [IN] agent Timeout passed to the module          *
+ *                                                                            *
+ ******************************************************************************/
+int     harness_init(const char *cgroup_root, char * const *config, int nconfig, int timeout)
+{
+        FILE    *f;
+        int     i;
+
+        if (NULL == (f = fopen(ZBX_MODULE_LXD_CONFIG_FILE, "w")))
+        {
+                fprintf(stderr, "cannot write %s: %s\n", ZBX_MODULE_LXD_CONFIG_FILE, strerror(errno));
+                return FAIL;
+        }
+
+        if (NULL != cgroup_root)
+                fprintf(f, "CgroupRoot=%s\n", cgroup_root);
+
+        for (i = 0; i < nconfig; i++)
+                fprintf(f, "%s\n", config[i]);
+
+        fclose(f);
+
+        zbx_module_item_timeout(timeout);
+
+        return (ZBX_MODULE_OK == zbx_module_init() ? SUCCEED : FAIL);
+}
+
+void    harness_uninit(void)
+{
+        zbx_module_uninit();
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: harness_call                                                     *
+ *                                                                            *
+ * Purpose: split an item key into the key and its parameters and call the   *
+ *          module handler                                                    *
+ *                                                                            *
+ * Parameters: item   - [IN] item key, e.g. lxd.mem[c1,"total_rss"]            *
+ *             result - [OUT] the result, free it with harness_free()         *
+ *                                                                            *
+ * Return value: SYSINFO_RET_OK, SYSINFO_RET_FAIL or -1 if the module has no  *
+ *               such key                                                     *
+ *                                                                            *
+ ******************************************************************************/
+int     harness_call(const char *item, AGENT_RESULT *result)
+{
+        ZBX_METRIC      *metric;
+        AGENT_REQUEST   request;
+        char            *key, *p, *out, *params[16];
+        int             ret, quoted;
+
+        memset(&request, 0, sizeof(request));
+        memset(result, 0, sizeof(*result));
+
+        key = strdup(item);
+
+        if (NULL != (p = strchr(key, '[')))
+        {
+                *p++ = '\0';
+
+                for (params[request.nparam++] = out = p, quoted = 0; '\0' != *p && ']' != *p; p++)
+                {
+                        if ('"' == *p)
+                                quoted = !quoted;
+                        else if (',' == *p && 0 == quoted && 16 > request.nparam)
+                        {
+                                *out++ = '\0';
+                                params[request.nparam++] = out;
+                        }
+                        else
+                                *out++ = *p;
+                }
+
+                *out = '\0';
+        }
+
+        for (metric = zbx_module_item_list(); NULL != metric->key; metric++)
+        {
+                if (0 == strcmp(metric->key, key))
+                        break;
+        }
+
+        if (NULL == metric->key)
+        {
+                free(key);
+                return -1;
+        }
+
+        request.key = key;
+        request.params = params;
+        ret = metric->function(&request, result);
+        free(key);
+
+        return ret;
+}
+
+/* text of the result value */
+const char      *harness_value(const AGENT_RESULT *result, char *buffer, size_t size)
+{
+        if (0 != (result->type & AR_UINT64))
+                snprintf(buffer, size, ZBX_FS_UI64, result->ui64);
+        else if (0 != (result->type & AR_DOUBLE))
+                snprintf(buffer, size, "%.6f", result->dbl);
+        else if (0 != (result->type & AR_STRING))
+                return result->str;
+        else if (0 != (result->type & AR_TEXT))
+                return result->text;
+        else if (0 != (result->type & AR_MESSAGE))
+                return result->msg;
+        else
+                zbx_strlcpy(buffer, "", size);
+
+        return buffer;
+}
+
+void    harness_free(AGENT_RESULT *result)
+{
+        zbx_free(result->str);
+        zbx_free(result->text);
+        zbx_free(result->msg);
+        result->type = 0;
+}
+
+/* monotonic seconds for latency measurements */
+double  harness_now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
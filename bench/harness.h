@@ -0,0 +1,29 @@
+/*
+** Minimal agent side of the module interface: writes the module configuration,
+** loads the module and calls item keys the way zabbix_agentd does.
+*/
+#ifndef ZABBIX_LXD_HARNESS_H
+#define ZABBIX_LXD_HARNESS_H
+
+#include "common.h"
+#include "module.h"
+
+extern int              zbx_stub_log_level;
+extern zbx_uint64_t     zbx_stub_allocs;
+
+/* entry points of the module, tests including the module source get them from there */
+#ifndef ZABBIX_LXD_HARNESS_MODULE
+ZBX_METRIC      *zbx_module_item_list(void);
+int     zbx_module_init(void);
+int     zbx_module_uninit(void);
+void    zbx_module_item_timeout(int timeout);
+#endif
+
+int     harness_init(const char *cgroup_root, char * const *config, int nconfig, int timeout);
+void    harness_uninit(void);
+int     harness_call(const char *item, AGENT_RESULT *result);
+const char      *harness_value(const AGENT_RESULT *result, char *buffer, size_t size);
+void    harness_free(AGENT_RESULT *result);
+double  harness_now(void);
+
+#endif
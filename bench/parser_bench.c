@@ -0,0 +1,255 @@
+/*
+** Compares the stat file parser of the module with the fgets/sscanf path it
+** replaced, on a memory.stat of a fixture tree:
+**
+**   out/parser_bench -f out/v1/memory/lxc.payload.c0001/memory.stat -m total_rss
+**
+** "lookup" is what one item costs: open the file and find one metric, the old
+** way line by line with fgets, strncmp and sscanf, the new way with one read()
+** and zbx_lxd_snapshot_parse(). "parse" is the file content already in memory
+** split into all of its values, the way a snapshot is filled. Allocations are
+** the ones of the code under test, stdio buffers of fopen() are not counted.
+*/
+
+#include "../zabbix_module_lxd.c"
+#define ZABBIX_LXD_HARNESS_MODULE
+#include "harness.h"
+
+#define PARSER_BUFFER   65536
+
+/* lookup of one metric like the items did before the snapshot parser */
+static int      legacy_lookup(const char *filename, const char *metric, zbx_uint64_t *value)
+{
+        FILE    *file;
+        char    line[MAX_STRING_LEN], *metric2;
+        int     ret = FAIL;
+
+        if (NULL == (file = fopen(filename, "r")))
+                return FAIL;
+
+        metric2 = malloc(strlen(metric) + 3);
+        memcpy(metric2, metric, strlen(metric));
+        memcpy(metric2 + strlen(metric), " ", 2);
+
+        while (NULL != fgets(line, sizeof(line), file))
+        {
+                if (0 != strncmp(line, metric2, strlen(metric2)))
+                        continue;
+
+                if (1 != sscanf(line, "%*s " ZBX_FS_UI64, value))
+                        continue;
+
+                ret = SUCCEED;
+                break;
+        }
+
+        fclose(file);
+        free(metric2);
+
+        return ret;
+}
+
+/* all values of a file like the first snapshots were filled, before the single-read parser */
+static void     legacy_parse(zbx_lxd_snapshot_t *snapshot, char *buf, size_t len)
+{
+        FILE            *file;
+        char            line[MAX_STRING_LEN], key[MAX_STRING_LEN], subkey[MAX_STRING_LEN];
+        zbx_uint64_t    value;
+        zbx_lxd_stat_t  *stat;
+
+        if (NULL == (file = fmemopen(buf, len, "r")))
+                return;
+
+        snapshot->nstats = 0;
+
+        while (NULL != fgets(line, sizeof(line), file))
+        {
+                if (2 == sscanf(line, "%s " ZBX_FS_UI64, key, &value))
+                        *subkey = '\0';
+                else if (3 != sscanf(line, "%s %s " ZBX_FS_UI64, key, subkey, &value))
+                        continue;
+
+                if (snapshot->nstats == snapshot->stats_alloc)
+                {
+                        snapshot->stats_alloc += 32;
+                        snapshot->stats = zbx_realloc(snapshot->stats, snapshot->stats_alloc * sizeof(zbx_lxd_stat_t));
+                }
+
+                stat = &snapshot->stats[snapshot->nstats];
+
+                if ('\0' == *subkey)
+                        zbx_strlcpy(stat->key, key, sizeof(stat->key));
+                else
+                        zbx_snprintf(stat->key, sizeof(stat->key), "%s %s", key, subkey);
+
+                stat->value = value;
+                snapshot->nstats++;
+        }
+
+        fclose(file);
+}
+
+/* lookup of one metric the way the module does it now */
+static int      parser_lookup(const char *filename, const char *metric, zbx_lxd_snapshot_t *snapshot, char *buf,
+                zbx_uint64_t *value)
+{
+        ssize_t n;
+        int     fd;
+
+        if (-1 == (fd = open(filename, O_RDONLY)))
+                return FAIL;
+
+        n = read(fd, buf, PARSER_BUFFER);
+        close(fd);
+
+        if (0 > n)
+                return FAIL;
+
+        zbx_lxd_snapshot_parse(snapshot, buf, (size_t)n);
+
+        return zbx_lxd_snapshot_value(snapshot, metric, value);
+}
+
+typedef struct
+{
+        const char      *name;
+        double          seconds;
+        zbx_uint64_t    allocs;
+        int             values;         /* values found by the last call */
+}
+parser_result_t;
+
+static void     parser_report(const parser_result_t *result, int iterations)
+{
+        printf("%-28s %10.0f %12.0f %9.2f %7d\n", result->name, result->seconds * 1e9 / iterations,
+                        iterations / result->seconds, (double)result->allocs / iterations, result->values);
+}
+
+static void     usage(const char *progname)
+{
+        fprintf(stderr, "usage: %s -f stat_file [-m metric] [-n iterations]\n", progname);
+        exit(EXIT_FAILURE);
+}
+
+int     main(int argc, char **argv)
+{
+        parser_result_t         results[4];
+        zbx_lxd_snapshot_t      legacy, parser;
+        const char              *filename = NULL, *metric = "total_rss";
+        char                    *buf;
+        zbx_uint64_t            allocs, legacy_value = 0, parser_value = 0;
+        double                  started;
+        ssize_t                 len;
+        int                     opt, iterations = 100000, i, fd, failed = 0;
+
+        while (-1 != (opt = getopt(argc, argv, "f:m:n:")))
+        {
+                switch (opt)
+                {
+                        case 'f':
+                                filename = optarg;
+                                break;
+                        case 'm':
+                                metric = optarg;
+                                break;
+                        case 'n':
+                                iterations = atoi(optarg);
+                                break;
+                        default:
+                                usage(argv[0]);
+                }
+        }
+
+        if (NULL == filename || 1 > iterations)
+                usage(argv[0]);
+
+        // the file content is kept at the start, the lookups read behind it
+        buf = malloc(2 * PARSER_BUFFER);
+
+        if (-1 == (fd = open(filename, O_RDONLY)) || 0 >= (len = read(fd, buf, PARSER_BUFFER)))
+        {
+                fprintf(stderr, "cannot read %s\n", filename);
+                return EXIT_FAILURE;
+        }
+        close(fd);
+
+        memset(&legacy, 0, sizeof(legacy));
+        memset(&parser, 0, sizeof(parser));
+        memset(results, 0, sizeof(results));
+
+        results[0].name = "fgets/sscanf lookup";
+        allocs = zbx_stub_allocs;
+        started = harness_now();
+        for (i = 0; i < iterations; i++)
+                results[0].values = (SUCCEED == legacy_lookup(filename, metric, &legacy_value));
+        results[0].seconds = harness_now() - started;
+        results[0].allocs = zbx_stub_allocs - allocs;
+
+        results[1].name = "read+parse lookup";
+        allocs = zbx_stub_allocs;
+        started = harness_now();
+        for (i = 0; i < iterations; i++)
+                results[1].values = (SUCCEED == parser_lookup(filename, metric, &parser, buf + len, &parser_value));
+        results[1].seconds = harness_now() - started;
+        results[1].allocs = zbx_stub_allocs - allocs;
+
+        results[2].name = "fgets/sscanf parse";
+        allocs = zbx_stub_allocs;
+        started = harness_now();
+        for (i = 0; i < iterations; i++)
+                legacy_parse(&legacy, buf, (size_t)len);
+        results[2].seconds = harness_now() - started;
+        results[2].allocs = zbx_stub_allocs - allocs;
+        results[2].values = legacy.nstats;
+
+        results[3].name = "zbx_lxd_snapshot_parse";
+        allocs = zbx_stub_allocs;
+        started = harness_now();
+        for (i = 0; i < iterations; i++)
+                zbx_lxd_snapshot_parse(&parser, buf, (size_t)len);
+        results[3].seconds = harness_now() - started;
+        results[3].allocs = zbx_stub_allocs - allocs;
+        results[3].values = parser.nstats;
+
+        printf("%s, %d bytes, metric %s, %d iterations\n\n", filename, (int)len, metric, iterations);
+        printf("%-28s %10s %12s %9s %7s\n", "", "ns/call", "calls/s", "allocs", "values");
+
+        for (i = 0; i < 4; i++)
+                parser_report(&results[i], iterations);
+
+        printf("\nlookup %.1fx, parse %.1fx faster\n", results[0].seconds / results[1].seconds,
+                        results[2].seconds / results[3].seconds);
+
+        // both paths have to agree, otherwise the comparison is meaningless
+        if (results[0].values != results[1].values || legacy_value != parser_value)
+        {
+                printf("FAIL: %s is " ZBX_FS_UI64 " with fgets/sscanf and " ZBX_FS_UI64 " with the parser\n",
+                                metric, legacy_value, parser_value);
+                failed++;
+        }
+
+        if (legacy.nstats != parser.nstats)
+        {
+                printf("FAIL: %d values with fgets/sscanf and %d with the parser\n", legacy.nstats, parser.nstats);
+                failed++;
+        }
+
+        for (i = 0; i < legacy.nstats && i < parser.nstats; i++)
+        {
+                if (0 != strcmp(legacy.stats[i].key, parser.stats[i].key) ||
+                                legacy.stats[i].value != parser.stats[i].value)
+                {
+                        printf("FAIL: line %d is %s " ZBX_FS_UI64 " with fgets/sscanf and %s " ZBX_FS_UI64
+                                        " with the parser\n", i + 1, legacy.stats[i].key, legacy.stats[i].value,
+                                        parser.stats[i].key, parser.stats[i].value);
+                        failed++;
+                        break;
+                }
+        }
+
+        free(legacy.stats);
+        free(parser.stats);
+        free(buf);
+
+        return (0 == failed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,266 @@
+/*
+** Checks PushServer mode against a stand-in trapper listening on localhost:
+**
+**   out/push_test -r out/v2
+**
+** The trapper takes two sender requests, checks that every container of the
+** tree is pushed with lxd.up 1 and an lxd.stats object and answers like the
+** Zabbix server does. The module is built into the test so that it can also
+** check that the push thread left the container cache and the reader of the
+** agent process alone; the agent processes are forked from the process the
+** thread runs in.
+*/
+
+#include "../zabbix_module_lxd.c"
+#define ZABBIX_LXD_HARNESS_MODULE
+#include "harness.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PUSH_REQUESTS   2
+
+typedef struct
+{
+        int             listener;
+        int             requests;
+        int             up;             /* lxd.up values of 1 in the last request */
+        int             stats;          /* lxd.stats values with a memory object in the last request */
+        int             errors;
+        pthread_mutex_t lock;
+        pthread_cond_t  cond;
+}
+push_trapper_t;
+
+static int      push_read(int fd, char *buffer, size_t len)
+{
+        ssize_t n;
+
+        for (; 0 < len; buffer += n, len -= n)
+        {
+                if (0 >= (n = read(fd, buffer, len)))
+                        return FAIL;
+        }
+
+        return SUCCEED;
+}
+
+/* counts the values of one sender request, returns FAIL if it is not a valid one */
+static int      push_check(const char *data, int *up, int *stats)
+{
+        struct zbx_json_parse   jp, jp_data, jp_row, jp_stats;
+        const char              *p = NULL, *value;
+        char                    request[64], key[MAX_STRING_LEN], *string = NULL;
+        size_t                  string_alloc = 0;
+        int                     is_null;
+
+        *up = *stats = 0;
+
+        if (SUCCEED != zbx_json_open(data, &jp) ||
+                        SUCCEED != zbx_json_value_by_name(&jp, ZBX_PROTO_TAG_REQUEST, request, sizeof(request)) ||
+                        0 != strcmp(request, ZBX_PROTO_VALUE_SENDER_DATA) ||
+                        SUCCEED != zbx_json_brackets_by_name(&jp, ZBX_PROTO_TAG_DATA, &jp_data))
+        {
+                return FAIL;
+        }
+
+        while (NULL != (p = zbx_json_next(&jp_data, p)))
+        {
+                if (SUCCEED != zbx_json_brackets_open(p, &jp_row) ||
+                                SUCCEED != zbx_json_value_by_name(&jp_row, ZBX_PROTO_TAG_KEY, key, sizeof(key)) ||
+                                NULL == (value = zbx_json_pair_by_name(&jp_row, ZBX_PROTO_TAG_VALUE)) ||
+                                NULL == zbx_json_decodevalue_dyn(value, &string, &string_alloc, &is_null))
+                {
+                        free(string);
+                        return FAIL;
+                }
+
+                if (0 == strncmp(key, "lxd.up[", 7) && 0 == strcmp(string, "1"))
+                        (*up)++;
+                else if (0 == strncmp(key, "lxd.stats[", 10) && SUCCEED == zbx_json_open(string, &jp_stats) &&
+                                SUCCEED == zbx_json_brackets_by_name(&jp_stats, "memory", &jp_row))
+                {
+                        (*stats)++;
+                }
+        }
+
+        free(string);
+
+        return SUCCEED;
+}
+
+/* the stand-in trapper */
+static void     *push_trapper(void *arg)
+{
+        static const char       *response = "{\"response\":\"success\",\"info\":\"processed: 0; failed: 0\"}";
+        push_trapper_t          *trapper = (push_trapper_t *)arg;
+        char                    header[13], *data;
+        zbx_uint64_t            len;
+        int                     fd, up, stats, ret;
+
+        while (PUSH_REQUESTS > trapper->requests && -1 != (fd = accept(trapper->listener, NULL, NULL)))
+        {
+                data = NULL;
+                up = stats = 0;
+
+                if (SUCCEED == (ret = push_read(fd, header, sizeof(header))) && 0 == memcmp(header, "ZBXD\1", 5))
+                {
+                        memcpy(&len, header + 5, sizeof(len));
+                        data = malloc(len + 1);
+
+                        if (SUCCEED == (ret = push_read(fd, data, len)))
+                        {
+                                data[len] = '\0';
+                                ret = push_check(data, &up, &stats);
+                        }
+                }
+                else
+                        ret = FAIL;
+
+                len = strlen(response);
+                memcpy(header + 5, &len, sizeof(len));
+                if (sizeof(header) != write(fd, header, sizeof(header)) || (ssize_t)len != write(fd, response, len))
+                        ret = FAIL;
+                close(fd);
+                free(data);
+
+                pthread_mutex_lock(&trapper->lock);
+                trapper->requests++;
+                trapper->up = up;
+                trapper->stats = stats;
+                if (SUCCEED != ret)
+                        trapper->errors++;
+                pthread_cond_signal(&trapper->cond);
+                pthread_mutex_unlock(&trapper->lock);
+        }
+
+        return NULL;
+}
+
+static void     usage(const char *progname)
+{
+        fprintf(stderr, "usage: %s -r cgroup_root [-l log_level]\n", progname);
+        exit(EXIT_FAILURE);
+}
+
+int     main(int argc, char **argv)
+{
+        push_trapper_t          trapper;
+        struct sockaddr_in      addr;
+        socklen_t               addr_len = sizeof(addr);
+        struct timespec         deadline;
+        pthread_t               thread;
+        char                    *root = NULL, port[32], *config[3];
+        int                     opt, expected = 0, i, failed = 0;
+        DIR                     *dir;
+        struct dirent           *d;
+
+        while (-1 != (opt = getopt(argc, argv, "r:l:")))
+        {
+                switch (opt)
+                {
+                        case 'r':
+                                root = optarg;
+                                break;
+                        case 'l':
+                                zbx_stub_log_level = atoi(optarg);
+                                break;
+                        default:
+                                usage(argv[0]);
+                }
+        }
+
+        if (NULL == root)
+                usage(argv[0]);
+
+        // containers of a v1 tree are counted in cpuset, of a cgroup2 tree in the root
+        zbx_snprintf(port, sizeof(port), "%s/cpuset", root);
+        if (NULL == (dir = opendir(port)) && NULL == (dir = opendir(root)))
+                usage(argv[0]);
+
+        while (NULL != (d = readdir(dir)))
+        {
+                if (0 == strncmp(d->d_name, "lxc.payload.", 12))
+                        expected++;
+        }
+        closedir(dir);
+
+        memset(&trapper, 0, sizeof(trapper));
+        pthread_mutex_init(&trapper.lock, NULL);
+        pthread_cond_init(&trapper.cond, NULL);
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (-1 == (trapper.listener = socket(AF_INET, SOCK_STREAM, 0)) ||
+                        0 != bind(trapper.listener, (struct sockaddr *)&addr, sizeof(addr)) ||
+                        0 != listen(trapper.listener, 4) ||
+                        0 != getsockname(trapper.listener, (struct sockaddr *)&addr, &addr_len))
+        {
+                fprintf(stderr, "cannot listen on localhost: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+        }
+
+        pthread_create(&thread, NULL, push_trapper, &trapper);
+
+        zbx_snprintf(port, sizeof(port), "PushPort=%d", ntohs(addr.sin_port));
+        config[0] = "PushServer=127.0.0.1";
+        config[1] = port;
+        config[2] = "PushInterval=1";
+
+        if (SUCCEED != harness_init(root, config, 3, 3))
+        {
+                fprintf(stderr, "cannot load the module\n");
+                return EXIT_FAILURE;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 10;
+
+        pthread_mutex_lock(&trapper.lock);
+        while (PUSH_REQUESTS > trapper.requests &&
+                        ETIMEDOUT != pthread_cond_timedwait(&trapper.cond, &trapper.lock, &deadline))
+        {
+                ;
+        }
+        pthread_mutex_unlock(&trapper.lock);
+
+        harness_uninit();
+
+        if (PUSH_REQUESTS != trapper.requests || 0 != trapper.errors)
+        {
+                printf("FAIL: %d of %d sender requests received, %d invalid\n", trapper.requests, PUSH_REQUESTS,
+                                trapper.errors);
+                failed++;
+        }
+
+        if (expected != trapper.up || expected != trapper.stats)
+        {
+                printf("FAIL: %d containers, %d lxd.up and %d lxd.stats values pushed\n", expected, trapper.up,
+                                trapper.stats);
+                failed++;
+        }
+
+        for (i = 0; i < ZBX_LXD_BUCKETS; i++)
+        {
+                if (NULL != containers[i] || NULL != reader.buckets[i])
+                {
+                        printf("FAIL: the push thread used the container cache or the reader of the process\n");
+                        failed++;
+                        break;
+                }
+        }
+
+        if (0 == failed)
+        {
+                printf("push: OK, %d requests of %d containers to a stand-in trapper\n", trapper.requests,
+                                expected);
+        }
+
+        shutdown(trapper.listener, SHUT_RDWR);
+        close(trapper.listener);
+        pthread_join(thread, NULL);
+
+        return (0 == failed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,87 @@
+/*
+** Calls item keys of the module like zabbix_agentd -t does, e.g.
+**
+**   out/run -r out/v1 'lxd.discovery' 'lxd.mem[c0001,working_set]'
+**
+** An argument sleep=<seconds> pauses between keys, for the rate keys.
+*/
+
+#include "harness.h"
+
+#include <unistd.h>
+#include <getopt.h>
+
+static void     usage(const char *progname)
+{
+        fprintf(stderr, "usage: %s [-r cgroup_root] [-c Key=Value]... [-t timeout] [-l log_level] item...\n",
+                        progname);
+        exit(EXIT_FAILURE);
+}
+
+int     main(int argc, char **argv)
+{
+        AGENT_RESULT    result;
+        char            *root = NULL, *config[32], buffer[64];
+        int             opt, nconfig = 0, timeout = 3, i, ret, failed = 0;
+
+        while (-1 != (opt = getopt(argc, argv, "r:c:t:l:")))
+        {
+                switch (opt)
+                {
+                        case 'r':
+                                root = optarg;
+                                break;
+                        case 'c':
+                                if (32 > nconfig)
+                                        config[nconfig++] = optarg;
+                                break;
+                        case 't':
+                                timeout = atoi(optarg);
+                                break;
+                        case 'l':
+                                zbx_stub_log_level = atoi(optarg);
+                                break;
+                        default:
+                                usage(argv[0]);
+                }
+        }
+
+        if (optind == argc)
+                usage(argv[0]);
+
+        if (SUCCEED != harness_init(root, config, nconfig, timeout))
+        {
+                fprintf(stderr, "cannot load the module\n");
+                return EXIT_FAILURE;
+        }
+
+        for (i = optind; i < argc; i++)
+        {
+                if (0 == strncmp(argv[i], "sleep=", 6))
+                {
+                        usleep((useconds_t)(atof(argv[i] + 6) * 1e6));
+                        continue;
+                }
+
+                if (-1 == (ret = harness_call(argv[i], &result)))
+                {
+                        printf("%s [NOTSUPPORTED] [unknown key]\n", argv[i]);
+                        failed++;
+                        continue;
+                }
+
+                if (SYSINFO_RET_OK == ret)
+                        printf("%s [%s]\n", argv[i], harness_value(&result, buffer, sizeof(buffer)));
+                else
+                {
+                        printf("%s [NOTSUPPORTED] [%s]\n", argv[i], harness_value(&result, buffer, sizeof(buffer)));
+                        failed++;
+                }
+
+                harness_free(&result);
+        }
+
+        harness_uninit();
+
+        return (0 == failed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,74 @@
+/*
+** Stand-in for the Zabbix 3.2 include/common.h, only what zabbix_module_lxd.c
+** uses. The functions are implemented in ../zabbix.c.
+*/
+#ifndef ZABBIX_COMMON_H
+#define ZABBIX_COMMON_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <dirent.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+typedef uint64_t        zbx_uint64_t;
+typedef int64_t         zbx_int64_t;
+typedef uint32_t        zbx_uint32_t;
+
+#define ZBX_FS_UI64     "%lu"
+#define ZBX_FS_I64      "%ld"
+#define ZBX_FS_DBL      "%lf"
+#define ZBX_FS_SIZE_T   "%lu"
+#define zbx_fs_size_t   unsigned long
+
+#define MAX_STRING_LEN  2048
+#define SEC_PER_DAY     86400
+
+#define SUCCEED         0
+#define FAIL            -1
+
+#define THIS_SHOULD_NEVER_HAPPEN        fprintf(stderr, "should never happen %s:%d\n", __FILE__, __LINE__)
+
+#ifndef MIN
+#       define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#       define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define zbx_free(ptr)                           \
+                                                \
+do                                              \
+{                                               \
+        if (ptr)                                \
+        {                                       \
+                free(ptr);                      \
+                ptr = NULL;                     \
+        }                                       \
+}                                               \
+while (0)
+
+#define zbx_malloc(old, size)           zbx_malloc2(__FILE__, __LINE__, old, size)
+#define zbx_realloc(src, size)          zbx_realloc2(__FILE__, __LINE__, src, size)
+#define zbx_strdup(old, str)            zbx_strdup2(__FILE__, __LINE__, old, str)
+
+void    *zbx_malloc2(const char *filename, int line, void *old, size_t size);
+void    *zbx_realloc2(const char *filename, int line, void *old, size_t size);
+char    *zbx_strdup2(const char *filename, int line, char *old, const char *str);
+
+char    *zbx_dsprintf(char *dest, const char *f, ...);
+size_t  zbx_snprintf(char *str, size_t count, const char *fmt, ...);
+void    zbx_snprintf_alloc(char **str, size_t *alloc_len, size_t *offset, const char *fmt, ...);
+size_t  zbx_strlcpy(char *dst, const char *src, size_t siz);
+int     zbx_strcmp_null(const char *s1, const char *s2);
+const char      *zbx_strerror(int errnum);
+int     is_uint64_n(const char *str, size_t n, zbx_uint64_t *value);
+#define is_uint64(str, value)   is_uint64_n(str, 20, value)
+double  zbx_time(void);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+** Stand-in for the Zabbix 3.2 include/comms.h, plain TCP with the ZBXD
+** header and no TLS.
+*/
+#ifndef ZABBIX_COMMS_H
+#define ZABBIX_COMMS_H
+
+#include "common.h"
+
+typedef int     ZBX_SOCKET;
+
+#define ZBX_TCP_SEC_UNENCRYPTED 1
+#define ZBX_TCP_PROTOCOL        0x01
+
+typedef struct
+{
+        ZBX_SOCKET      socket;
+        char            *buffer;
+        size_t          read_bytes;
+}
+zbx_socket_t;
+
+int     zbx_tcp_connect(zbx_socket_t *s, const char *source_ip, const char *ip, unsigned short port, int timeout,
+                unsigned int tls_connect, const char *tls_arg1, const char *tls_arg2);
+int     zbx_tcp_send_ext(zbx_socket_t *s, const char *data, size_t len, unsigned char flags, int timeout);
+ssize_t zbx_tcp_recv_ext(zbx_socket_t *s, int timeout);
+void    zbx_tcp_close(zbx_socket_t *s);
+const char      *zbx_socket_strerror(void);
+
+#define zbx_tcp_send(s, d)              zbx_tcp_send_ext((s), (d), strlen(d), ZBX_TCP_PROTOCOL, 0)
+#define zbx_tcp_recv(s)                 (0 > zbx_tcp_recv_ext(s, 0) ? FAIL : SUCCEED)
+
+#endif
@@ -0,0 +1,16 @@
+/*
+** Stand-in for the Zabbix 3.2 include/log.h, messages go to stderr.
+*/
+#ifndef ZABBIX_LOG_H
+#define ZABBIX_LOG_H
+
+#define LOG_LEVEL_EMPTY         0
+#define LOG_LEVEL_CRIT          1
+#define LOG_LEVEL_ERR           2
+#define LOG_LEVEL_WARNING       3
+#define LOG_LEVEL_DEBUG         4
+#define LOG_LEVEL_TRACE         5
+
+void    zabbix_log(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,67 @@
+/*
+** Stand-in for the Zabbix 3.2 include/module.h with the AGENT_REQUEST and
+** AGENT_RESULT the agent passes to module item handlers.
+*/
+#ifndef ZABBIX_MODULE_H
+#define ZABBIX_MODULE_H
+
+#include "common.h"
+
+#define ZBX_MODULE_OK                   0
+#define ZBX_MODULE_FAIL                 -1
+#define ZBX_MODULE_API_VERSION_ONE      1
+
+#define CF_HAVEPARAMS           0x01
+#define CF_MODULE               0x02
+#define CF_USERPARAMETER        0x04
+
+typedef struct
+{
+        char            *key;
+        unsigned        flags;
+        int             (*function)();
+        char            *test_param;
+}
+ZBX_METRIC;
+
+typedef struct
+{
+        char            *key;
+        int             nparam;
+        char            **params;
+        zbx_uint64_t    lastlogsize;
+        int             mtime;
+}
+AGENT_REQUEST;
+
+typedef struct
+{
+        int             type;
+        zbx_uint64_t    ui64;
+        double          dbl;
+        char            *str;
+        char            *text;
+        char            *msg;
+        void            *logs;
+}
+AGENT_RESULT;
+
+#define AR_UINT64       0x01
+#define AR_DOUBLE       0x02
+#define AR_STRING       0x04
+#define AR_TEXT         0x08
+#define AR_LOG          0x10
+#define AR_MESSAGE      0x20
+
+#define get_rparam(request, num)        (request->nparam > num ? request->params[num] : NULL)
+
+#define SET_UI64_RESULT(res, val)       ((res)->type |= AR_UINT64, (res)->ui64 = (zbx_uint64_t)(val))
+#define SET_DBL_RESULT(res, val)        ((res)->type |= AR_DOUBLE, (res)->dbl = (double)(val))
+#define SET_STR_RESULT(res, val)        ((res)->type |= AR_STRING, (res)->str = (char *)(val))
+#define SET_TEXT_RESULT(res, val)       ((res)->type |= AR_TEXT, (res)->text = (char *)(val))
+#define SET_MSG_RESULT(res, val)        ((res)->type |= AR_MESSAGE, (res)->msg = (char *)(val))
+
+#define SYSINFO_RET_OK          0
+#define SYSINFO_RET_FAIL        1
+
+#endif
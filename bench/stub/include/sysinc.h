@@ -0,0 +1,17 @@
+/*
+** Stand-in for the Zabbix 3.2 include/sysinc.h.
+*/
+#ifndef ZABBIX_SYSINC_H
+#define ZABBIX_SYSINC_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#define ZBX_NULL2STR(str)       (NULL != str ? str : "(null)")
+#define ZBX_KIBIBYTE            1024
+#define ZBX_MAX_UINT64          (~(zbx_uint64_t)0)
+
+#endif
@@ -0,0 +1,76 @@
+/*
+** Stand-in for the Zabbix 3.2 include/zbxjson.h, the builder and the parser
+** functions zabbix_module_lxd.c uses with the same contracts.
+*/
+#ifndef ZABBIX_ZBXJSON_H
+#define ZABBIX_ZBXJSON_H
+
+#include "common.h"
+
+#define ZBX_PROTO_TAG_DATA              "data"
+#define ZBX_PROTO_TAG_REQUEST           "request"
+#define ZBX_PROTO_TAG_HOST              "host"
+#define ZBX_PROTO_TAG_KEY               "key"
+#define ZBX_PROTO_TAG_VALUE             "value"
+#define ZBX_PROTO_TAG_CLOCK             "clock"
+#define ZBX_PROTO_TAG_NS                "ns"
+#define ZBX_PROTO_TAG_RESPONSE          "response"
+#define ZBX_PROTO_TAG_INFO              "info"
+#define ZBX_PROTO_VALUE_SENDER_DATA     "sender data"
+#define ZBX_PROTO_VALUE_SUCCESS         "success"
+#define ZBX_PROTO_VALUE_FAILED          "failed"
+
+#define ZBX_JSON_STAT_BUF_LEN   4096
+#define ZBX_JSON_MAX_DEPTH      64
+
+typedef enum
+{
+        ZBX_JSON_TYPE_UNKNOWN = 0,
+        ZBX_JSON_TYPE_STRING,
+        ZBX_JSON_TYPE_INT,
+        ZBX_JSON_TYPE_ARRAY,
+        ZBX_JSON_TYPE_OBJECT,
+        ZBX_JSON_TYPE_NULL,
+        ZBX_JSON_TYPE_TRUE,
+        ZBX_JSON_TYPE_FALSE
+}
+zbx_json_type_t;
+
+struct zbx_json
+{
+        char    *buffer;
+        char    buf_stat[ZBX_JSON_STAT_BUF_LEN];
+        size_t  buffer_allocated;
+        size_t  buffer_offset;
+        size_t  buffer_size;
+        int     status;
+        int     level;
+        char    stack[ZBX_JSON_MAX_DEPTH];
+};
+
+struct zbx_json_parse
+{
+        const char      *start;
+        const char      *end;
+};
+
+void    zbx_json_init(struct zbx_json *j, size_t allocate);
+void    zbx_json_free(struct zbx_json *j);
+void    zbx_json_addobject(struct zbx_json *j, const char *name);
+void    zbx_json_addarray(struct zbx_json *j, const char *name);
+void    zbx_json_addstring(struct zbx_json *j, const char *name, const char *string, zbx_json_type_t type);
+void    zbx_json_adduint64(struct zbx_json *j, const char *name, zbx_uint64_t value);
+int     zbx_json_close(struct zbx_json *j);
+
+int     zbx_json_open(const char *buffer, struct zbx_json_parse *jp);
+const char      *zbx_json_next(const struct zbx_json_parse *jp, const char *p);
+const char      *zbx_json_next_value(const struct zbx_json_parse *jp, const char *p, char *string, size_t len,
+                int *is_null);
+const char      *zbx_json_pair_next(const struct zbx_json_parse *jp, const char *p, char *name, size_t len);
+const char      *zbx_json_pair_by_name(const struct zbx_json_parse *jp, const char *name);
+int     zbx_json_brackets_open(const char *p, struct zbx_json_parse *jp);
+int     zbx_json_brackets_by_name(const struct zbx_json_parse *jp, const char *name, struct zbx_json_parse *out);
+int     zbx_json_value_by_name(const struct zbx_json_parse *jp, const char *name, char *string, size_t len);
+const char      *zbx_json_decodevalue_dyn(const char *p, char **string, size_t *string_alloc, int *is_null);
+
+#endif
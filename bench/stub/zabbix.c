@@ -0,0 +1,783 @@
+/*
+** Stand-in implementations of the Zabbix agent functions zabbix_module_lxd.c
+** calls, enough to build and drive the module outside a Zabbix source tree.
+**
+** Programs are linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,
+** --wrap=strdup so that every allocation of the module and of these helpers
+** is counted in zbx_stub_allocs.
+*/
+
+#include "common.h"
+#include "log.h"
+#include "cfg.h"
+#include "zbxjson.h"
+#include "comms.h"
+#include "sysinc.h"
+
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+int             zbx_stub_log_level = LOG_LEVEL_WARNING;
+zbx_uint64_t    zbx_stub_allocs = 0;
+
+void    *__real_malloc(size_t size);
+void    *__real_calloc(size_t nmemb, size_t size);
+void    *__real_realloc(void *ptr, size_t size);
+
+void    *__wrap_malloc(size_t size)
+{
+        __atomic_fetch_add(&zbx_stub_allocs, 1, __ATOMIC_RELAXED);
+        return __real_malloc(size);
+}
+
+void    *__wrap_calloc(size_t nmemb, size_t size)
+{
+        __atomic_fetch_add(&zbx_stub_allocs, 1, __ATOMIC_RELAXED);
+        return __real_calloc(nmemb, size);
+}
+
+void    *__wrap_realloc(void *ptr, size_t size)
+{
+        __atomic_fetch_add(&zbx_stub_allocs, 1, __ATOMIC_RELAXED);
+        return __real_realloc(ptr, size);
+}
+
+char    *__wrap_strdup(const char *str)
+{
+        size_t  len = strlen(str) + 1;
+
+        return memcpy(__wrap_malloc(len), str, len);
+}
+
+void    zabbix_log(int level, const char *fmt, ...)
+{
+        va_list args;
+
+        if (level > zbx_stub_log_level)
+                return;
+
+        va_start(args, fmt);
+        fprintf(stderr, "[%d] ", level);
+        vfprintf(stderr, fmt, args);
+        fputc('\n', stderr);
+        va_end(args);
+}
+
+void    *zbx_malloc2(const char *filename, int line, void *old, size_t size)
+{
+        if (NULL != old)
+        {
+                fprintf(stderr, "%s:%d: zbx_malloc() of an allocated pointer\n", filename, line);
+                abort();
+        }
+
+        return malloc(0 != size ? size : 1);
+}
+
+void    *zbx_realloc2(const char *filename, int line, void *old, size_t size)
+{
+        void    *ptr;
+
+        if (NULL == (ptr = realloc(old, 0 != size ? size : 1)))
+        {
+                fprintf(stderr, "%s:%d: out of memory\n", filename, line);
+                abort();
+        }
+
+        return ptr;
+}
+
+char    *zbx_strdup2(const char *filename, int line, char *old, const char *str)
+{
+        free(old);
+
+        return strdup(str);
+}
+
+static char     *zbx_vdsprintf(const char *f, va_list args)
+{
+        va_list args2;
+        char    *str;
+        int     len;
+
+        va_copy(args2, args);
+        len = vsnprintf(NULL, 0, f, args2);
+        va_end(args2);
+
+        str = malloc(len + 1);
+        vsnprintf(str, len + 1, f, args);
+
+        return str;
+}
+
+char    *zbx_dsprintf(char *dest, const char *f, ...)
+{
+        va_list args;
+        char    *str;
+
+        va_start(args, f);
+        str = zbx_vdsprintf(f, args);
+        va_end(args);
+
+        free(dest);
+
+        return str;
+}
+
+size_t  zbx_snprintf(char *str, size_t count, const char *fmt, ...)
+{
+        va_list args;
+        int     len;
+
+        va_start(args, fmt);
+        len = vsnprintf(str, count, fmt, args);
+        va_end(args);
+
+        if (0 > len)
+                return 0;
+
+        return ((size_t)len >= count ? count - 1 : (size_t)len);
+}
+
+void    zbx_snprintf_alloc(char **str, size_t *alloc_len, size_t *offset, const char *fmt, ...)
+{
+        va_list args;
+        char    *add;
+        size_t  len;
+
+        va_start(args, fmt);
+        add = zbx_vdsprintf(fmt, args);
+        va_end(args);
+
+        len = strlen(add);
+
+        if (NULL == *str || *offset + len + 1 > *alloc_len)
+        {
+                *alloc_len = (*offset + len + 1) * 2;
+                *str = realloc(*str, *alloc_len);
+        }
+
+        memcpy(*str + *offset, add, len + 1);
+        *offset += len;
+        free(add);
+}
+
+size_t  zbx_strlcpy(char *dst, const char *src, size_t siz)
+{
+        const char      *s = src;
+
+        if (0 != siz)
+        {
+                while (0 != --siz && '\0' != *s)
+                        *dst++ = *s++;
+
+                *dst = '\0';
+        }
+
+        return s - src;
+}
+
+int     zbx_strcmp_null(const char *s1, const char *s2)
+{
+        if (NULL == s1)
+                return (NULL == s2 ? 0 : -1);
+
+        if (NULL == s2)
+                return 1;
+
+        return strcmp(s1, s2);
+}
+
+const char      *zbx_strerror(int errnum)
+{
+        return strerror(errnum);
+}
+
+int     is_uint64_n(const char *str, size_t n, zbx_uint64_t *value)
+{
+        zbx_uint64_t    v = 0;
+        size_t          len;
+
+        for (len = 0; '\0' != str[len] && len < n; len++)
+        {
+                if (0 == isdigit((unsigned char)str[len]) || (ZBX_MAX_UINT64 - (str[len] - '0')) / 10 < v)
+                        return FAIL;
+
+                v = v * 10 + (str[len] - '0');
+        }
+
+        if (0 == len || '\0' != str[len])
+                return FAIL;
+
+        if (NULL != value)
+                *value = v;
+
+        return SUCCEED;
+}
+
+double  zbx_time(void)
+{
+        struct timeval  tv;
+
+        gettimeofday(&tv, NULL);
+
+        return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+/* Key=Value lines, comments start with '#' */
+int     parse_cfg_file(const char *cfg_file, struct cfg_line *cfg, int optional, int strict)
+{
+        FILE            *f;
+        char            line[MAX_STRING_LEN], *value;
+        struct cfg_line *c;
+        zbx_uint64_t    ui64;
+
+        if (NULL == (f = fopen(cfg_file, "r")))
+                return (ZBX_CFG_FILE_OPTIONAL == optional ? SUCCEED : FAIL);
+
+        while (NULL != fgets(line, sizeof(line), f))
+        {
+                line[strcspn(line, "\r\n")] = '\0';
+
+                if ('#' == *line || NULL == (value = strchr(line, '=')))
+                        continue;
+
+                *value++ = '\0';
+
+                for (c = cfg; NULL != c->parameter; c++)
+                {
+                        if (0 == strcmp(c->parameter, line))
+                                break;
+                }
+
+                if (NULL == c->parameter)
+                {
+                        if (ZBX_CFG_STRICT == strict)
+                        {
+                                fprintf(stderr, "%s: unknown parameter %s\n", cfg_file, line);
+                                exit(EXIT_FAILURE);
+                        }
+
+                        continue;
+                }
+
+                switch (c->type)
+                {
+                        case TYPE_INT:
+                                if (SUCCEED != is_uint64(value, &ui64) || ui64 < c->min ||
+                                                (0 != c->max && ui64 > c->max))
+                                {
+                                        fprintf(stderr, "%s: wrong value of %s\n", cfg_file, line);
+                                        exit(EXIT_FAILURE);
+                                }
+                                *(int *)c->variable = (int)ui64;
+                                break;
+                        case TYPE_UINT64:
+                                *(zbx_uint64_t *)c->variable = strtoull(value, NULL, 10);
+                                break;
+                        case TYPE_STRING:
+                                free(*(char **)c->variable);
+                                *(char **)c->variable = strdup(value);
+                                break;
+                }
+        }
+
+        fclose(f);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * JSON builder, the buffer is kept closed after every call like in Zabbix   *
+ *                                                                            *
+ ******************************************************************************/
+static void     json_put(struct zbx_json *j, const char *s, size_t n)
+{
+        if (j->buffer_size + n + ZBX_JSON_MAX_DEPTH + 1 > j->buffer_allocated)
+        {
+                j->buffer_allocated = (j->buffer_size + n + ZBX_JSON_MAX_DEPTH + 1) * 2;
+
+                if (j->buffer == j->buf_stat)
+                        j->buffer = memcpy(malloc(j->buffer_allocated), j->buf_stat, j->buffer_size);
+                else
+                        j->buffer = realloc(j->buffer, j->buffer_allocated);
+        }
+
+        memcpy(j->buffer + j->buffer_size, s, n);
+        j->buffer_size += n;
+}
+
+static void     json_terminate(struct zbx_json *j)
+{
+        size_t  offset = j->buffer_size;
+        int     level;
+
+        for (level = j->level - 1; 0 <= level; level--)
+                j->buffer[offset++] = ('{' == j->stack[level] ? '}' : ']');
+
+        j->buffer[offset] = '\0';
+}
+
+static void     json_string(struct zbx_json *j, const char *s)
+{
+        char    escaped[8];
+
+        json_put(j, "\"", 1);
+
+        for (; '\0' != *s; s++)
+        {
+                if ('"' == *s || '\\' == *s)
+                {
+                        escaped[0] = '\\';
+                        escaped[1] = *s;
+                        json_put(j, escaped, 2);
+                }
+                else if (0x20 > (unsigned char)*s)
+                {
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", *s);
+                        json_put(j, escaped, 6);
+                }
+                else
+                        json_put(j, s, 1);
+        }
+
+        json_put(j, "\"", 1);
+}
+
+static void     json_name(struct zbx_json *j, const char *name)
+{
+        if (0 != j->status)
+                json_put(j, ",", 1);
+
+        if (NULL != name)
+        {
+                json_string(j, name);
+                json_put(j, ":", 1);
+        }
+}
+
+static void     json_open(struct zbx_json *j, const char *name, char bracket)
+{
+        json_name(j, name);
+        json_put(j, &bracket, 1);
+        j->stack[j->level++] = bracket;
+        j->status = 0;
+        json_terminate(j);
+}
+
+void    zbx_json_init(struct zbx_json *j, size_t allocate)
+{
+        j->buffer = j->buf_stat;
+        j->buffer_allocated = sizeof(j->buf_stat);
+        j->buffer_offset = 0;
+        j->buffer_size = 0;
+        j->status = 0;
+        j->level = 0;
+        json_open(j, NULL, '{');
+}
+
+void    zbx_json_free(struct zbx_json *j)
+{
+        if (j->buffer != j->buf_stat)
+                free(j->buffer);
+}
+
+void    zbx_json_addobject(struct zbx_json *j, const char *name)
+{
+        json_open(j, name, '{');
+}
+
+void    zbx_json_addarray(struct zbx_json *j, const char *name)
+{
+        json_open(j, name, '[');
+}
+
+void    zbx_json_addstring(struct zbx_json *j, const char *name, const char *string, zbx_json_type_t type)
+{
+        json_name(j, name);
+
+        if (NULL == string)
+                json_put(j, "null", 4);
+        else if (ZBX_JSON_TYPE_STRING == type)
+                json_string(j, string);
+        else
+                json_put(j, string, strlen(string));
+
+        j->status = 1;
+        json_terminate(j);
+}
+
+void    zbx_json_adduint64(struct zbx_json *j, const char *name, zbx_uint64_t value)
+{
+        char    buffer[32];
+
+        snprintf(buffer, sizeof(buffer), ZBX_FS_UI64, value);
+        zbx_json_addstring(j, name, buffer, ZBX_JSON_TYPE_INT);
+}
+
+int     zbx_json_close(struct zbx_json *j)
+{
+        char    bracket;
+
+        if (1 == j->level)
+                return FAIL;
+
+        bracket = ('{' == j->stack[--j->level] ? '}' : ']');
+        json_put(j, &bracket, 1);
+        j->status = 1;
+        json_terminate(j);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * JSON parser, same contracts as src/libs/zbxjson/json.c                     *
+ *                                                                            *
+ ******************************************************************************/
+static const char       *json_whitespace(const char *p)
+{
+        while (' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p)
+                p++;
+
+        return p;
+}
+
+static const char       *json_string_end(const char *p)
+{
+        for (p++; '\0' != *p && '"' != *p; p++)
+        {
+                if ('\\' == *p && '\0' != p[1])
+                        p++;
+        }
+
+        return ('\0' == *p ? NULL : p);
+}
+
+/* the last character of the value at p, NULL if it is not terminated */
+static const char       *json_value_end(const char *p)
+{
+        int     depth = 0;
+
+        p = json_whitespace(p);
+
+        if ('"' == *p)
+                return json_string_end(p);
+
+        if ('{' == *p || '[' == *p)
+        {
+                for (; '\0' != *p; p++)
+                {
+                        if ('"' == *p)
+                        {
+                                if (NULL == (p = json_string_end(p)))
+                                        return NULL;
+                        }
+                        else if ('{' == *p || '[' == *p)
+                                depth++;
+                        else if (('}' == *p || ']' == *p) && 0 == --depth)
+                                return p;
+                }
+
+                return NULL;
+        }
+
+        while ('\0' != p[1] && NULL == strchr(",}] \t\r\n", p[1]))
+                p++;
+
+        return p;
+}
+
+static const char       *json_copy(const char *p, char *out, size_t size, int *is_null)
+{
+        const char      *end;
+        size_t          offset = 0;
+        char            c;
+
+        if (NULL != is_null)
+                *is_null = 0;
+
+        if ('{' == *p || '[' == *p || NULL == (end = json_value_end(p)))
+                return NULL;
+
+        if ('"' == *p)
+        {
+                for (p++; p < end; p++)
+                {
+                        if ('\\' == (c = *p))
+                        {
+                                switch (*++p)
+                                {
+                                        case 'n':
+                                                c = '\n';
+                                                break;
+                                        case 't':
+                                                c = '\t';
+                                                break;
+                                        default:
+                                                c = *p;
+                                }
+                        }
+
+                        if (offset + 1 < size)
+                                out[offset++] = c;
+                }
+        }
+        else
+        {
+                if ('n' == *p && NULL != is_null)
+                        *is_null = 1;
+
+                for (; p <= end; p++)
+                {
+                        if (offset + 1 < size)
+                                out[offset++] = *p;
+                }
+        }
+
+        if (0 != size)
+                out[offset] = '\0';
+
+        return end + 1;
+}
+
+int     zbx_json_brackets_open(const char *p, struct zbx_json_parse *jp)
+{
+        const char      *end;
+
+        p = json_whitespace(p);
+
+        if (('{' != *p && '[' != *p) || NULL == (end = json_value_end(p)))
+                return FAIL;
+
+        jp->start = p;
+        jp->end = end;
+
+        return SUCCEED;
+}
+
+int     zbx_json_open(const char *buffer, struct zbx_json_parse *jp)
+{
+        return zbx_json_brackets_open(buffer, jp);
+}
+
+const char      *zbx_json_next(const struct zbx_json_parse *jp, const char *p)
+{
+        int     level = 0;
+
+        if (NULL == p)
+        {
+                p = json_whitespace(jp->start + 1);
+                return (p >= jp->end ? NULL : p);
+        }
+
+        for (; p < jp->end; p++)
+        {
+                switch (*p)
+                {
+                        case '{':
+                        case '[':
+                                level++;
+                                break;
+                        case '}':
+                        case ']':
+                                level--;
+                                break;
+                        case '"':
+                                if (NULL == (p = json_string_end(p)))
+                                        return NULL;
+                                break;
+                        case ',':
+                                if (0 == level)
+                                {
+                                        p = json_whitespace(p + 1);
+                                        return (p >= jp->end ? NULL : p);
+                                }
+                                break;
+                }
+        }
+
+        return NULL;
+}
+
+const char      *zbx_json_next_value(const struct zbx_json_parse *jp, const char *p, char *string, size_t len,
+                int *is_null)
+{
+        if (NULL == (p = zbx_json_next(jp, p)))
+                return NULL;
+
+        return (NULL == json_copy(p, string, len, is_null) ? NULL : p);
+}
+
+const char      *zbx_json_decodevalue_dyn(const char *p, char **string, size_t *string_alloc, int *is_null)
+{
+        const char      *end;
+        size_t          need;
+
+        if (NULL == (end = json_value_end(p)))
+                return NULL;
+
+        if (*string_alloc < (need = end - p + 2))
+        {
+                *string_alloc = need;
+                *string = realloc(*string, need);
+        }
+
+        return json_copy(p, *string, *string_alloc, is_null);
+}
+
+const char      *zbx_json_pair_next(const struct zbx_json_parse *jp, const char *p, char *name, size_t len)
+{
+        const char      *value;
+
+        if (NULL == (p = zbx_json_next(jp, p)) || '"' != *p || NULL == (value = json_copy(p, name, len, NULL)))
+                return NULL;
+
+        if (':' != *(value = json_whitespace(value)))
+                return NULL;
+
+        return json_whitespace(value + 1);
+}
+
+const char      *zbx_json_pair_by_name(const struct zbx_json_parse *jp, const char *name)
+{
+        const char      *p = NULL;
+        char            buffer[MAX_STRING_LEN];
+
+        while (NULL != (p = zbx_json_pair_next(jp, p, buffer, sizeof(buffer))))
+        {
+                if (0 == strcmp(buffer, name))
+                        return p;
+        }
+
+        return NULL;
+}
+
+int     zbx_json_brackets_by_name(const struct zbx_json_parse *jp, const char *name, struct zbx_json_parse *out)
+{
+        const char      *p;
+
+        if (NULL == (p = zbx_json_pair_by_name(jp, name)))
+                return FAIL;
+
+        return zbx_json_brackets_open(p, out);
+}
+
+int     zbx_json_value_by_name(const struct zbx_json_parse *jp, const char *name, char *string, size_t len)
+{
+        const char      *p;
+
+        if (NULL == (p = zbx_json_pair_by_name(jp, name)))
+                return FAIL;
+
+        return (NULL == json_copy(p, string, len, NULL) ? FAIL : SUCCEED);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Zabbix protocol over plain TCP: "ZBXD\1", 8 byte little-endian length and  *
+ * the data, the response is read until the peer closes the connection       *
+ *                                                                            *
+ ******************************************************************************/
+static char     socket_error[MAX_STRING_LEN];
+
+int     zbx_tcp_connect(zbx_socket_t *s, const char *source_ip, const char *ip, unsigned short port, int timeout,
+                unsigned int tls_connect, const char *tls_arg1, const char *tls_arg2)
+{
+        struct sockaddr_in      addr;
+        struct timeval          tv = {timeout, 0};
+
+        memset(s, 0, sizeof(*s));
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+
+        if (1 != inet_pton(AF_INET, ip, &addr.sin_addr))
+        {
+                snprintf(socket_error, sizeof(socket_error), "cannot resolve [%s]", ip);
+                return FAIL;
+        }
+
+        if (-1 == (s->socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)))
+        {
+                snprintf(socket_error, sizeof(socket_error), "socket(): %s", strerror(errno));
+                return FAIL;
+        }
+
+        setsockopt(s->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(s->socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (0 != connect(s->socket, (struct sockaddr *)&addr, sizeof(addr)))
+        {
+                snprintf(socket_error, sizeof(socket_error), "connect(): %s", strerror(errno));
+                close(s->socket);
+                return FAIL;
+        }
+
+        return SUCCEED;
+}
+
+int     zbx_tcp_send_ext(zbx_socket_t *s, const char *data, size_t len, unsigned char flags, int timeout)
+{
+        char            header[13] = "ZBXD\1";
+        zbx_uint64_t    len64 = len;
+
+        memcpy(header + 5, &len64, sizeof(len64));
+
+        if (sizeof(header) != write(s->socket, header, sizeof(header)) || (ssize_t)len != write(s->socket, data, len))
+        {
+                snprintf(socket_error, sizeof(socket_error), "write(): %s", strerror(errno));
+                return FAIL;
+        }
+
+        return SUCCEED;
+}
+
+ssize_t zbx_tcp_recv_ext(zbx_socket_t *s, int timeout)
+{
+        char    *buffer = NULL;
+        size_t  alloc = 0, len = 0;
+        ssize_t n;
+
+        for (;;)
+        {
+                if (len + 1 >= alloc)
+                        buffer = realloc(buffer, alloc += MAX_STRING_LEN);
+
+                if (0 >= (n = read(s->socket, buffer + len, alloc - len - 1)))
+                        break;
+
+                len += n;
+        }
+
+        if (13 > len || 0 != memcmp(buffer, "ZBXD\1", 5))
+        {
+                snprintf(socket_error, sizeof(socket_error), "cannot read the response");
+                free(buffer);
+                return -1;
+        }
+
+        buffer[len] = '\0';
+        s->buffer = strdup(buffer + 13);
+        s->read_bytes = len - 13;
+        free(buffer);
+
+        return (ssize_t)s->read_bytes;
+}
+
+void    zbx_tcp_close(zbx_socket_t *s)
+{
+        close(s->socket);
+        zbx_free(s->buffer);
+}
+
+const char      *zbx_socket_strerror(void)
+{
+        return socket_error;
+}
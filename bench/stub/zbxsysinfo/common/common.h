@@ -0,0 +1 @@
+/* zabbix_module_lxd.c includes common/common.h of the agent sysinfo library, nothing of it is used */
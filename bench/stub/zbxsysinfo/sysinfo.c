@@ -0,0 +1 @@
+/* zabbix_module_lxd.c includes the agent sysinfo.c for its request helpers, the stand-ins live in module.h */
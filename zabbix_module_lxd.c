@@ -24,6 +24,7 @@
 #include "module.h"
 #include "sysinc.h"
 #include "zbxjson.h"
+#include "cfg.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -31,7 +32,15 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <grp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sched.h>
+#include <regex.h>
+#include <ctype.h>
 
 // request parameters
 #include "common/common.h"
@@ -41,30 +50,527 @@
 #       define ZBX_MODULE_API_VERSION   ZBX_MODULE_API_VERSION_ONE
 #endif
 
+#ifndef ZBX_MODULE_LXD_CONFIG_FILE
+#       define ZBX_MODULE_LXD_CONFIG_FILE       "/etc/zabbix/zabbix_module_lxd.conf"
+#endif
+
+#define ZBX_LXD_KEY_LEN         38      /* longest stat file key, e.g. "total_workingset_activate_anon" */
+#define ZBX_LXD_READ_MAX        (1024 * 1024)   /* stat files are never that large */
+#define ZBX_LXD_BUCKETS         256     /* container registry hash buckets */
+#define ZBX_LXD_EXPIRE          600     /* drop containers not polled for this many seconds */
+#define ZBX_LXD_NAME_LEN        64      /* LXD container names are at most 63 characters */
+#define ZBX_LXD_SLOT_STATS      128     /* lines of a stat file kept in the shared table */
+#define ZBX_LXD_CPUS_TTL        30      /* seconds the effective cpuset size of a container is cached */
+#define ZBX_LXD_WATCH_RETRY     60      /* seconds before inotify is tried again after a failure */
+#define ZBX_LXD_API_MAX         (64 * 1024 * 1024)      /* largest LXD API response accepted */
+#define ZBX_LXD_API_CONTAINERS  "/1.0/containers?recursion=2&all-projects=true"
+#define ZBX_LXD_MAX_KEYS        32      /* entries of keys[] with their own lxd.module.stats counters */
+#define ZBX_LXD_LATENCY_BUCKETS 21      /* below 1us, 2us, 4us, ... 2^19us and slower */
+#define ZBX_LXD_EVENTS_RESCAN   10      /* seconds between container walks of the events watcher */
+#define ZBX_LXD_SAMPLES         128     /* samples kept per container by the sampler */
+#define ZBX_LXD_DRIVERS         3       /* places of container cgroups, see drivers[] */
+#define ZBX_LXD_FILTERS         16      /* compiled lxd.discovery filters kept per agent process */
+#define ZBX_LXD_SEQ_SPINS       10000   /* reads of a shared slot being rewritten before giving up on it */
+#define ZBX_LXD_CLAIM_WAIT      1000    /* yields waiting for another process to fill in an events entry */
+
+/* stat files sampled by the collector */
+#define ZBX_LXD_FILE_MEMORY     0
+#define ZBX_LXD_FILE_CPUACCT    1
+#define ZBX_LXD_FILE_CPU        2
+#define ZBX_LXD_FILE_IO_BYTES   3
+#define ZBX_LXD_FILE_IO_OPS     4
+#define ZBX_LXD_FILE_COUNT      5
+
+#ifndef O_PATH
+#       define O_PATH   O_RDONLY
+#endif
+
+#define ZBX_LXD_SLOT_EMPTY      0
+#define ZBX_LXD_SLOT_USED       1
+#define ZBX_LXD_SLOT_REMOVED    2
+#define ZBX_LXD_SLOT_CLAIMED    3       /* events table entry being filled in */
+
 struct inspect_result
 {
    char  *value;
    int   return_code;
 };
 
+/* stat file keys known at compile time, sorted for bsearch() */
+static const char       *known_keys[] =
+{
+        "Total", "active_anon", "active_file", "anon", "anon_thp", "burst_time", "burst_usec", "cache", "dirty",
+        "file", "file_dirty", "file_mapped", "file_thp", "file_writeback", "hierarchical_memory_limit",
+        "hierarchical_memsw_limit", "inactive_anon", "inactive_file", "kernel", "kernel_stack", "mapped_file",
+        "nr_bursts", "nr_periods", "nr_throttled", "pagetables", "percpu", "pgfault", "pgmajfault", "pgpgin",
+        "pgpgout", "rss", "rss_huge", "shmem", "shmem_thp", "slab", "slab_reclaimable", "slab_unreclaimable",
+        "sock", "swap", "swapcached", "system", "system_usec", "throttled_time", "throttled_usec",
+        "total_active_anon", "total_active_file", "total_cache", "total_dirty", "total_inactive_anon",
+        "total_inactive_file", "total_mapped_file", "total_pgfault", "total_pgmajfault", "total_pgpgin",
+        "total_pgpgout", "total_rss", "total_rss_huge", "total_shmem", "total_swap", "total_swapcached",
+        "total_unevictable", "total_workingset_activate", "total_workingset_activate_anon",
+        "total_workingset_activate_file", "total_workingset_nodereclaim", "total_workingset_refault",
+        "total_workingset_refault_anon", "total_workingset_refault_file", "total_workingset_restore",
+        "total_workingset_restore_anon", "total_workingset_restore_file", "total_writeback", "unevictable",
+        "usage", "usage_usec", "user", "user_usec", "workingset_activate", "workingset_activate_anon",
+        "workingset_activate_file", "workingset_nodereclaim", "workingset_refault", "workingset_refault_anon",
+        "workingset_refault_file", "workingset_restore", "workingset_restore_anon", "workingset_restore_file",
+        "writeback"
+};
+
+#define ZBX_LXD_KNOWN_KEYS      (int)(sizeof(known_keys) / sizeof(*known_keys))
+
+/* one "key value" line of a cgroup stat file, id is index in known_keys or -1 */
+typedef struct
+{
+        char            key[ZBX_LXD_KEY_LEN];
+        short           id;
+        zbx_uint64_t    value;
+}
+zbx_lxd_stat_t;
+
+/* parsed content of one cgroup stat file of a container */
+typedef struct zbx_lxd_snapshot
+{
+        char                    *cgroup;
+        char                    *stat_file;
+        double                  sampled;
+        int                     nstats;
+        int                     stats_alloc;
+        zbx_lxd_stat_t          *stats;
+        short                   index[ZBX_LXD_KNOWN_KEYS];      /* known key id -> position in stats + 1 */
+        struct zbx_lxd_snapshot *next;
+}
+zbx_lxd_snapshot_t;
+
+/* CPU utilisation modes of lxd.cpu.util */
+#define ZBX_LXD_CPU_USER        0
+#define ZBX_LXD_CPU_SYSTEM      1
+#define ZBX_LXD_CPU_TOTAL       2
+
+/* per-device counters of lxd.dev.rate */
+#define ZBX_LXD_IO_READ_BYTES   0
+#define ZBX_LXD_IO_WRITE_BYTES  1
+#define ZBX_LXD_IO_READ_OPS     2
+#define ZBX_LXD_IO_WRITE_OPS    3
+#define ZBX_LXD_IO_COUNT        4
+
+#define ZBX_LXD_DEV_LEN         16      /* "major:minor" */
+#define ZBX_LXD_IO_DEVICES      16      /* devices of a container lxd.dev.rate keeps samples of */
+#define ZBX_LXD_PID_DEPTH       4       /* sub-cgroup levels searched for a container process */
+#define ZBX_LXD_TOP_MAX         100     /* most processes lxd.top returns */
+#define ZBX_LXD_TOP_BATCH       64      /* processes parsed by lxd.top between deadline checks */
+
+/* cpu.stat counters of lxd.cpu.throttling */
+#define ZBX_LXD_THR_PERIODS     0
+#define ZBX_LXD_THR_THROTTLED   1
+#define ZBX_LXD_THR_TIME        2
+#define ZBX_LXD_THR_USAGE       3
+#define ZBX_LXD_THR_COUNT       4
+
+/* pressure stall information of lxd.pressure */
+#define ZBX_LXD_PSI_CPU         0
+#define ZBX_LXD_PSI_MEMORY      1
+#define ZBX_LXD_PSI_IO          2
+#define ZBX_LXD_PSI_COUNT       3
+
+/* process of a container seen by lxd.top */
+typedef struct
+{
+        pid_t           pid;
+        zbx_uint64_t    start;          /* start time in ticks after boot, detects a reused pid */
+        zbx_uint64_t    ticks;          /* user and system ticks */
+        zbx_uint64_t    rss;            /* resident pages */
+        double          cpu;            /* percent of one CPU */
+        char            comm[16];
+}
+zbx_lxd_proc_t;
+
+/* one block device of a container with its counters and rates, negative - none yet */
+typedef struct
+{
+        char            dev[ZBX_LXD_DEV_LEN];
+        zbx_uint64_t    counters[ZBX_LXD_IO_COUNT];
+        double          rates[ZBX_LXD_IO_COUNT];
+}
+zbx_lxd_device_t;
+
+/* previous samples of the rate keys of a container */
+typedef struct
+{
+        zbx_uint64_t    cpu_ticks[2];   /* user and system ticks of the previous sample */
+        double          cpu_sampled;    /* time of the previous sample, 0 - none yet */
+        double          cpu_util[3];    /* utilisation between the last two samples, negative - none yet */
+        zbx_uint64_t    psi_total[ZBX_LXD_PSI_COUNT][2];        /* some and full stall usec */
+        double          psi_rate[ZBX_LXD_PSI_COUNT][2];         /* stalled percent of time, negative - none yet */
+        double          psi_sampled[ZBX_LXD_PSI_COUNT];
+        zbx_uint64_t    thr_counters[ZBX_LXD_THR_COUNT];        /* cpu.stat of the previous sample */
+        double          thr_sampled;    /* time of the previous sample, 0 - none yet */
+        double          thr_ratio;      /* percent of periods throttled, negative - none yet */
+        double          thr_time;       /* seconds throttled per second */
+        double          thr_cores;      /* CPUs used */
+        zbx_lxd_device_t        devices[ZBX_LXD_IO_DEVICES];    /* blkio devices of the previous sample */
+        int             ndevices;
+        double          io_sampled;     /* time of the previous sample, 0 - none yet */
+}
+zbx_lxd_rates_t;
+
+typedef struct zbx_lxd_container
+{
+        char                    *name;
+        double                  lastaccess;
+        zbx_lxd_snapshot_t      *snapshots;
+        zbx_lxd_rates_t         rates;          /* when the shared events table has no entry for it */
+        int                     cpus;           /* effective cpuset size, 0 - not read yet */
+        double                  cpus_checked;
+        zbx_lxd_device_t        *devices;       /* blkio devices of the last snapshot read, rates from rates */
+        int                     ndevices;
+        double                  io_sampled;     /* time of that snapshot, 0 - none yet */
+        pid_t                   net_pid;        /* process in the container network namespace, 0 - unknown */
+        ino_t                   net_ns;         /* inode of that namespace, detects a reused pid */
+        zbx_lxd_snapshot_t      *net;           /* parsed /proc/<net_pid>/net/dev */
+        zbx_lxd_proc_t          *procs;         /* processes of the previous lxd.top call, by pid */
+        int                     nprocs;
+        double                  procs_sampled;
+        struct zbx_lxd_container *next;
+}
+zbx_lxd_container_t;
+
+/* cgroup hierarchies found by zbx_lxd_dir_detect(), a published layout is    */
+/* never changed, detection publishes a new one                               */
+typedef struct zbx_lxd_layout
+{
+        int                     generation;     /* dirfds and members of another generation are dropped */
+        int                     version;        /* 1 - controllers have their own v1 hierarchies, */
+                                                /* 2 - unified cgroup2 hierarchy                  */
+        char                    *stat_dir;      /* parent of the hierarchies, with a trailing slash */
+        const char              *driver;        /* driver directory or container prefix, NULL - not found */
+        char                    *cpuset;        /* hierarchies relative to stat_dir, e.g. "cpu,cpuacct/", */
+        char                    *cpu;           /* "" on cgroup2, NULL - not mounted                      */
+        char                    *cpuacct;
+        char                    *memory;
+        char                    *blkio;
+        char                    *unified;       /* cgroup2 of a hybrid v1 host */
+        struct zbx_lxd_layout   *prev;          /* replaced layout, readers may still use it */
+}
+zbx_lxd_layout_t;
+
+/* cached directory of a container in one cgroup hierarchy, name is empty for */
+/* the driver directory of the hierarchy itself                               */
+typedef struct zbx_lxd_dirfd
+{
+        char                    *cgroup;
+        char                    name[ZBX_LXD_NAME_LEN];
+        int                     fd;
+        double                  lastuse;
+        struct zbx_lxd_dirfd    *next;
+}
+zbx_lxd_dirfd_t;
+
+/* container seen in a driver directory, stopped is 0 while it runs */
+typedef struct zbx_lxd_member
+{
+        char                    name[ZBX_LXD_NAME_LEN];
+        const char              *driver;
+        time_t                  started;
+        time_t                  stopped;
+        int                     seen;
+        struct zbx_lxd_member   *next;
+}
+zbx_lxd_member_t;
+
+/* container set of an agent process kept up to date by inotify events of */
+/* the cpuset hierarchy root and its driver directories                    */
+typedef struct
+{
+        pid_t                   pid;
+        int                     fd;
+        int                     generation;
+        int                     scan;
+        double                  failed;
+        int                     root;
+        int                     wd[ZBX_LXD_DRIVERS];
+        zbx_lxd_member_t        *buckets[ZBX_LXD_BUCKETS];
+}
+zbx_lxd_members_t;
+
+/* container object in the cached LXD API response */
+typedef struct
+{
+        char                    name[ZBX_LXD_NAME_LEN];
+        char                    project[ZBX_LXD_NAME_LEN];
+        struct zbx_json_parse   jp;
+}
+zbx_lxd_api_container_t;
+
+/* LXD API response cache of an agent process, the connection is socket_api, */
+/* responses are received into buf and swapped with body once parsed         */
+typedef struct
+{
+        pid_t                   pid;
+        char                    *buf;
+        size_t                  buf_alloc;
+        char                    *body;
+        size_t                  body_alloc;
+        double                  fetched;
+        double                  deadline;       /* receiving gives up at this time */
+        double                  requested;      /* request awaiting its response, 0 if none */
+        zbx_lxd_api_container_t *containers;
+        int                     ncontainers;
+}
+zbx_lxd_api_t;
+
+/* compiled include and exclude patterns of lxd.discovery, NULL pattern matches */
+/* every container and excludes none                                            */
+typedef struct zbx_lxd_filter
+{
+        char                    *include;
+        char                    *exclude;
+        regex_t                 include_re;
+        regex_t                 exclude_re;
+        double                  lastuse;
+        struct zbx_lxd_filter   *next;
+}
+zbx_lxd_filter_t;
+
+/* state of a thread reading stat files: cached directories, read buffer and */
+/* the cgroup2 file being translated into its v1 counterpart                  */
+typedef struct
+{
+        zbx_lxd_dirfd_t         *buckets[ZBX_LXD_BUCKETS];
+        int                     count;
+        int                     generation;
+        char                    *buf;
+        size_t                  buf_alloc;
+        zbx_lxd_snapshot_t      unified;
+}
+zbx_lxd_reader_t;
+
+/* stat file copy in the shared collector table */
+typedef struct
+{
+        double          sampled;
+        int             nstats;
+        int             truncated;
+        zbx_lxd_stat_t  stats[ZBX_LXD_SLOT_STATS];
+}
+zbx_lxd_slot_file_t;
+
+/* container in the shared collector table, readers retry while seq is odd */
+typedef struct
+{
+        zbx_uint32_t            seq;
+        int                     state;
+        zbx_uint64_t            tick;
+        char                    name[ZBX_LXD_NAME_LEN];
+        zbx_lxd_slot_file_t     files[ZBX_LXD_FILE_COUNT];
+}
+zbx_lxd_slot_t;
+
+/* CPU and memory usage read by the sampler, sampled is 0 for a failed read */
+typedef struct
+{
+        double          sampled;
+        zbx_uint64_t    cpu;            /* usage in microseconds */
+        zbx_uint64_t    memory;         /* usage in bytes */
+}
+zbx_lxd_sample_t;
+
+/* container in the shared sampler table, readers retry while seq is odd */
+typedef struct
+{
+        zbx_uint32_t            seq;
+        int                     state;
+        zbx_uint64_t            tick;
+        char                    name[ZBX_LXD_NAME_LEN];
+        zbx_uint64_t            count;                  /* samples taken, the latest is count - 1 */
+        zbx_lxd_sample_t        samples[ZBX_LXD_SAMPLES];
+}
+zbx_lxd_sampler_slot_t;
+
+/* memory events of lxd.mem.events */
+#define ZBX_LXD_EVENT_OOM       0
+#define ZBX_LXD_EVENT_OOM_KILL  1
+#define ZBX_LXD_EVENT_HIGH      2
+#define ZBX_LXD_EVENT_MAX       3
+#define ZBX_LXD_EVENT_COUNT     4
+
+/* memory.events counters and rate samples of a container shared by the agent processes */
+typedef struct
+{
+        zbx_uint32_t    state;
+        pid_t           owner;                          /* process filling in a claimed entry, 0 - none */
+        pid_t           lock;                           /* process updating rates, 0 - none */
+        zbx_lxd_rates_t rates;
+        char            name[ZBX_LXD_NAME_LEN];
+        int             updated;                        /* when the watcher stored current, 0 - never */
+        zbx_uint64_t    current[ZBX_LXD_EVENT_COUNT];
+        zbx_uint64_t    last[ZBX_LXD_EVENT_COUNT];      /* value returned by the previous delta + 1, 0 - none */
+}
+zbx_lxd_events_t;
+
+/* calls of one item key */
+typedef struct
+{
+        zbx_uint64_t    calls;
+        zbx_uint64_t    errors;
+        zbx_uint64_t    latency[ZBX_LXD_LATENCY_BUCKETS];
+}
+zbx_lxd_key_stats_t;
+
+/* lxd.module.stats counters of all agent processes, updated with atomic adds */
+typedef struct
+{
+        zbx_lxd_key_stats_t     keys[ZBX_LXD_MAX_KEYS];
+        zbx_uint64_t            file_opens;
+        zbx_uint64_t            file_reads;
+        zbx_uint64_t            bytes_parsed;
+        zbx_uint64_t            walks;
+        zbx_uint64_t            walk_usec;
+        zbx_uint64_t            detects;
+        zbx_uint64_t            deadlines;
+}
+zbx_lxd_stats_t;
+
+#define ZBX_LXD_STATS_ADD(counter, value)       __atomic_fetch_add(&module_stats->counter, (value), __ATOMIC_RELAXED)
+
 char    *m_version = "v0.1";
-char    *stat_dir = NULL, *driver, *cpu_cgroup = NULL, *hostname = 0;
-static int item_timeout = 1, buffer_size = 1024, cid_length = 66, socket_api;
+static char     hostname[MAX_STRING_LEN / 4];
+static int item_timeout = 1, buffer_size = 1024, cid_length = 66, socket_api = -1;
+
+/* module configuration, see zbx_module_lxd_load_config() */
+static int snapshot_ttl = 5, collector_interval = 0, collector_slots = 1024, max_dirfds = 256;
+static int api_ttl = 10, stale_ttl = 0;
+static char *api_socket = NULL;
+static char *cgroup_root = NULL;
+static char *push_server = NULL, *push_hostname = NULL;
+static int push_port = 10051, push_interval = 60;
+static int events_watch = 0;
+static int sampler_interval = 0;
+
+/* where LXD puts the cgroup of a container under a hierarchy root: drivers     */
+/* ending with '/' are directories of <name> directories, others prefix <name>.  */
+/* LXC 4 and newer (the LXD snap included) use lxc.payload.<name>, LXC 3 used    */
+/* lxc/<name> and LXC 4 pre-releases lxc.payload/<name>.                         */
+static const char       *drivers[ZBX_LXD_DRIVERS + 1] = {"lxc.payload/", "lxc/", "lxc.payload.", NULL};
+
+/* current cgroup layout, swapped atomically by zbx_lxd_dir_detect() */
+static zbx_lxd_layout_t layout_none = {0, 1, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+static zbx_lxd_layout_t *layout = &layout_none;
+
+/* /proc/self/mountinfo of the agent process, polled for mount table changes */
+static int              mounts_fd = -1;
+static pid_t            mounts_pid = 0;
+
+static zbx_lxd_container_t      *containers[ZBX_LXD_BUCKETS];
+static double                   containers_swept = 0;
+static zbx_lxd_reader_t         reader;
+static zbx_lxd_members_t        members = {0, -1, 0, 0, 0, -1, {-1, -1, -1}, {NULL}};
+static zbx_lxd_api_t            api;
+static zbx_lxd_filter_t         *filters = NULL;
+
+/* lxd.top buffers reused by the calls of an agent process */
+static pid_t                    *top_pids = NULL;
+static int                      top_pids_alloc = 0;
+static zbx_lxd_proc_t           *top_procs = NULL;
+static int                      top_procs_alloc = 0;
+
+/* shared collector table, mapped before the agent forks its processes */
+static zbx_lxd_slot_t   *slots = NULL;
+static pthread_t        collector;
+static pthread_mutex_t  collector_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   collector_cond = PTHREAD_COND_INITIALIZER;
+static pid_t            collector_pid = 0;
+static int              collector_stop = 0;
+
+/* active push of all container stats to a trapper */
+static pthread_t        pusher;
+static pthread_mutex_t  push_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   push_cond = PTHREAD_COND_INITIALIZER;
+static pid_t            push_pid = 0;
+static int              push_stop = 0;
+
+/* shared sample table of the sub-interval sampler thread */
+static zbx_lxd_sampler_slot_t   *sampler_slots = NULL;
+static pthread_t                sampler;
+static pthread_mutex_t          sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           sampler_cond = PTHREAD_COND_INITIALIZER;
+static pid_t                    sampler_pid = 0;
+static int                      sampler_stop = 0;
+
+/* shared memory.events table and its optional watcher thread */
+static zbx_lxd_events_t *events = NULL;
+static pthread_t        events_watcher;
+static pid_t            events_pid = 0;
+static int              events_stop = 0;
+static const char       *event_names[ZBX_LXD_EVENT_COUNT] = {"oom", "oom_kill", "high", "max"};
+
+/* serializes the passes of the module threads over the shared per-process state */
+static pthread_mutex_t  walk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* module counters, shared by the agent processes once zbx_module_init() has mapped them */
+static zbx_lxd_stats_t  stats_local;
+static zbx_lxd_stats_t  *module_stats = &stats_local;
+static int              (*handlers[ZBX_LXD_MAX_KEYS])(AGENT_REQUEST *request, AGENT_RESULT *result);
+
+static const char       *collect_files[ZBX_LXD_FILE_COUNT] =
+{
+        "memory.stat",
+        "cpuacct.stat",
+        "cpu.stat",
+        "blkio.throttle.io_service_bytes",
+        "blkio.throttle.io_serviced"
+};
+
 int     zbx_module_lxd_discovery(AGENT_REQUEST *request, AGENT_RESULT *result);
 int     zbx_module_lxd_up(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_lifecycle(AGENT_REQUEST *request, AGENT_RESULT *result);
 int     zbx_module_lxd_mem(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_mem_events(AGENT_REQUEST *request, AGENT_RESULT *result);
 int     zbx_module_lxd_cpu(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_cpu_util(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_cpu_throttling(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_cpu_sampled(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_mem_sampled(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_top(AGENT_REQUEST *request, AGENT_RESULT *result);
 int     zbx_module_lxd_dev(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_dev_discovery(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_dev_rate(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_net(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_net_discovery(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_pressure(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_stats(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_age(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_all(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_api(AGENT_REQUEST *request, AGENT_RESULT *result);
+int     zbx_module_lxd_module_stats(AGENT_REQUEST *request, AGENT_RESULT *result);
 
 
 static ZBX_METRIC keys[] =
 /*      KEY                     FLAG            FUNCTION                TEST PARAMETERS */
 {
-        {"lxd.discovery", CF_HAVEPARAMS, zbx_module_lxd_discovery,    "<parameter 1>, <parameter 2>, <parameter 3>"},
+        {"lxd.discovery", CF_HAVEPARAMS, zbx_module_lxd_discovery,    ".*,^ci-,"},
+        {"lxd.all",  0,              zbx_module_lxd_all,  NULL},
         {"lxd.up",   CF_HAVEPARAMS,  zbx_module_lxd_up,   "container name"},
+        {"lxd.lifecycle", CF_HAVEPARAMS, zbx_module_lxd_lifecycle, "container name, started"},
         {"lxd.mem",  CF_HAVEPARAMS,  zbx_module_lxd_mem,  "container name, memory metric name"},
+        {"lxd.mem.events", CF_HAVEPARAMS, zbx_module_lxd_mem_events, "container name, oom_kill"},
         {"lxd.cpu",  CF_HAVEPARAMS,  zbx_module_lxd_cpu,  "container name, cpu metric name"},
+        {"lxd.cpu.util", CF_HAVEPARAMS, zbx_module_lxd_cpu_util, "container name, total"},
+        {"lxd.cpu.throttling", CF_HAVEPARAMS, zbx_module_lxd_cpu_throttling, "container name, throttled_ratio"},
+        {"lxd.cpu.sampled", CF_HAVEPARAMS, zbx_module_lxd_cpu_sampled, "container name, max"},
+        {"lxd.mem.sampled", CF_HAVEPARAMS, zbx_module_lxd_mem_sampled, "container name, max"},
+        {"lxd.top",  CF_HAVEPARAMS,  zbx_module_lxd_top,  "container name, cpu, 10"},
         {"lxd.dev",  CF_HAVEPARAMS,  zbx_module_lxd_dev,  "container name, blkio file, blkio metric name"},
+        {"lxd.dev.discovery", CF_HAVEPARAMS, zbx_module_lxd_dev_discovery, "container name"},
+        {"lxd.dev.rate", CF_HAVEPARAMS, zbx_module_lxd_dev_rate, "container name"},
+        {"lxd.net",  CF_HAVEPARAMS,  zbx_module_lxd_net,  "container name, eth0, rx_bytes"},
+        {"lxd.net.discovery", CF_HAVEPARAMS, zbx_module_lxd_net_discovery, "container name"},
+        {"lxd.pressure", CF_HAVEPARAMS, zbx_module_lxd_pressure, "container name, cpu, some, avg10"},
+        {"lxd.stats", CF_HAVEPARAMS, zbx_module_lxd_stats, "container name"},
+        {"lxd.age",  CF_HAVEPARAMS,  zbx_module_lxd_age,  "container name, memory.stat"},
+        {"lxd.api",  CF_HAVEPARAMS,  zbx_module_lxd_api,  "container name, status"},
+        {"lxd.module.stats", 0,      zbx_module_lxd_module_stats, NULL},
         {NULL}
 };
 
@@ -116,518 +622,7203 @@ ZBX_METRIC      *zbx_module_item_list()
 
 /******************************************************************************
  *                                                                            *
- * Function: zbx_lxd_dir_detect                                               *
+ * Function: zbx_lxd_layout_free                                              *
  *                                                                            *
- * Purpose: it should find metric folder - it depends on exec environment     *
+ ******************************************************************************/
+static void     zbx_lxd_layout_free(zbx_lxd_layout_t *l)
+{
+        zbx_free(l->stat_dir);
+        zbx_free(l->cpuset);
+        zbx_free(l->cpu);
+        zbx_free(l->cpuacct);
+        zbx_free(l->memory);
+        zbx_free(l->blkio);
+        zbx_free(l->unified);
+        zbx_free(l);
+}
+
+/******************************************************************************
  *                                                                            *
- * Return value: SYSINFO_RET_FAIL - stat folder was not found                 *
- *               SYSINFO_RET_OK - stat folder was found                       *
+ * Function: zbx_lxd_layout_create                                            *
+ *                                                                            *
+ * Purpose: new layout rooted at stat_dir                                     *
  *                                                                            *
  ******************************************************************************/
-int     zbx_lxd_dir_detect()
+static zbx_lxd_layout_t *zbx_lxd_layout_create(const char *stat_dir, int version)
 {
-        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_lxd_dir_detect()");
+        zbx_lxd_layout_t        *l;
 
-        char *drivers[] = {
-            "lxc/",           // LXC
-            ""
-        }, **tdriver;
-        char path[512];
-        char *temp1, *temp2;
-        FILE *fp;
-        DIR  *dir;
+        l = (zbx_lxd_layout_t *)zbx_malloc(NULL, sizeof(zbx_lxd_layout_t));
+        memset(l, 0, sizeof(zbx_lxd_layout_t));
+        l->version = version;
+        l->stat_dir = zbx_dsprintf(NULL, "%s/", stat_dir);
 
-        if ((fp = fopen("/proc/mounts", "r")) == NULL)
+        // all controllers of a container share its single cgroup2 directory
+        if (2 == version)
         {
-            zabbix_log(LOG_LEVEL_WARNING, "Cannot open /proc/mounts: %s", zbx_strerror(errno));
-            return SYSINFO_RET_FAIL;
+                l->cpuset = zbx_strdup(NULL, "");
+                l->cpu = zbx_strdup(NULL, "");
+                l->cpuacct = zbx_strdup(NULL, "");
+                l->memory = zbx_strdup(NULL, "");
+                l->blkio = zbx_strdup(NULL, "");
+                l->unified = zbx_strdup(NULL, "");
         }
 
-        while (fgets(path, 512, fp) != NULL)
-        {
-            if ((strstr(path, "cpuset cgroup")) != NULL)
-            {
-                temp1 = string_replace(path, "cgroup ", "");
-                temp2 = string_replace(temp1, strstr(temp1, " "), "");
-                free(temp1);
-                if (stat_dir != NULL) free(stat_dir);
-                stat_dir = string_replace(temp2, "cpuset", "");
-                free(temp2);
-                zabbix_log(LOG_LEVEL_DEBUG, "Detected LXD stat directory: %s", stat_dir);
-
-
-                pclose(fp);
-
-                char *cgroup = "cpuset/";
-                tdriver = drivers;
-                size_t  ddir_size;
-                char    *ddir;
-                while (*tdriver != "")
-                {
-                    ddir_size = strlen(cgroup) + strlen(stat_dir) + strlen(*tdriver) + 1;
-                    ddir = malloc(ddir_size);
-                    zbx_strlcpy(ddir, stat_dir, ddir_size);
-                    zbx_strlcat(ddir, cgroup, ddir_size);
-                    zbx_strlcat(ddir, *tdriver, ddir_size);
-                    zabbix_log(LOG_LEVEL_DEBUG, "ddir to test: %s", ddir);
-
-                    if (NULL != (dir = opendir(ddir)))
-                    {
-                        closedir(dir);
-                        free(ddir);
-                        driver = *tdriver;
-                        zabbix_log(LOG_LEVEL_DEBUG, "Detected used LXD driver dir: %s", driver);
-                        
-                        // detect cpu_cgroup - JoinController cpu,cpuacct
-                        cgroup = "cpu,cpuacct/";
-                        ddir_size = strlen(cgroup) + strlen(stat_dir) + 1;
-                        ddir = malloc(ddir_size);
-                        zbx_strlcpy(ddir, stat_dir, ddir_size);
-                        zbx_strlcat(ddir, cgroup, ddir_size);
-                        if (NULL != (dir = opendir(ddir)))
-                        {
-                            closedir(dir);
-                            cpu_cgroup = "cpu,cpuacct/";
-                            zabbix_log(LOG_LEVEL_DEBUG, "Detected JoinController cpu,cpuacct");
-                        } else {
-                            cpu_cgroup = "cpuacct/";
-                        }
-                        free(ddir);
-                        return SYSINFO_RET_OK;
-                    }
-                    *tdriver++;
-                    free(ddir);
-                }
-                driver = "";
-                zabbix_log(LOG_LEVEL_DEBUG, "Cannot detect used LXD driver");
-                return SYSINFO_RET_FAIL;
-            }
-        }
-        pclose(fp);
-        zabbix_log(LOG_LEVEL_DEBUG, "Cannot detect LXD stat directory");
-        return SYSINFO_RET_FAIL;
+        return l;
 }
 
 /******************************************************************************
  *                                                                            *
- * Function: zbx_module_lxd_up                                                *
+ * Function: zbx_lxd_layout_copy                                              *
  *                                                                            *
- * Purpose: check if container is running                                     *
+ ******************************************************************************/
+static zbx_lxd_layout_t *zbx_lxd_layout_copy(const zbx_lxd_layout_t *src)
+{
+        zbx_lxd_layout_t        *l;
+
+        l = (zbx_lxd_layout_t *)zbx_malloc(NULL, sizeof(zbx_lxd_layout_t));
+        memset(l, 0, sizeof(zbx_lxd_layout_t));
+        l->version = src->version;
+        l->driver = src->driver;
+        l->stat_dir = (NULL != src->stat_dir ? zbx_strdup(NULL, src->stat_dir) : NULL);
+        l->cpuset = (NULL != src->cpuset ? zbx_strdup(NULL, src->cpuset) : NULL);
+        l->cpu = (NULL != src->cpu ? zbx_strdup(NULL, src->cpu) : NULL);
+        l->cpuacct = (NULL != src->cpuacct ? zbx_strdup(NULL, src->cpuacct) : NULL);
+        l->memory = (NULL != src->memory ? zbx_strdup(NULL, src->memory) : NULL);
+        l->blkio = (NULL != src->blkio ? zbx_strdup(NULL, src->blkio) : NULL);
+        l->unified = (NULL != src->unified ? zbx_strdup(NULL, src->unified) : NULL);
+
+        return l;
+}
+
+/******************************************************************************
  *                                                                            *
- * Return value: 1 - is running, 0 - is not running                           *
+ * Function: zbx_lxd_layout_driver                                            *
+ *                                                                            *
+ * Purpose: find the driver directory of a layout                             *
+ *                                                                            *
+ * Comment: LXC 4 and newer create containers as lxc.payload.<name> right in  *
+ *          the hierarchy root, it is the fallback when no driver directory   *
+ *          exists there. The driver of a layout is only the one tried first, *
+ *          containers of all drivers are found.                              *
  *                                                                            *
  ******************************************************************************/
-int     zbx_module_lxd_up(AGENT_REQUEST *request, AGENT_RESULT *result)
+static void     zbx_lxd_layout_driver(zbx_lxd_layout_t *l)
 {
-        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_up()");
-        char    *container;
+        const char              **tdriver;
+        char                    path[MAX_STRING_LEN];
+        DIR                     *dir;
 
-        if (1 != request->nparam)
-        {
-                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
-                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
-                return SYSINFO_RET_FAIL;
-        }
+        l->driver = NULL;
 
-        if (stat_dir == NULL || driver == NULL)
-        {
-                zabbix_log(LOG_LEVEL_DEBUG, "up check is not available at the moment - no stat directory");
-                SET_MSG_RESULT(result, zbx_strdup(NULL, "up check is not available at the moment - no stat directory"));
-                return SYSINFO_RET_FAIL;
-        }
+        if (NULL == l->cpuset)
+                return;
 
-        if(cpu_cgroup == NULL)
+        for (tdriver = drivers; NULL != *tdriver; tdriver++)
         {
-                if (zbx_lxd_dir_detect() == SYSINFO_RET_FAIL)
+                if ('/' != (*tdriver)[strlen(*tdriver) - 1])
+                        continue;
+
+                zbx_snprintf(path, sizeof(path), "%s%s%s", l->stat_dir, l->cpuset, *tdriver);
+                zabbix_log(LOG_LEVEL_DEBUG, "ddir to test: %s", path);
+
+                if (NULL != (dir = opendir(path)))
                 {
-                    zabbix_log(LOG_LEVEL_DEBUG, "up check is not available at the moment - no cpu_cgroup directory");
-                    SET_MSG_RESULT(result, zbx_strdup(NULL, "up check is not available at the moment - no cpu_cgroup directory"));
-                    return SYSINFO_RET_FAIL;
+                        closedir(dir);
+                        l->driver = *tdriver;
+                        zabbix_log(LOG_LEVEL_DEBUG, "Detected used LXD driver dir: %s", l->driver);
+                        return;
                 }
         }
 
-        container = zbx_strdup(NULL, get_rparam(request, 0));
-        char    *stat_file = "/cpuacct.stat";
-        char    *cgroup = cpu_cgroup;
-        size_t  filename_size = strlen(cgroup) + strlen(container) + strlen(stat_dir) + strlen(driver) + strlen(stat_file) + 2;
-        char    *filename = malloc(filename_size);
-        zbx_strlcpy(filename, stat_dir, filename_size);
-        zbx_strlcat(filename, cgroup, filename_size);
-        zbx_strlcat(filename, driver, filename_size);
-        zbx_strlcat(filename, container, filename_size);
-        free(container);
-        zbx_strlcat(filename, stat_file, filename_size);
-        zabbix_log(LOG_LEVEL_DEBUG, "Metric source file: %s", filename);
+        l->driver = "lxc.payload.";
+        zabbix_log(LOG_LEVEL_DEBUG, "Using LXD container prefix: %s", l->driver);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_layout_relative                                          *
+ *                                                                            *
+ * Purpose: name of a hierarchy mounted right in stat_dir                     *
+ *                                                                            *
+ * Return value: allocated "<name>/" or NULL if mount is elsewhere            *
+ *                                                                            *
+ ******************************************************************************/
+static char     *zbx_lxd_layout_relative(const char *stat_dir, const char *mount, size_t mount_len)
+{
+        size_t  len = strlen(stat_dir);
 
-        FILE    *file;
-        if (NULL == (file = fopen(filename, "r")))
+        if (NULL == mount || mount_len <= len || 0 != strncmp(mount, stat_dir, len) ||
+                        NULL != memchr(mount + len, '/', mount_len - len))
         {
-                zabbix_log(LOG_LEVEL_DEBUG, "Cannot open metric file: '%s', container doesn't run", filename);
-                free(filename);
-                SET_UI64_RESULT(result, 0);
-                return SYSINFO_RET_OK;
+                return NULL;
         }
-        zbx_fclose(file);
-        zabbix_log(LOG_LEVEL_DEBUG, "Can open metric file: '%s', container is running", filename);
-        free(filename);
-        SET_UI64_RESULT(result, 1);
-        return SYSINFO_RET_OK;
+
+        return zbx_dsprintf(NULL, "%.*s/", (int)(mount_len - len), mount + len);
 }
 
 /******************************************************************************
  *                                                                            *
- * Function: zbx_module_lxd_mem                                               *
+ * Function: zbx_lxd_layout_mounts                                            *
  *                                                                            *
- * Purpose: container memory metrics                                          *
+ * Purpose: build the layout from the cgroup mounts of the agent              *
  *                                                                            *
- * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
- *                                 as not supported by zabbix                 *
- *               SYSINFO_RET_OK - success                                     *
+ * Return value: the layout or NULL if there is no cgroup mount to use        *
+ *                                                                            *
+ * Comment: v1 hierarchies are recognized by the controllers in their super   *
+ *          options, so joined (cpu,cpuacct), split and named hierarchies are *
+ *          told apart whatever their mount points are called. The cgroup2    *
+ *          mount is used only when there is no v1 cpuset hierarchy.         *
  *                                                                            *
- * Notes: https://www.kernel.org/doc/Documentation/cgroup-v1/memory.txt       *
  ******************************************************************************/
-int     zbx_module_lxd_mem(AGENT_REQUEST *request, AGENT_RESULT *result)
+static zbx_lxd_layout_t *zbx_lxd_layout_mounts()
 {
-        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_mem()");
-        char    *container, *metric;
-        int     ret = SYSINFO_RET_FAIL;
+        static const char       *controllers[] = {"cpuset", "cpu", "cpuacct", "memory", "blkio", NULL};
+        zbx_lxd_layout_t        *l;
+        char                    *buf = NULL, *line, *eol, *field, *mount, *fstype, *token, *p, *path;
+        const char              *mounts[6] = {NULL}, *unified = NULL;
+        size_t                  alloc = 0, len = 0, lens[6] = {0}, unified_len = 0;
+        ssize_t                 n;
+        int                     fd, i;
 
-        if (2 != request->nparam)
+        if (-1 == (fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC)))
         {
-                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
-                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
-                return SYSINFO_RET_FAIL;
+                zabbix_log(LOG_LEVEL_WARNING, "Cannot open /proc/self/mountinfo: %s", zbx_strerror(errno));
+                return NULL;
         }
 
-        if (stat_dir == NULL || driver == NULL)
+        while (1)
         {
-                zabbix_log(LOG_LEVEL_DEBUG, "mem metrics are not available at the moment - no stat directory");
-                SET_MSG_RESULT(result, zbx_strdup(NULL, "mem metrics are not available at the moment - no stat directory"));
-                return SYSINFO_RET_FAIL;
-        }
+                if (alloc - len < ZBX_KIBIBYTE)
+                        buf = (char *)zbx_realloc(buf, alloc += ZBX_KIBIBYTE * 16);
 
-        container = zbx_strdup(NULL, get_rparam(request, 0));
-        metric = get_rparam(request, 1);
-        char    *stat_file = "/memory.stat";
-        char    *cgroup = "memory/";
-        size_t  filename_size = strlen(cgroup) + strlen(container) + strlen(stat_dir) + strlen(driver) + strlen(stat_file) + 2;
-        char    *filename = malloc(filename_size);
-        zbx_strlcpy(filename, stat_dir, filename_size);
-        zbx_strlcat(filename, cgroup, filename_size);
-        zbx_strlcat(filename, driver, filename_size);
-        zbx_strlcat(filename, container, filename_size);
-        zbx_strlcat(filename, stat_file, filename_size);
-        zabbix_log(LOG_LEVEL_DEBUG, "Metric source file: %s", filename);
-        
-        FILE    *file;
-        if (NULL == (file = fopen(filename, "r")))
-        {
-                zabbix_log(LOG_LEVEL_ERR, "Cannot open metric file: '%s'", filename);
-                free(container);
-                free(filename);
-                SET_MSG_RESULT(result, strdup("Cannot open memory.stat file"));
-                return SYSINFO_RET_FAIL;
+                if (0 >= (n = read(fd, buf + len, alloc - len - 1)))
+                        break;
+
+                len += n;
         }
 
-        char    line[MAX_STRING_LEN];
-        char    *metric2 = malloc(strlen(metric)+3);
-        memcpy(metric2, metric, strlen(metric));
-        memcpy(metric2 + strlen(metric), " ", 2);
-        zbx_uint64_t    value = 0;
-        zabbix_log(LOG_LEVEL_DEBUG, "Looking metric %s in memory.stat file", metric);
-        while (NULL != fgets(line, sizeof(line), file))
+        close(fd);
+        buf[len] = '\0';
+
+        for (line = buf; '\0' != *line; line = eol)
         {
-                if (0 != strncmp(line, metric2, strlen(metric2)))
+                if (NULL == (eol = strchr(line, '\n')))
+                        eol = line + strlen(line);
+                else
+                        *eol++ = '\0';
+
+                // "<id> <parent> <dev> <root> <mount point> <options> [<optional>...] - <fstype> <source> <super options>"
+                for (field = line, i = 0; i < 4 && NULL != field; i++)
+                {
+                        if (NULL != (field = strchr(field, ' ')))
+                                field++;
+                }
+
+                if (NULL == (mount = field) || NULL == (p = strstr(mount, " - ")))
                         continue;
-                if (1 != sscanf(line, "%*s " ZBX_FS_UI64, &value))
+
+                fstype = p + 3;
+
+                if (0 == strncmp(fstype, "cgroup2 ", 8))
                 {
-                        zabbix_log(LOG_LEVEL_ERR, "sscanf failed for matched metric line");
+                        if (NULL == unified)
+                                unified_len = strchr(mount, ' ') - (unified = mount);
                         continue;
                 }
-                zabbix_log(LOG_LEVEL_DEBUG, "Id: %s; metric: %s; value: %d", container, metric, value);
-                SET_UI64_RESULT(result, value);
-                ret = SYSINFO_RET_OK;
-                break;
+
+                if (0 != strncmp(fstype, "cgroup ", 7) || NULL == (token = strchr(fstype + 7, ' ')))
+                        continue;
+
+                // super options list the controllers of a v1 hierarchy, named ones have only name=
+                for (token++; '\0' != *token; token = ('\0' != *p ? p + 1 : p))
+                {
+                        if (NULL == (p = strchr(token, ',')))
+                                p = token + strlen(token);
+
+                        for (i = 0; NULL != controllers[i]; i++)
+                        {
+                                if (NULL == mounts[i] && strlen(controllers[i]) == (size_t)(p - token) &&
+                                                0 == strncmp(token, controllers[i], p - token))
+                                {
+                                        lens[i] = strchr(mount, ' ') - (mounts[i] = mount);
+                                }
+                        }
+                }
         }
-        zbx_fclose(file);
 
-        free(container);
-        free(filename);
-        free(metric2);
+        if (NULL != mounts[0])
+        {
+                // v1 hierarchies are mounted side by side, /sys/fs/cgroup/<controllers>
+                for (p = (char *)mounts[0] + lens[0]; p > mounts[0] && '/' != p[-1]; p--)
+                        ;
 
-        if (SYSINFO_RET_FAIL == ret)
-                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot find a line with requested metric in memory.stat file"));
+                l = zbx_lxd_layout_create("", 1);
+                l->stat_dir = zbx_dsprintf(l->stat_dir, "%.*s", (int)(p - mounts[0]), mounts[0]);
+                l->cpuset = zbx_lxd_layout_relative(l->stat_dir, mounts[0], lens[0]);
+                l->cpu = zbx_lxd_layout_relative(l->stat_dir, mounts[1], lens[1]);
+                l->cpuacct = zbx_lxd_layout_relative(l->stat_dir, mounts[2], lens[2]);
+                l->memory = zbx_lxd_layout_relative(l->stat_dir, mounts[3], lens[3]);
+                l->blkio = zbx_lxd_layout_relative(l->stat_dir, mounts[4], lens[4]);
+                l->unified = zbx_lxd_layout_relative(l->stat_dir, unified, unified_len);
+                zabbix_log(LOG_LEVEL_DEBUG, "Detected LXD stat directory: %s, cpu: %s, cpuacct: %s, memory: %s,"
+                                " blkio: %s, unified: %s", l->stat_dir, ZBX_NULL2STR(l->cpu),
+                                ZBX_NULL2STR(l->cpuacct), ZBX_NULL2STR(l->memory), ZBX_NULL2STR(l->blkio),
+                                ZBX_NULL2STR(l->unified));
+        }
+        else if (NULL != unified)
+        {
+                path = zbx_dsprintf(NULL, "%.*s", (int)unified_len, unified);
+                l = zbx_lxd_layout_create(path, 2);
+                zbx_free(path);
+                zabbix_log(LOG_LEVEL_DEBUG, "Detected LXD cgroup2 stat directory: %s", l->stat_dir);
+        }
+        else
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot detect LXD stat directory");
+                l = NULL;
+        }
 
-        return ret;
+        zbx_free(buf);
+
+        return l;
 }
 
 /******************************************************************************
  *                                                                            *
- * Function: zbx_module_lxd_cpu                                               *
+ * Function: zbx_lxd_layout_root                                              *
  *                                                                            *
- * Purpose: container CPU metrics                                             *
+ * Purpose: build the layout of the hierarchy at the configured CgroupRoot    *
+ *          instead of the mounted ones, e.g. a copy of a host tree           *
  *                                                                            *
- * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
- *                                 as not supported by zabbix                 *
- *               SYSINFO_RET_OK - success                                     *
+ * Return value: the layout or NULL if root has no cgroup layout              *
+ *                                                                            *
+ * Comment: root with a cpuset directory is a v1 layout, otherwise it is      *
+ *          taken as a cgroup2 mount                                          *
  *                                                                            *
- * Notes: https://www.kernel.org/doc/Documentation/cgroup-v1/cpuacct.txt      *
  ******************************************************************************/
-int     zbx_module_lxd_cpu(AGENT_REQUEST *request, AGENT_RESULT *result)
+static zbx_lxd_layout_t *zbx_lxd_layout_root(const char *root)
 {
-        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_cpu()");
+        static const char       *names[] = {"cpuset", "cpu", "cpuacct", "memory", "blkio", "unified", NULL};
+        zbx_lxd_layout_t        *l;
+        char                    path[MAX_STRING_LEN], *dirs[6];
+        int                     i;
 
-        char    *container, *metric;
-        int     ret = SYSINFO_RET_FAIL;
+        zbx_snprintf(path, sizeof(path), "%s/cpuset", root);
 
-        if (2 != request->nparam)
-        {
-                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
-                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
-                return SYSINFO_RET_FAIL;
-        }
-
-        if (stat_dir == NULL || driver == NULL)
+        if (0 != access(path, F_OK))
         {
-                zabbix_log(LOG_LEVEL_DEBUG, "cpu metrics are not available at the moment - no stat directory");
-                SET_MSG_RESULT(result, zbx_strdup(NULL, "cpu metrics are not available at the moment - no stat directory"));
-                return SYSINFO_RET_FAIL;
-        }
+                zbx_snprintf(path, sizeof(path), "%s/cgroup.controllers", root);
 
-        if(cpu_cgroup == NULL)
-        {
-                if (zbx_lxd_dir_detect() == SYSINFO_RET_FAIL)
+                if (0 != access(path, F_OK))
                 {
-                    zabbix_log(LOG_LEVEL_DEBUG, "cpu check is not available at the moment - no cpu_cgroup directory");
-                    SET_MSG_RESULT(result, zbx_strdup(NULL, "cpu check is not available at the moment - no cpu_cgroup directory"));
-                    return SYSINFO_RET_FAIL;
+                        zabbix_log(LOG_LEVEL_WARNING, "CgroupRoot %s has neither cpuset nor cgroup.controllers", root);
+                        return NULL;
                 }
-        }
 
-        container = zbx_strdup(NULL, get_rparam(request, 0));
-        metric = get_rparam(request, 1);
-        char    *cgroup = NULL, *stat_file = NULL;
-        if(strcmp(metric, "user") == 0 || strcmp(metric, "system") == 0) {
-            stat_file = "/cpuacct.stat";
-            cgroup = cpu_cgroup;
-        } else {
-            stat_file = "/cpu.stat";
-            if (strchr(cpu_cgroup, ',') != NULL) {
-                cgroup = cpu_cgroup;
-            } else {
-                cgroup = "cpu/";
-            }
+                return zbx_lxd_layout_create(root, 2);
         }
 
-        zabbix_log(LOG_LEVEL_DEBUG, "cpu_cgroup: %s, cgroup: %s, stat_file: %s, metric: %s, container: %s", cpu_cgroup, cgroup, stat_file, metric, container);
-        size_t  filename_size = strlen(cgroup) + strlen(container) + strlen(stat_dir) + strlen(driver) + strlen(stat_file) + 2;
-        char    *filename = malloc(filename_size);
-       
-        zbx_strlcpy(filename, stat_dir, filename_size);
-        zbx_strlcat(filename, cgroup, filename_size);
-        zbx_strlcat(filename, driver, filename_size);
-        zbx_strlcat(filename, container, filename_size);
-        zbx_strlcat(filename, stat_file, filename_size);
-        zabbix_log(LOG_LEVEL_DEBUG, "Metric source file: %s", filename);
-        
-        FILE    *file;
-        if (NULL == (file = fopen(filename, "r")))
+        for (i = 0; NULL != names[i]; i++)
         {
-                zabbix_log(LOG_LEVEL_ERR, "Cannot open metric file: '%s'", filename);
-                free(filename);
-                free(container);
-                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot open %s file", ++stat_file));
-                return SYSINFO_RET_FAIL;
+                zbx_snprintf(path, sizeof(path), "%s/%s", root, names[i]);
+                dirs[i] = (0 == access(path, F_OK) ? zbx_dsprintf(NULL, "%s/", names[i]) : NULL);
         }
 
-        char    line[MAX_STRING_LEN];
-        char    *metric2 = malloc(strlen(metric)+3);
-        zbx_uint64_t cpu_num;
-        memcpy(metric2, metric, strlen(metric));
-        memcpy(metric2 + strlen(metric), " ", 2);
-        zbx_uint64_t    value = 0;
-        zabbix_log(LOG_LEVEL_DEBUG, "Looking metric %s in cpuacct.stat file", metric);
-        while (NULL != fgets(line, sizeof(line), file))
+        // cpu and cpuacct are usually joined, cpu and cpuacct are links to it then
+        zbx_snprintf(path, sizeof(path), "%s/cpu,cpuacct", root);
+
+        if (0 == access(path, F_OK))
         {
-                
-                if (0 != strncmp(line, metric2, strlen(metric2)))
-                        continue;
-                if (1 != sscanf(line, "%*s " ZBX_FS_UI64, &value))
-                {
-                        zabbix_log(LOG_LEVEL_ERR, "sscanf failed for matched metric line");
-                        continue;
-                }
-                // normalize CPU usage by using number of online CPUs
-                if (1 < (cpu_num = sysconf(_SC_NPROCESSORS_ONLN)))
-                {
-                    value /= cpu_num;
-                }
-                zabbix_log(LOG_LEVEL_DEBUG, "Id: %s; metric: %s; value: %d", container, metric, value);
-                SET_UI64_RESULT(result, value);
-                ret = SYSINFO_RET_OK;
-                break;
+                dirs[1] = zbx_dsprintf(dirs[1], "cpu,cpuacct/");
+                dirs[2] = zbx_dsprintf(dirs[2], "cpu,cpuacct/");
         }
-        zbx_fclose(file);
 
+        l = zbx_lxd_layout_create(root, 1);
+        l->cpuset = dirs[0];
+        l->cpu = dirs[1];
+        l->cpuacct = dirs[2];
+        l->memory = dirs[3];
+        l->blkio = dirs[4];
+        l->unified = dirs[5];
+        zabbix_log(LOG_LEVEL_DEBUG, "Using LXD stat directory: %s", l->stat_dir);
+
+        return l;
+}
+
+static int      zbx_lxd_str_equal(const char *s1, const char *s2)
+{
+        return (NULL == s1 || NULL == s2 ? s1 == s2 : 0 == strcmp(s1, s2));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_layout_publish                                           *
+ *                                                                            *
+ * Purpose: make a detected layout the current one unless it is the same      *
+ *                                                                            *
+ * Comment: the replaced layout is kept, other threads of the main agent      *
+ *          process may still read it; layouts change only with the mounts    *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_layout_publish(zbx_lxd_layout_t *l)
+{
+        zbx_lxd_layout_t        *current = layout;
+
+        if (current->version == l->version && zbx_lxd_str_equal(current->stat_dir, l->stat_dir) &&
+                        zbx_lxd_str_equal(current->driver, l->driver) &&
+                        zbx_lxd_str_equal(current->cpuset, l->cpuset) && zbx_lxd_str_equal(current->cpu, l->cpu) &&
+                        zbx_lxd_str_equal(current->cpuacct, l->cpuacct) &&
+                        zbx_lxd_str_equal(current->memory, l->memory) &&
+                        zbx_lxd_str_equal(current->blkio, l->blkio) &&
+                        zbx_lxd_str_equal(current->unified, l->unified))
+        {
+                zbx_lxd_layout_free(l);
+                return;
+        }
+
+        l->generation = current->generation + 1;
+        l->prev = current;
+        __atomic_store_n(&layout, l, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_dir_detect                                               *
+ *                                                                            *
+ * Purpose: it should find metric folder - it depends on exec environment     *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - stat folder was not found                 *
+ *               SYSINFO_RET_OK - stat folder was found                       *
+ *                                                                            *
+ * Comment: mountinfo is watched from before it is read, so a change racing   *
+ *          with the detection is noticed by zbx_lxd_layout_check()           *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_lxd_dir_detect()
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_lxd_dir_detect()");
+        ZBX_LXD_STATS_ADD(detects, 1);
+
+        zbx_lxd_layout_t        *l;
+
+        if (NULL != cgroup_root)
+        {
+                l = zbx_lxd_layout_root(cgroup_root);
+        }
+        else
+        {
+                if (mounts_pid != getpid())
+                {
+                        if (-1 != mounts_fd)
+                                close(mounts_fd);
+
+                        mounts_fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+                        mounts_pid = getpid();
+                }
+
+                l = zbx_lxd_layout_mounts();
+        }
+
+        if (NULL == l)
+                return SYSINFO_RET_FAIL;
+
+        zbx_lxd_layout_driver(l);
+        zbx_lxd_layout_publish(l);
+
+        return (NULL != layout->driver ? SYSINFO_RET_OK : SYSINFO_RET_FAIL);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_layout_check                                             *
+ *                                                                            *
+ * Purpose: make sure the current layout is usable, detect it again only      *
+ *          when the mount table has changed                                  *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - no stat folder or driver directory        *
+ *               SYSINFO_RET_OK - the layout can be used                      *
+ *                                                                            *
+ * Comment: called by every request, it costs a poll() of mountinfo. A layout *
+ *          without driver directory (LXD not started yet) probes just the    *
+ *          driver directories again.                                         *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_layout_check()
+{
+        zbx_lxd_layout_t        *l;
+        struct pollfd           pfd;
+
+        // the descriptor is not shared with the forked processes, each needs its own change events
+        if (NULL == cgroup_root && mounts_pid != getpid())
+        {
+                if (-1 != mounts_fd)
+                        close(mounts_fd);
+
+                mounts_fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+                mounts_pid = getpid();
+        }
+
+        if (-1 != mounts_fd && NULL == cgroup_root)
+        {
+                pfd.fd = mounts_fd;
+                pfd.events = POLLPRI;
+
+                if (0 < poll(&pfd, 1, 0) && 0 != (pfd.revents & (POLLPRI | POLLERR)))
+                {
+                        zabbix_log(LOG_LEVEL_DEBUG, "Mount table has changed");
+                        return zbx_lxd_dir_detect();
+                }
+        }
+
+        if (NULL == layout->stat_dir)
+                return (NULL != cgroup_root ? zbx_lxd_dir_detect() : SYSINFO_RET_FAIL);
+
+        if (NULL == layout->driver)
+        {
+                l = zbx_lxd_layout_copy(layout);
+                zbx_lxd_layout_driver(l);
+
+                if (NULL != l->driver)
+                        zbx_lxd_layout_publish(l);
+                else
+                        zbx_lxd_layout_free(l);
+        }
+
+        return (NULL != layout->driver ? SYSINFO_RET_OK : SYSINFO_RET_FAIL);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_hash                                                     *
+ *                                                                            *
+ ******************************************************************************/
+static unsigned int     zbx_lxd_hash(const char *name)
+{
+        unsigned int    hash = 5381;
+
+        for (; '\0' != *name; name++)
+                hash = hash * 33 + (unsigned char)*name;
+
+        return hash;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_driver_match                                             *
+ *                                                                            *
+ * Purpose: find the driver of an entry of a hierarchy root                   *
+ *                                                                            *
+ * Return value: index of the driver in drivers[] or -1 if the entry is       *
+ *               neither a driver directory nor a container directory         *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_driver_match(const char *entry)
+{
+        size_t  len;
+        int     i;
+
+        for (i = 0; NULL != drivers[i]; i++)
+        {
+                len = strlen(drivers[i]);
+
+                if ('/' == drivers[i][len - 1])
+                {
+                        if (0 == strncmp(entry, drivers[i], len - 1) && '\0' == entry[len - 1])
+                                return i;
+                }
+                else if (0 == strncmp(entry, drivers[i], len) && '\0' != entry[len])
+                        return i;
+        }
+
+        return -1;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_entry_dir                                                *
+ *                                                                            *
+ * Purpose: check that a directory entry is a directory                       *
+ *                                                                            *
+ * Comment: d_type is trusted, only file systems not filling it cost a stat   *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_entry_dir(int dfd, const struct dirent *d)
+{
+        struct stat     sb;
+
+        if (DT_DIR == d->d_type)
+                return SUCCEED;
+
+        if (DT_UNKNOWN != d->d_type)
+                return FAIL;
+
+        return (0 == fstatat(dfd, d->d_name, &sb, AT_SYMLINK_NOFOLLOW) && 0 != S_ISDIR(sb.st_mode) ? SUCCEED : FAIL);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_drivers_scan                                             *
+ *                                                                            *
+ * Purpose: call back for the container directories of all drivers            *
+ *                                                                            *
+ * Parameters: callback - [IN] called with the container name, its driver,   *
+ *                             descriptor of the directory holding it and     *
+ *                             its entry there                                *
+ *                                                                            *
+ * Return value: SUCCEED - the cpuset hierarchy root was read                 *
+ *               FAIL - the cpuset hierarchy root cannot be opened            *
+ *                                                                            *
+ * Comment: the hierarchy root is read once, prefixed containers are taken    *
+ *          from it and only the driver directories present are descended     *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_drivers_scan(void (*callback)(const char *container, const char *driver, int dfd,
+                const char *entry, void *arg), void *arg)
+{
+        struct dirent   *d, *e;
+        DIR             *dir, *sub;
+        char            *root;
+        size_t          len;
+        int             i, fd;
+
+        root = zbx_dsprintf(NULL, "%s%s", layout->stat_dir, layout->cpuset);
+
+        if (NULL == (dir = opendir(root)))
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "%s: %s", root, zbx_strerror(errno));
+                free(root);
+                return FAIL;
+        }
+        free(root);
+
+        while (NULL != (d = readdir(dir)))
+        {
+                // cgroup control files are skipped without a stat
+                if (DT_DIR != d->d_type && DT_UNKNOWN != d->d_type)
+                        continue;
+
+                if (-1 == (i = zbx_lxd_driver_match(d->d_name)) || SUCCEED != zbx_lxd_entry_dir(dirfd(dir), d))
+                        continue;
+
+                len = strlen(drivers[i]);
+
+                if ('/' != drivers[i][len - 1])
+                {
+                        callback(d->d_name + len, drivers[i], dirfd(dir), d->d_name, arg);
+                        continue;
+                }
+
+                if (-1 == (fd = openat(dirfd(dir), d->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)))
+                        continue;
+
+                if (NULL == (sub = fdopendir(fd)))
+                {
+                        close(fd);
+                        continue;
+                }
+
+                while (NULL != (e = readdir(sub)))
+                {
+                        if ('.' == e->d_name[0] || SUCCEED != zbx_lxd_entry_dir(dirfd(sub), e))
+                                continue;
+
+                        callback(e->d_name, drivers[i], dirfd(sub), e->d_name, arg);
+                }
+                closedir(sub);
+        }
+        closedir(dir);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_container_exists                                         *
+ *                                                                            *
+ * Purpose: check that a container has a cgroup under any driver              *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_container_exists(const char *name)
+{
+        char    path[MAX_STRING_LEN];
+        int     i;
+
+        for (i = 0; NULL != drivers[i]; i++)
+        {
+                zbx_snprintf(path, sizeof(path), "%s%s%s%s", layout->stat_dir, layout->cpuset, drivers[i], name);
+
+                if (0 == access(path, F_OK))
+                        return SUCCEED;
+        }
+
+        return FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_members_reset                                            *
+ *                                                                            *
+ * Purpose: stop watching the driver directories and forget all containers    *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_members_reset()
+{
+        zbx_lxd_member_t        *member;
+        int                     i;
+
+        if (-1 != members.fd)
+                close(members.fd);
+        members.fd = -1;
+        members.root = -1;
+
+        for (i = 0; i < ZBX_LXD_DRIVERS; i++)
+                members.wd[i] = -1;
+
+        for (i = 0; i < ZBX_LXD_BUCKETS; i++)
+        {
+                while (NULL != (member = members.buckets[i]))
+                {
+                        members.buckets[i] = member->next;
+                        free(member);
+                }
+        }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_member_get                                               *
+ *                                                                            *
+ * Purpose: find a container of the set, add it when create is set            *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_member_t *zbx_lxd_member_get(const char *name, int create)
+{
+        zbx_lxd_member_t        *member;
+        unsigned int            hash;
+
+        if (ZBX_LXD_NAME_LEN <= strlen(name))
+                return NULL;
+
+        hash = zbx_lxd_hash(name) % ZBX_LXD_BUCKETS;
+
+        for (member = members.buckets[hash]; NULL != member; member = member->next)
+        {
+                if (0 == strcmp(member->name, name))
+                        return member;
+        }
+
+        if (0 == create)
+                return NULL;
+
+        member = zbx_malloc(NULL, sizeof(zbx_lxd_member_t));
+        zbx_strlcpy(member->name, name, sizeof(member->name));
+        member->driver = NULL;
+        member->started = 0;
+        member->stopped = 0;
+        member->seen = 0;
+        member->next = members.buckets[hash];
+        members.buckets[hash] = member;
+
+        return member;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_member_start                                             *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_member_start(const char *name, const char *driver, time_t started)
+{
+        zbx_lxd_member_t        *member;
+
+        if (NULL == (member = zbx_lxd_member_get(name, 1)))
+                return;
+
+        member->driver = driver;
+
+        if (0 == member->started || 0 != member->stopped)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Container %s started", name);
+                member->started = started;
+                member->stopped = 0;
+        }
+        member->seen = members.scan;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_member_stop                                              *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_member_stop(zbx_lxd_member_t *member, time_t stopped)
+{
+        if (NULL == member || 0 != member->stopped)
+                return;
+
+        zabbix_log(LOG_LEVEL_DEBUG, "Container %s stopped", member->name);
+        member->stopped = stopped;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_member_found                                             *
+ *                                                                            *
+ * Purpose: add a container found by the scan, it started when its cgroup     *
+ *          directory was created                                             *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_member_found(const char *name, const char *driver, int dfd, const char *entry, void *arg)
+{
+        struct stat     sb;
+
+        if (0 == fstatat(dfd, entry, &sb, 0))
+                zbx_lxd_member_start(name, driver, sb.st_ctime);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_members_scan                                             *
+ *                                                                            *
+ * Purpose: read the driver directories into the set, containers no longer    *
+ *          there are marked stopped                                          *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_members_scan()
+{
+        zbx_lxd_member_t        *member;
+        time_t                  now = time(NULL);
+        int                     i;
+
+        members.scan++;
+
+        if (SUCCEED != zbx_lxd_drivers_scan(zbx_lxd_member_found, NULL))
+                return FAIL;
+
+        for (i = 0; i < ZBX_LXD_BUCKETS; i++)
+        {
+                for (member = members.buckets[i]; NULL != member; member = member->next)
+                {
+                        if (member->seen != members.scan)
+                                zbx_lxd_member_stop(member, now);
+                }
+        }
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_members_watch                                            *
+ *                                                                            *
+ * Purpose: watch a driver directory of the cpuset hierarchy root             *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_members_watch(int i)
+{
+        char    *path;
+
+        path = zbx_dsprintf(NULL, "%s%s%s", layout->stat_dir, layout->cpuset, drivers[i]);
+
+        if (-1 == (members.wd[i] = inotify_add_watch(members.fd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                        IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot watch %s: %s", path, zbx_strerror(errno));
+        }
+
+        free(path);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_members_sync                                             *
+ *                                                                            *
+ * Purpose: apply pending inotify events of the driver directories to the set *
+ *                                                                            *
+ * Return value: SUCCEED - the set is up to date                              *
+ *               FAIL - the directories cannot be watched, the caller should  *
+ *                      read them instead                                     *
+ *                                                                            *
+ * Comment: the set is created on first use in every agent process, an       *
+ *          inotify descriptor inherited over fork() would be shared. Stop    *
+ *          time is when the process noticed the event. The hierarchy root is *
+ *          watched for prefixed containers and driver directories appearing, *
+ *          each driver directory present for its containers.                 *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_members_sync()
+{
+        char                    buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        const struct inotify_event      *event;
+        const char              *name;
+        zbx_lxd_member_t        *member, **prev;
+        char                    *root;
+        ssize_t                 n, i;
+        time_t                  now = time(NULL);
+        double                  clock = zbx_time();
+        int                     rescan = 0, b, d;
+
+        if (NULL == layout->stat_dir || NULL == layout->driver)
+                return FAIL;
+
+        if (members.pid != getpid() || members.generation != layout->generation)
+        {
+                zbx_lxd_members_reset();
+                members.pid = getpid();
+                members.generation = layout->generation;
+                members.failed = 0;
+        }
+
+        if (-1 == members.fd)
+        {
+                if (0 != members.failed && members.failed + ZBX_LXD_WATCH_RETRY > clock)
+                        return FAIL;
+
+                root = zbx_dsprintf(NULL, "%s%s", layout->stat_dir, layout->cpuset);
+
+                if (-1 == (members.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) ||
+                                -1 == (members.root = inotify_add_watch(members.fd, root, IN_CREATE | IN_DELETE |
+                                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)))
+                {
+                        zabbix_log(LOG_LEVEL_DEBUG, "Cannot watch %s: %s", root, zbx_strerror(errno));
+                        free(root);
+                        zbx_lxd_members_reset();
+                        members.failed = clock;
+                        return FAIL;
+                }
+                free(root);
+
+                for (d = 0; NULL != drivers[d]; d++)
+                {
+                        if ('/' == drivers[d][strlen(drivers[d]) - 1])
+                                zbx_lxd_members_watch(d);
+                }
+
+                // containers started before the watches were added
+                if (SUCCEED != zbx_lxd_members_scan())
+                {
+                        zbx_lxd_members_reset();
+                        members.failed = clock;
+                        return FAIL;
+                }
+        }
+
+        while (0 < (n = read(members.fd, buf, sizeof(buf))))
+        {
+                for (i = 0; i < n; i += sizeof(struct inotify_event) + event->len)
+                {
+                        event = (const struct inotify_event *)(buf + i);
+
+                        if (0 != (event->mask & IN_Q_OVERFLOW))
+                        {
+                                rescan = 1;
+                                continue;
+                        }
+
+                        if (event->wd == members.root)
+                        {
+                                if (0 != (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)))
+                                {
+                                        // the hierarchy root is gone, watch it again on the next call
+                                        zbx_lxd_members_reset();
+                                        return FAIL;
+                                }
+
+                                if (0 == (event->mask & IN_ISDIR) || 0 == event->len ||
+                                                -1 == (d = zbx_lxd_driver_match(event->name)))
+                                {
+                                        continue;
+                                }
+
+                                if ('/' == drivers[d][strlen(drivers[d]) - 1])
+                                {
+                                        // containers of a driver directory come and go with it
+                                        if (0 != (event->mask & (IN_CREATE | IN_MOVED_TO)) && -1 == members.wd[d])
+                                                zbx_lxd_members_watch(d);
+                                        rescan = 1;
+                                        continue;
+                                }
+
+                                name = event->name + strlen(drivers[d]);
+                        }
+                        else
+                        {
+                                for (d = 0; d < ZBX_LXD_DRIVERS && members.wd[d] != event->wd; d++)
+                                        ;
+
+                                if (ZBX_LXD_DRIVERS == d)
+                                        continue;
+
+                                if (0 != (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)))
+                                {
+                                        if (0 == (event->mask & IN_IGNORED))
+                                                inotify_rm_watch(members.fd, members.wd[d]);
+                                        members.wd[d] = -1;
+                                        rescan = 1;
+                                        continue;
+                                }
+
+                                if (0 == (event->mask & IN_ISDIR) || 0 == event->len)
+                                        continue;
+
+                                name = event->name;
+                        }
+
+                        if (0 != (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                                zbx_lxd_member_start(name, drivers[d], now);
+                        else
+                                zbx_lxd_member_stop(zbx_lxd_member_get(name, 0), now);
+                }
+        }
+
+        if (0 != rescan && SUCCEED != zbx_lxd_members_scan())
+        {
+                zbx_lxd_members_reset();
+                return FAIL;
+        }
+
+        // forget containers stopped long ago
+        for (b = 0; b < ZBX_LXD_BUCKETS; b++)
+        {
+                for (prev = &members.buckets[b]; NULL != (member = *prev);)
+                {
+                        if (0 != member->stopped && member->stopped + ZBX_LXD_EXPIRE < now)
+                        {
+                                *prev = member->next;
+                                free(member);
+                                continue;
+                        }
+                        prev = &member->next;
+                }
+        }
+
+        return SUCCEED;
+}
+
+/* containers_walk() callback and its argument, for the scan fallback */
+typedef struct
+{
+        void    (*callback)(const char *container, const char *driver, void *arg);
+        void    *arg;
+}
+zbx_lxd_walk_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_walk_found                                               *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_walk_found(const char *name, const char *driver, int dfd, const char *entry, void *arg)
+{
+        zbx_lxd_walk_t  *walk = (zbx_lxd_walk_t *)arg;
+
+        walk->callback(name, driver, walk->arg);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_containers_walk                                          *
+ *                                                                            *
+ * Purpose: call back for every running container, and also for containers   *
+ *          stopped in the last ZBX_LXD_EXPIRE seconds when stopped is set    *
+ *                                                                            *
+ * Return value: SUCCEED - the driver directories were read                   *
+ *               FAIL - the cpuset hierarchy root cannot be opened            *
+ *                                                                            *
+ * Comment: the inotify maintained set is used when available, otherwise the  *
+ *          cpuset driver directories are read and stopped containers are not *
+ *          known                                                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_containers_walk(void (*callback)(const char *container, const char *driver, void *arg),
+                void *arg, int stopped)
+{
+        zbx_lxd_member_t        *member;
+        zbx_lxd_walk_t          walk = {callback, arg};
+        double                  started = zbx_time();
+        int                     i, ret;
+
+        ZBX_LXD_STATS_ADD(walks, 1);
+
+        if (SUCCEED == zbx_lxd_members_sync())
+        {
+                for (i = 0; i < ZBX_LXD_BUCKETS; i++)
+                {
+                        for (member = members.buckets[i]; NULL != member; member = member->next)
+                        {
+                                if (0 == member->stopped || 0 != stopped)
+                                        callback(member->name, member->driver, arg);
+                        }
+                }
+
+                ZBX_LXD_STATS_ADD(walk_usec, (zbx_uint64_t)((zbx_time() - started) * 1000000));
+
+                return SUCCEED;
+        }
+
+        zabbix_log(LOG_LEVEL_DEBUG, "lxd containers walk-> root: %s%s", layout->stat_dir, layout->cpuset);
+
+        ret = zbx_lxd_drivers_scan(zbx_lxd_walk_found, &walk);
+
+        ZBX_LXD_STATS_ADD(walk_usec, (zbx_uint64_t)((zbx_time() - started) * 1000000));
+
+        return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_reader_flush                                             *
+ *                                                                            *
+ * Purpose: close all cached directories and release the read buffer          *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_reader_flush(zbx_lxd_reader_t *cache)
+{
+        zbx_lxd_dirfd_t *dirfd;
+        int             i;
+
+        for (i = 0; i < ZBX_LXD_BUCKETS; i++)
+        {
+                while (NULL != (dirfd = cache->buckets[i]))
+                {
+                        cache->buckets[i] = dirfd->next;
+                        close(dirfd->fd);
+                        free(dirfd->cgroup);
+                        free(dirfd);
+                }
+        }
+
+        cache->count = 0;
+        zbx_free(cache->buf);
+        cache->buf_alloc = 0;
+        zbx_free(cache->unified.stats);
+        cache->unified.stats_alloc = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_dirfd_get                                                *
+ *                                                                            *
+ * Purpose: return cached O_PATH descriptor of a cgroup directory, open and   *
+ *          cache it if needed                                                *
+ *                                                                            *
+ * Parameters: cache  - [IN] the directory cache                              *
+ *             cgroup - [IN] cgroup hierarchy, e.g. "memory/", NULL if it  *
+ *                           is not mounted                                   *
+ *             name   - [IN] container name, empty string for the root of the  *
+ *                           hierarchy                                        *
+ *                                                                            *
+ * Return value: the cached entry or NULL if the directory cannot be opened   *
+ *                                                                            *
+ * Comment: container directories are opened relative to the cached          *
+ *          hierarchy root, the layout driver is tried first and then the     *
+ *          others. The least recently used one is closed when there are      *
+ *          MaxDirFds of them.                                                *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_dirfd_t  *zbx_lxd_dirfd_get(zbx_lxd_reader_t *cache, const char *cgroup, const char *name)
+{
+        zbx_lxd_dirfd_t *dirfd, *parent, **prev, **oldest = NULL;
+        unsigned int    hash;
+        char            *path, entry[ZBX_LXD_NAME_LEN * 2];
+        int             fd, i;
+
+        if (cache->generation != layout->generation)
+        {
+                zbx_lxd_reader_flush(cache);
+                cache->generation = layout->generation;
+        }
+
+        if (NULL == cgroup)
+                return NULL;
+
+        hash = (zbx_lxd_hash(cgroup) + zbx_lxd_hash(name)) % ZBX_LXD_BUCKETS;
+
+        for (dirfd = cache->buckets[hash]; NULL != dirfd; dirfd = dirfd->next)
+        {
+                if (0 == strcmp(dirfd->name, name) && 0 == strcmp(dirfd->cgroup, cgroup))
+                {
+                        dirfd->lastuse = zbx_time();
+                        return dirfd;
+                }
+        }
+
+        if ('\0' == *name)
+        {
+                path = zbx_dsprintf(NULL, "%s%s", layout->stat_dir, cgroup);
+                fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+                free(path);
+        }
+        else if (NULL != (parent = zbx_lxd_dirfd_get(cache, cgroup, "")))
+        {
+                zbx_snprintf(entry, sizeof(entry), "%s%s", layout->driver, name);
+                fd = openat(parent->fd, entry, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+                for (i = 0; -1 == fd && NULL != drivers[i]; i++)
+                {
+                        if (drivers[i] == layout->driver)
+                                continue;
+
+                        zbx_snprintf(entry, sizeof(entry), "%s%s", drivers[i], name);
+                        fd = openat(parent->fd, entry, O_PATH | O_DIRECTORY | O_CLOEXEC);
+                }
+        }
+        else
+                fd = -1;
+
+        if (-1 == fd)
+                return NULL;
+
+        if ('\0' != *name && cache->count >= max_dirfds)
+        {
+                for (i = 0; i < ZBX_LXD_BUCKETS; i++)
+                {
+                        for (prev = &cache->buckets[i]; NULL != *prev; prev = &(*prev)->next)
+                        {
+                                if ('\0' == (*prev)->name[0])
+                                        continue;
+
+                                if (NULL == oldest || (*prev)->lastuse < (*oldest)->lastuse)
+                                        oldest = prev;
+                        }
+                }
+
+                if (NULL != oldest)
+                {
+                        dirfd = *oldest;
+                        *oldest = dirfd->next;
+                        close(dirfd->fd);
+                        free(dirfd->cgroup);
+                        free(dirfd);
+                        cache->count--;
+                }
+        }
+
+        dirfd = zbx_malloc(NULL, sizeof(zbx_lxd_dirfd_t));
+        dirfd->cgroup = zbx_strdup(NULL, cgroup);
+        zbx_strlcpy(dirfd->name, name, sizeof(dirfd->name));
+        dirfd->fd = fd;
+        dirfd->lastuse = zbx_time();
+        dirfd->next = cache->buckets[hash];
+        cache->buckets[hash] = dirfd;
+
+        if ('\0' != *name)
+                cache->count++;
+
+        return dirfd;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_dirfd_drop                                               *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_dirfd_drop(zbx_lxd_reader_t *cache, zbx_lxd_dirfd_t *dirfd)
+{
+        zbx_lxd_dirfd_t **prev;
+        unsigned int    hash;
+
+        hash = (zbx_lxd_hash(dirfd->cgroup) + zbx_lxd_hash(dirfd->name)) % ZBX_LXD_BUCKETS;
+
+        for (prev = &cache->buckets[hash]; NULL != *prev; prev = &(*prev)->next)
+        {
+                if (*prev != dirfd)
+                        continue;
+
+                *prev = dirfd->next;
+                if ('\0' != dirfd->name[0])
+                        cache->count--;
+                close(dirfd->fd);
+                free(dirfd->cgroup);
+                free(dirfd);
+                break;
+        }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_openat                                                   *
+ *                                                                            *
+ * Purpose: open a stat file of a container relative to its cached cgroup     *
+ *          directory                                                         *
+ *                                                                            *
+ * Return value: file descriptor or -1 if the file cannot be opened           *
+ *                                                                            *
+ * Comment: a removed (and maybe recreated) container leaves a stale cached   *
+ *          directory behind, it is reopened once                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_openat(zbx_lxd_reader_t *cache, const char *cgroup, const char *name, const char *stat_file)
+{
+        zbx_lxd_dirfd_t *dirfd;
+        int             fd, retry;
+
+        if (NULL == layout->stat_dir || NULL == layout->driver || ZBX_LXD_NAME_LEN <= strlen(name))
+        {
+                errno = ENOENT;
+                return -1;
+        }
+
+        for (retry = 0; retry < 2; retry++)
+        {
+                if (NULL == (dirfd = zbx_lxd_dirfd_get(cache, cgroup, name)))
+                        return -1;
+
+                if (-1 != (fd = openat(dirfd->fd, stat_file, O_RDONLY | O_CLOEXEC)))
+                        break;
+
+                if (ENOENT != errno && ESTALE != errno && ENODEV != errno)
+                        break;
+
+                zbx_lxd_dirfd_drop(cache, dirfd);
+        }
+
+        return fd;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_free                                            *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_snapshot_free(zbx_lxd_snapshot_t *snapshot)
+{
+        free(snapshot->cgroup);
+        free(snapshot->stat_file);
+        free(snapshot->stats);
+        free(snapshot);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_container_free                                           *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_container_free(zbx_lxd_container_t *container)
+{
+        zbx_lxd_snapshot_t      *snapshot;
+
+        while (NULL != (snapshot = container->snapshots))
+        {
+                container->snapshots = snapshot->next;
+                zbx_lxd_snapshot_free(snapshot);
+        }
+
+        if (NULL != container->net)
+                zbx_lxd_snapshot_free(container->net);
+
+        free(container->devices);
+        free(container->procs);
+        free(container->name);
         free(container);
-        free(filename);
-        free(metric2);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_container_get                                            *
+ *                                                                            *
+ * Purpose: find container in the per-process registry, register it if it is  *
+ *          not known yet                                                     *
+ *                                                                            *
+ * Comment: containers that were not polled for ZBX_LXD_EXPIRE seconds are    *
+ *          dropped, so removed containers do not pile up                     *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_container_t      *zbx_lxd_container_get(const char *name, double now)
+{
+        zbx_lxd_container_t     *container, **prev;
+        unsigned int            hash, i;
+
+        if (containers_swept + ZBX_LXD_EXPIRE < now)
+        {
+                for (i = 0; i < ZBX_LXD_BUCKETS; i++)
+                {
+                        for (prev = &containers[i]; NULL != (container = *prev);)
+                        {
+                                if (container->lastaccess + ZBX_LXD_EXPIRE < now)
+                                {
+                                        zabbix_log(LOG_LEVEL_DEBUG, "Dropping cached stats of container %s", container->name);
+                                        *prev = container->next;
+                                        zbx_lxd_container_free(container);
+                                        continue;
+                                }
+                                prev = &container->next;
+                        }
+                }
+                containers_swept = now;
+        }
+
+        hash = zbx_lxd_hash(name) % ZBX_LXD_BUCKETS;
+
+        for (container = containers[hash]; NULL != container; container = container->next)
+        {
+                if (0 == strcmp(container->name, name))
+                        break;
+        }
+
+        if (NULL == container)
+        {
+                container = zbx_malloc(NULL, sizeof(zbx_lxd_container_t));
+                container->name = zbx_strdup(NULL, name);
+                container->snapshots = NULL;
+                memset(&container->rates, 0, sizeof(container->rates));
+                container->cpus = 0;
+                container->cpus_checked = 0;
+                container->devices = NULL;
+                container->ndevices = 0;
+                container->io_sampled = 0;
+                container->net_pid = 0;
+                container->net_ns = 0;
+                container->net = NULL;
+                container->procs = NULL;
+                container->nprocs = 0;
+                container->procs_sampled = 0;
+                container->next = containers[hash];
+                containers[hash] = container;
+        }
+
+        container->lastaccess = now;
+
+        return container;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_known_key                                                *
+ *                                                                            *
+ * Return value: index of the key in known_keys or -1                         *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_known_key_compare(const void *d1, const void *d2)
+{
+        return strcmp(*(const char * const *)d1, *(const char * const *)d2);
+}
+
+static int      zbx_lxd_known_key(const char *key)
+{
+        const char      **known;
+
+        if (NULL == (known = bsearch(&key, known_keys, ZBX_LXD_KNOWN_KEYS, sizeof(*known_keys),
+                        zbx_lxd_known_key_compare)))
+        {
+                return -1;
+        }
+
+        return known - known_keys;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_index                                           *
+ *                                                                            *
+ * Purpose: map known keys to their position in the snapshot                  *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_snapshot_index(zbx_lxd_snapshot_t *snapshot)
+{
+        int     i;
+
+        memset(snapshot->index, 0, sizeof(snapshot->index));
+
+        for (i = 0; i < snapshot->nstats; i++)
+        {
+                if (0 <= snapshot->stats[i].id && 0 == snapshot->index[snapshot->stats[i].id])
+                        snapshot->index[snapshot->stats[i].id] = i + 1;
+        }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_uint64                                                   *
+ *                                                                            *
+ * Purpose: convert the decimal number between p and end                      *
+ *                                                                            *
+ * Return value: SUCCEED - the whole range is a number that fits uint64       *
+ *               FAIL - otherwise                                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_uint64(const char *p, const char *end, zbx_uint64_t *value)
+{
+        zbx_uint64_t    digit;
+
+        if (p == end)
+                return FAIL;
+
+        for (*value = 0; p < end; p++)
+        {
+                if ('0' > *p || '9' < *p || *value > (ZBX_MAX_UINT64 - (digit = *p - '0')) / 10)
+                        return FAIL;
+
+                *value = *value * 10 + digit;
+        }
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_add                                             *
+ *                                                                            *
+ * Purpose: append a value to the snapshot, keys too long are skipped         *
+ *                                                                            *
+ * Parameters: snapshot - [OUT] the snapshot                                  *
+ *             key      - [IN] the key, need not be terminated                *
+ *             len      - [IN] key length                                     *
+ *             value    - [IN] the value                                      *
+ *                                                                            *
+ * Comment: the snapshot index is not updated                                 *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_snapshot_add(zbx_lxd_snapshot_t *snapshot, const char *key, size_t len, zbx_uint64_t value)
+{
+        zbx_lxd_stat_t  *stat;
+
+        if (ZBX_LXD_KEY_LEN <= len)
+                return;
+
+        if (snapshot->nstats == snapshot->stats_alloc)
+        {
+                snapshot->stats_alloc += 32;
+                snapshot->stats = zbx_realloc(snapshot->stats, snapshot->stats_alloc * sizeof(zbx_lxd_stat_t));
+        }
+
+        stat = &snapshot->stats[snapshot->nstats++];
+        memcpy(stat->key, key, len);
+        stat->key[len] = '\0';
+        stat->id = zbx_lxd_known_key(stat->key);
+        stat->value = value;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_parse                                           *
+ *                                                                            *
+ * Purpose: parse "key value" and "key subkey value" lines into the snapshot  *
+ *                                                                            *
+ * Parameters: snapshot - [OUT] the snapshot                                  *
+ *             buf      - [IN] stat file content, need not be terminated      *
+ *             len      - [IN] content length                                 *
+ *                                                                            *
+ * Comment: does not allocate once the snapshot has grown to the file size,   *
+ *          unparsable lines are skipped                                      *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_snapshot_parse(zbx_lxd_snapshot_t *snapshot, const char *buf, size_t len)
+{
+        const char      *p = buf, *end = buf + len, *key, *key_end, *eol;
+        zbx_uint64_t    value;
+
+        snapshot->nstats = 0;
+
+        for (; p < end; p = eol + 1)
+        {
+                if (NULL == (eol = memchr(p, '\n', end - p)))
+                        eol = end;
+
+                // key is everything up to the last space, e.g. "total_rss" or "8:0 Read"
+                for (key = p, key_end = eol; key_end > key && ' ' != key_end[-1]; key_end--)
+                        ;
+
+                if (key_end <= key + 1 || key_end == eol)
+                        continue;
+
+                if (SUCCEED == zbx_lxd_uint64(key_end, eol, &value))
+                        zbx_lxd_snapshot_add(snapshot, key, key_end - key - 1, value);
+        }
+
+        zbx_lxd_snapshot_index(snapshot);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_value                                           *
+ *                                                                            *
+ * Purpose: find metric value in the snapshot                                 *
+ *                                                                            *
+ * Comment: known keys are found through the snapshot index, other metrics    *
+ *          match either the whole key or its first word, so "8:0" returns    *
+ *          the first line of the device like before                          *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_snapshot_value(const zbx_lxd_snapshot_t *snapshot, const char *metric, zbx_uint64_t *value)
+{
+        size_t  len = strlen(metric);
+        int     i;
+
+        if (0 <= (i = zbx_lxd_known_key(metric)))
+        {
+                if (0 == snapshot->index[i])
+                        return FAIL;
+
+                *value = snapshot->stats[snapshot->index[i] - 1].value;
+                return SUCCEED;
+        }
+
+        for (i = 0; i < snapshot->nstats; i++)
+        {
+                if (0 != strncmp(snapshot->stats[i].key, metric, len))
+                        continue;
+
+                if ('\0' != snapshot->stats[i].key[len] && ' ' != snapshot->stats[i].key[len])
+                        continue;
+
+                *value = snapshot->stats[i].value;
+                return SUCCEED;
+        }
+
+        return FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_fd_read                                                  *
+ *                                                                            *
+ * Purpose: read an open proc or cgroup file with a single read() into the    *
+ *          reader buffer and close it                                        *
+ *                                                                            *
+ * Return value: SUCCEED - the file was read                                  *
+ *               FAIL - read error                                            *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_fd_read(zbx_lxd_reader_t *cache, int fd, size_t *len)
+{
+        ssize_t n;
+
+        if (0 == cache->buf_alloc)
+        {
+                cache->buf_alloc = ZBX_KIBIBYTE * 8;
+                cache->buf = zbx_malloc(NULL, cache->buf_alloc);
+        }
+
+        ZBX_LXD_STATS_ADD(file_opens, 1);
+
+        // seq_file based files return everything in one read() when the buffer is large enough
+        for (*len = 0; 0 < (n = read(fd, cache->buf + *len, cache->buf_alloc - *len));)
+        {
+                ZBX_LXD_STATS_ADD(file_reads, 1);
+
+                if ((*len += n) < cache->buf_alloc)
+                        continue;
+
+                if (ZBX_LXD_READ_MAX <= cache->buf_alloc)
+                        break;
+
+                cache->buf_alloc *= 2;
+                cache->buf = zbx_realloc(cache->buf, cache->buf_alloc);
+        }
+        close(fd);
+        ZBX_LXD_STATS_ADD(bytes_parsed, *len);
+
+        return (-1 == n ? FAIL : SUCCEED);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_file_read                                                *
+ *                                                                            *
+ * Purpose: read a cgroup stat file into the reader buffer                    *
+ *                                                                            *
+ * Parameters: cache     - [IN/OUT] the reader, its buffer holds the content  *
+ *             cgroup    - [IN] cgroup hierarchy                              *
+ *             name      - [IN] container name                                *
+ *             stat_file - [IN] the file                                      *
+ *             len       - [OUT] content length                               *
+ *                                                                            *
+ * Return value: SUCCEED - the file was read                                  *
+ *               FAIL - the file cannot be opened                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_file_read(zbx_lxd_reader_t *cache, const char *cgroup, const char *name, const char *stat_file,
+                size_t *len)
+{
+        int     fd;
+
+        if (-1 == (fd = zbx_lxd_openat(cache, cgroup, name, stat_file)))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot open metric file '%s' of container '%s' in '%s%s': %s",
+                                stat_file, name, ZBX_NULL2STR(layout->stat_dir), ZBX_NULL2STR(cgroup),
+                                zbx_strerror(errno));
+                return FAIL;
+        }
+
+        if (SUCCEED != zbx_lxd_fd_read(cache, fd, len))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot read metric file: '%s%s': %s", cgroup, stat_file,
+                                zbx_strerror(errno));
+                return FAIL;
+        }
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_read                                            *
+ *                                                                            *
+ * Purpose: read a cgroup stat file and parse it into the snapshot            *
+ *                                                                            *
+ * Return value: SUCCEED - the file was read                                  *
+ *               FAIL - the file cannot be opened                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_snapshot_read(zbx_lxd_snapshot_t *snapshot, zbx_lxd_reader_t *cache, const char *cgroup,
+                const char *name, const char *stat_file)
+{
+        size_t  len;
+
+        if (SUCCEED != zbx_lxd_file_read(cache, cgroup, name, stat_file, &len))
+                return FAIL;
+
+        zbx_lxd_snapshot_parse(snapshot, cache->buf, len);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_pressure_parse                                           *
+ *                                                                            *
+ * Purpose: parse "some avg10=0.12 avg60=0.05 avg300=0.01 total=1234" lines   *
+ *          into "some avg10", ... "full total" values                        *
+ *                                                                            *
+ * Comment: averages are percentages with two decimals, they are kept         *
+ *          multiplied by 100 to fit the integer snapshot                     *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_pressure_parse(zbx_lxd_snapshot_t *snapshot, const char *buf, size_t len)
+{
+        const char      *p, *end = buf + len, *eol, *type, *field, *value, *dot;
+        zbx_uint64_t    ui64, fraction;
+        char            key[ZBX_LXD_KEY_LEN];
+        size_t          key_len;
+        int             type_len;
+
+        snapshot->nstats = 0;
+
+        for (p = buf; p < end; p = eol + 1)
+        {
+                if (NULL == (eol = memchr(p, '\n', end - p)))
+                        eol = end;
+
+                for (type = p; p < eol && ' ' != *p; p++)
+                        ;
+
+                for (type_len = (int)(p - type); p < eol; )
+                {
+                        for (field = ++p; p < eol && ' ' != *p; p++)
+                                ;
+
+                        if (NULL == (value = memchr(field, '=', p - field)))
+                                continue;
+
+                        value++;
+
+                        if (NULL == (dot = memchr(value, '.', p - value)))
+                        {
+                                if (SUCCEED != zbx_lxd_uint64(value, p, &ui64))
+                                        continue;
+                        }
+                        else
+                        {
+                                if (SUCCEED != zbx_lxd_uint64(value, dot, &ui64) || 3 != p - dot ||
+                                                SUCCEED != zbx_lxd_uint64(dot + 1, p, &fraction))
+                                {
+                                        continue;
+                                }
+
+                                ui64 = ui64 * 100 + fraction;
+                        }
+
+                        key_len = zbx_snprintf(key, sizeof(key), "%.*s %.*s", type_len, type,
+                                        (int)(value - field - 1), field);
+                        zbx_lxd_snapshot_add(snapshot, key, key_len, ui64);
+                }
+        }
+
+        zbx_lxd_snapshot_index(snapshot);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_file_value                                               *
+ *                                                                            *
+ * Purpose: read a single value file like memory.swap.current or              *
+ *          memory.usage_in_bytes                                             *
+ *                                                                            *
+ * Comment: "max" is reported as the v1 unlimited value, the largest page     *
+ *          counter in bytes                                                  *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_buf_value(zbx_lxd_reader_t *cache, size_t len, zbx_uint64_t *value)
+{
+        long    page_size;
+
+        while (0 < len && '\n' == cache->buf[len - 1])
+                len--;
+
+        if (3 == len && 0 == memcmp(cache->buf, "max", 3))
+        {
+                if (0 >= (page_size = sysconf(_SC_PAGESIZE)))
+                        page_size = 4096;
+
+                *value = (ZBX_MAX_UINT64 >> 1) / page_size * page_size;
+                return SUCCEED;
+        }
+
+        return zbx_lxd_uint64(cache->buf, cache->buf + len, value);
+}
+
+static int      zbx_lxd_file_value(zbx_lxd_reader_t *cache, const char *cgroup, const char *name,
+                const char *stat_file, zbx_uint64_t *value)
+{
+        size_t  len;
+
+        if (SUCCEED != zbx_lxd_file_read(cache, cgroup, name, stat_file, &len))
+                return FAIL;
+
+        return zbx_lxd_buf_value(cache, len, value);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_unified_limit                                            *
+ *                                                                            *
+ * Purpose: get the memory limit of a container on cgroup2, the smallest      *
+ *          memory.max of its cgroup and of the ancestors up to the           *
+ *          hierarchy root, as v1 reports in hierarchical_memory_limit        *
+ *                                                                            *
+ * Comment: ancestors are e.g. the lxc.payload/ directory or, with the agent  *
+ *          in a container, the root of its cgroup namespace. The root cgroup *
+ *          of the host has no memory.max.                                    *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_unified_limit(zbx_lxd_reader_t *cache, const char *name, zbx_uint64_t *limit)
+{
+        zbx_lxd_dirfd_t *dirfd, *root;
+        zbx_uint64_t    value;
+        struct stat     st, root_st;
+        size_t          len;
+        int             dir, parent, fd;
+
+        if (SUCCEED != zbx_lxd_file_value(cache, "", name, "memory.max", limit))
+                return FAIL;
+
+        if (NULL == (root = zbx_lxd_dirfd_get(cache, "", "")) || 0 != fstat(root->fd, &root_st) ||
+                        NULL == (dirfd = zbx_lxd_dirfd_get(cache, "", name)))
+        {
+                return SUCCEED;
+        }
+
+        for (dir = dirfd->fd;; dir = parent)
+        {
+                parent = openat(dir, "..", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+                if (dir != dirfd->fd)
+                        close(dir);
+
+                if (-1 == parent || -1 == (fd = openat(parent, "memory.max", O_RDONLY | O_CLOEXEC)))
+                        break;
+
+                if (SUCCEED == zbx_lxd_fd_read(cache, fd, &len) && SUCCEED == zbx_lxd_buf_value(cache, len, &value) &&
+                                value < *limit)
+                {
+                        *limit = value;
+                }
+
+                if (0 != fstat(parent, &st) || (st.st_dev == root_st.st_dev && st.st_ino == root_st.st_ino))
+                        break;
+        }
+
+        if (-1 != parent)
+                close(parent);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_unified_alias                                            *
+ *                                                                            *
+ * Purpose: add the value of a cgroup2 key found in the translated file under *
+ *          a v1 key                                                          *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_unified_alias(zbx_lxd_snapshot_t *snapshot, const zbx_lxd_snapshot_t *unified,
+                const char *key, const char *unified_key)
+{
+        zbx_uint64_t    value;
+
+        if (SUCCEED == zbx_lxd_snapshot_value(unified, unified_key, &value))
+                zbx_lxd_snapshot_add(snapshot, key, strlen(key), value);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_unified_memory                                           *
+ *                                                                            *
+ * Purpose: build v1 memory.stat from cgroup2 memory.stat, memory.swap.current *
+ *          and memory.max of the container and its ancestors                 *
+ *                                                                            *
+ * Comment: cgroup2 memory.stat is hierarchical already, so every v1 key also *
+ *          gets its total_ variant with the same value. cgroup2 keys are     *
+ *          kept as they are.                                                 *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_unified_memory(zbx_lxd_snapshot_t *snapshot, zbx_lxd_reader_t *cache, const char *name)
+{
+        /* v1 key, cgroup2 key it is taken from */
+        static const char       *aliases[][2] =
+        {
+                {"cache", "file"}, {"rss", "anon"}, {"rss_huge", "anon_thp"}, {"shmem", "shmem"},
+                {"mapped_file", "file_mapped"}, {"dirty", "file_dirty"}, {"writeback", "file_writeback"},
+                {"swapcached", "swapcached"}, {"pgfault", "pgfault"}, {"pgmajfault", "pgmajfault"},
+                {"inactive_anon", "inactive_anon"}, {"active_anon", "active_anon"},
+                {"inactive_file", "inactive_file"}, {"active_file", "active_file"},
+                {"unevictable", "unevictable"}, {"workingset_refault", "workingset_refault"},
+                {"workingset_refault_anon", "workingset_refault_anon"},
+                {"workingset_refault_file", "workingset_refault_file"},
+                {"workingset_activate", "workingset_activate"},
+                {"workingset_activate_anon", "workingset_activate_anon"},
+                {"workingset_activate_file", "workingset_activate_file"},
+                {"workingset_restore", "workingset_restore"},
+                {"workingset_restore_anon", "workingset_restore_anon"},
+                {"workingset_restore_file", "workingset_restore_file"},
+                {"workingset_nodereclaim", "workingset_nodereclaim"}
+        };
+        zbx_lxd_snapshot_t      *unified = &cache->unified;
+        zbx_uint64_t            value;
+        char                    key[ZBX_LXD_KEY_LEN];
+        int                     i;
+
+        if (SUCCEED != zbx_lxd_snapshot_read(unified, cache, "", name, "memory.stat"))
+                return FAIL;
+
+        snapshot->nstats = 0;
+
+        for (i = 0; i < (int)(sizeof(aliases) / sizeof(*aliases)); i++)
+        {
+                if (0 != strcmp(aliases[i][0], aliases[i][1]))
+                        zbx_lxd_unified_alias(snapshot, unified, aliases[i][0], aliases[i][1]);
+
+                zbx_snprintf(key, sizeof(key), "total_%s", aliases[i][0]);
+                zbx_lxd_unified_alias(snapshot, unified, key, aliases[i][1]);
+        }
+
+        // swap is not accounted for the root cgroup and without swap controller
+        if (SUCCEED == zbx_lxd_file_value(cache, "", name, "memory.swap.current", &value))
+        {
+                zbx_lxd_snapshot_add(snapshot, "swap", 4, value);
+                zbx_lxd_snapshot_add(snapshot, "total_swap", 10, value);
+        }
+
+        if (SUCCEED == zbx_lxd_unified_limit(cache, name, &value))
+                zbx_lxd_snapshot_add(snapshot, "hierarchical_memory_limit", 25, value);
+
+        if (SUCCEED == zbx_lxd_file_value(cache, "", name, "memory.current", &value))
+                zbx_lxd_snapshot_add(snapshot, "usage", 5, value);
+
+        for (i = 0; i < unified->nstats; i++)
+        {
+                zbx_lxd_snapshot_add(snapshot, unified->stats[i].key, strlen(unified->stats[i].key),
+                                unified->stats[i].value);
+        }
+
+        zbx_lxd_snapshot_index(snapshot);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_unified_cpu                                              *
+ *                                                                            *
+ * Purpose: build v1 cpuacct.stat or cpu.stat from cgroup2 cpu.stat           *
+ *                                                                            *
+ * Comment: cpuacct.stat user and system are in USER_HZ ticks, cgroup2 has    *
+ *          microseconds. v1 cpu.stat throttled and burst time are in         *
+ *          nanoseconds. cgroup2 keys are kept in cpu.stat.                   *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_unified_cpu(zbx_lxd_snapshot_t *snapshot, zbx_lxd_reader_t *cache, const char *name,
+                int cpuacct)
+{
+        zbx_lxd_snapshot_t      *unified = &cache->unified;
+        zbx_uint64_t            value;
+        long                    hz;
+        int                     i;
+
+        if (SUCCEED != zbx_lxd_snapshot_read(unified, cache, "", name, "cpu.stat"))
+                return FAIL;
+
+        snapshot->nstats = 0;
+
+        if (0 != cpuacct)
+        {
+                if (0 >= (hz = sysconf(_SC_CLK_TCK)))
+                        hz = 100;
+
+                if (SUCCEED == zbx_lxd_snapshot_value(unified, "user_usec", &value))
+                        zbx_lxd_snapshot_add(snapshot, "user", 4, value / (1000000 / hz));
+
+                if (SUCCEED == zbx_lxd_snapshot_value(unified, "system_usec", &value))
+                        zbx_lxd_snapshot_add(snapshot, "system", 6, value / (1000000 / hz));
+        }
+        else
+        {
+                if (SUCCEED == zbx_lxd_snapshot_value(unified, "throttled_usec", &value))
+                        zbx_lxd_snapshot_add(snapshot, "throttled_time", 14, value * 1000);
+
+                if (SUCCEED == zbx_lxd_snapshot_value(unified, "burst_usec", &value))
+                        zbx_lxd_snapshot_add(snapshot, "burst_time", 10, value * 1000);
+
+                for (i = 0; i < unified->nstats; i++)
+                {
+                        zbx_lxd_snapshot_add(snapshot, unified->stats[i].key, strlen(unified->stats[i].key),
+                                        unified->stats[i].value);
+                }
+        }
+
+        zbx_lxd_snapshot_index(snapshot);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_unified_io                                               *
+ *                                                                            *
+ * Purpose: build v1 blkio.throttle.io_service_bytes or io_serviced from      *
+ *          cgroup2 io.stat                                                   *
+ *                                                                            *
+ * Parameters: snapshot - [OUT] the snapshot                                  *
+ *             cache    - [IN/OUT] the reader                                 *
+ *             name     - [IN] container name                                 *
+ *             keys     - [IN] io.stat read, write and discard keys, e.g.     *
+ *                             "rbytes", "wbytes", "dbytes"                   *
+ *                                                                            *
+ * Comment: io.stat has "8:0 rbytes=1 wbytes=2 rios=3 ..." lines, they become *
+ *          "8:0 Read", "8:0 Write", "8:0 Discard" and "8:0 Total" and the     *
+ *          last "Total" line sums all devices like in v1                     *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_unified_io(zbx_lxd_snapshot_t *snapshot, zbx_lxd_reader_t *cache, const char *name,
+                const char * const *keys)
+{
+        static const char       *ops[] = {"Read", "Write", "Discard"};
+        const char              *p, *end, *eol, *dev, *dev_end, *token, *token_end, *eq;
+        zbx_uint64_t            value, dev_total, total = 0;
+        char                    key[ZBX_LXD_KEY_LEN];
+        size_t                  len;
+        int                     i;
+
+        if (SUCCEED != zbx_lxd_file_read(cache, "", name, "io.stat", &len))
+                return FAIL;
+
+        snapshot->nstats = 0;
+
+        for (p = cache->buf, end = cache->buf + len; p < end; p = eol + 1)
+        {
+                if (NULL == (eol = memchr(p, '\n', end - p)))
+                        eol = end;
+
+                if (NULL == (dev_end = memchr(p, ' ', eol - p)) || ZBX_LXD_KEY_LEN - 10 < dev_end - p)
+                        continue;
+
+                for (dev = p, dev_total = 0, token = dev_end + 1; token < eol; token = token_end + 1)
+                {
+                        if (NULL == (token_end = memchr(token, ' ', eol - token)))
+                                token_end = eol;
+
+                        if (NULL == (eq = memchr(token, '=', token_end - token)) ||
+                                        SUCCEED != zbx_lxd_uint64(eq + 1, token_end, &value))
+                        {
+                                continue;
+                        }
+
+                        for (i = 0; i < 3; i++)
+                        {
+                                if (strlen(keys[i]) != (size_t)(eq - token) || 0 != memcmp(keys[i], token, eq - token))
+                                        continue;
+
+                                len = zbx_snprintf(key, sizeof(key), "%.*s %s", (int)(dev_end - dev), dev, ops[i]);
+                                zbx_lxd_snapshot_add(snapshot, key, len, value);
+                                dev_total += value;
+                        }
+                }
+
+                len = zbx_snprintf(key, sizeof(key), "%.*s Total", (int)(dev_end - dev), dev);
+                zbx_lxd_snapshot_add(snapshot, key, len, dev_total);
+                total += dev_total;
+        }
+
+        zbx_lxd_snapshot_add(snapshot, "Total", 5, total);
+        zbx_lxd_snapshot_index(snapshot);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_cpu_quota                                                *
+ *                                                                            *
+ * Purpose: add the CFS quota and period as quota_us and period_us to a       *
+ *          cpu.stat snapshot, and on v1 the cpuacct.usage as usage_usec      *
+ *                                                                            *
+ * Comment: there is no quota_us without a quota, -1 on v1 and "max" on       *
+ *          cgroup2                                                           *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_cpu_quota(zbx_lxd_snapshot_t *snapshot, zbx_lxd_reader_t *cache, const char *cgroup,
+                const char *name)
+{
+        zbx_uint64_t    value;
+        const char      *p, *end;
+        size_t          len;
+
+        if (2 == layout->version)
+        {
+                // "<quota> <period>" or "max <period>"
+                if (SUCCEED == zbx_lxd_file_read(cache, "", name, "cpu.max", &len) &&
+                                NULL != (p = memchr(cache->buf, ' ', len)))
+                {
+                        for (end = cache->buf + len; end > p && '\n' == end[-1]; end--)
+                                ;
+
+                        if (SUCCEED == zbx_lxd_uint64(cache->buf, p, &value))
+                                zbx_lxd_snapshot_add(snapshot, "quota_us", 8, value);
+
+                        if (SUCCEED == zbx_lxd_uint64(p + 1, end, &value))
+                                zbx_lxd_snapshot_add(snapshot, "period_us", 9, value);
+                }
+        }
+        else
+        {
+                if (SUCCEED == zbx_lxd_file_value(cache, cgroup, name, "cpu.cfs_quota_us", &value))
+                        zbx_lxd_snapshot_add(snapshot, "quota_us", 8, value);
+
+                if (SUCCEED == zbx_lxd_file_value(cache, cgroup, name, "cpu.cfs_period_us", &value))
+                        zbx_lxd_snapshot_add(snapshot, "period_us", 9, value);
+
+                if (SUCCEED == zbx_lxd_file_value(cache, layout->cpuacct, name, "cpuacct.usage", &value))
+                        zbx_lxd_snapshot_add(snapshot, "usage_usec", 10, value / 1000);
+        }
+
+        zbx_lxd_snapshot_index(snapshot);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_legacy_events                                            *
+ *                                                                            *
+ * Purpose: assemble cgroup2 memory.events counters from v1 files             *
+ *                                                                            *
+ * Comment: oom and oom_kill are both the oom_kill count of                   *
+ *          memory.oom_control, max is memory.failcnt. v1 has no high         *
+ *          threshold.                                                        *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_legacy_events(zbx_lxd_snapshot_t *snapshot, zbx_lxd_reader_t *cache, const char *cgroup,
+                const char *name)
+{
+        zbx_lxd_snapshot_t      *oom_control = &cache->unified;
+        zbx_uint64_t            value;
+        int                     i;
+
+        if (SUCCEED != zbx_lxd_snapshot_read(oom_control, cache, cgroup, name, "memory.oom_control"))
+                return FAIL;
+
+        snapshot->nstats = 0;
+        zbx_lxd_unified_alias(snapshot, oom_control, "oom", "oom_kill");
+
+        for (i = 0; i < oom_control->nstats; i++)
+        {
+                zbx_lxd_snapshot_add(snapshot, oom_control->stats[i].key, strlen(oom_control->stats[i].key),
+                                oom_control->stats[i].value);
+        }
+
+        if (SUCCEED == zbx_lxd_file_value(cache, cgroup, name, "memory.failcnt", &value))
+                zbx_lxd_snapshot_add(snapshot, "max", 3, value);
+
+        zbx_lxd_snapshot_index(snapshot);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_load                                            *
+ *                                                                            *
+ * Purpose: read a v1 stat file of a container into the snapshot              *
+ *                                                                            *
+ * Return value: SUCCEED - the file was read                                  *
+ *               FAIL - the file cannot be opened                             *
+ *                                                                            *
+ * Comment: on the unified hierarchy the v1 files are assembled from their    *
+ *          cgroup2 counterparts in the single container directory, other     *
+ *          files are read from there as they are                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_snapshot_load(zbx_lxd_snapshot_t *snapshot, zbx_lxd_reader_t *cache, const char *cgroup,
+                const char *name, const char *stat_file)
+{
+        static const char       *io_bytes[] = {"rbytes", "wbytes", "dbytes"}, *io_ops[] = {"rios", "wios", "dios"};
+        size_t                  len = strlen(stat_file);
+        zbx_uint64_t            value;
+
+        // PSI files are found on the unified hierarchy only, in their own format
+        if (9 <= len && 0 == strcmp(stat_file + len - 9, ".pressure"))
+        {
+                if (SUCCEED != zbx_lxd_file_read(cache, cgroup, name, stat_file, &len))
+                        return FAIL;
+
+                zbx_lxd_pressure_parse(snapshot, cache->buf, len);
+
+                return SUCCEED;
+        }
+
+        if (2 != layout->version)
+        {
+                if (0 == strcmp(stat_file, "memory.events"))
+                        return zbx_lxd_legacy_events(snapshot, cache, cgroup, name);
+
+                if (SUCCEED != zbx_lxd_snapshot_read(snapshot, cache, cgroup, name, stat_file))
+                        return FAIL;
+
+                if (0 == strcmp(stat_file, "cpu.stat"))
+                        zbx_lxd_cpu_quota(snapshot, cache, cgroup, name);
+
+                // usage is not part of v1 memory.stat, derived lxd.mem metrics need it
+                if (0 == strcmp(stat_file, "memory.stat") &&
+                                SUCCEED == zbx_lxd_file_value(cache, cgroup, name, "memory.usage_in_bytes", &value))
+                {
+                        zbx_lxd_snapshot_add(snapshot, "usage", 5, value);
+                        zbx_lxd_snapshot_index(snapshot);
+                }
+
+                return SUCCEED;
+        }
+
+        if (0 == strcmp(stat_file, "memory.stat"))
+                return zbx_lxd_unified_memory(snapshot, cache, name);
+
+        if (0 == strcmp(stat_file, "cpuacct.stat"))
+                return zbx_lxd_unified_cpu(snapshot, cache, name, 1);
+
+        if (0 == strcmp(stat_file, "cpu.stat"))
+        {
+                if (SUCCEED != zbx_lxd_unified_cpu(snapshot, cache, name, 0))
+                        return FAIL;
+
+                zbx_lxd_cpu_quota(snapshot, cache, cgroup, name);
+                return SUCCEED;
+        }
+
+        if (0 == strcmp(stat_file, "blkio.throttle.io_service_bytes"))
+                return zbx_lxd_unified_io(snapshot, cache, name, io_bytes);
+
+        if (0 == strcmp(stat_file, "blkio.throttle.io_serviced"))
+                return zbx_lxd_unified_io(snapshot, cache, name, io_ops);
+
+        return zbx_lxd_snapshot_read(snapshot, cache, "", name, stat_file);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_file_cgroup                                              *
+ *                                                                            *
+ * Purpose: cgroup directory of a collected stat file                         *
+ *                                                                            *
+ ******************************************************************************/
+static const char       *zbx_lxd_file_cgroup(int file)
+{
+        switch (file)
+        {
+                case ZBX_LXD_FILE_MEMORY:
+                        return layout->memory;
+                case ZBX_LXD_FILE_CPUACCT:
+                        return layout->cpuacct;
+                case ZBX_LXD_FILE_CPU:
+                        return layout->cpu;
+                default:
+                        return layout->blkio;
+        }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_file_index                                               *
+ *                                                                            *
+ * Return value: index of a stat file sampled by the collector, -1 if the     *
+ *               file is not collected                                        *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_file_index(const char *stat_file)
+{
+        int     i;
+
+        for (i = 0; i < ZBX_LXD_FILE_COUNT; i++)
+        {
+                if (0 == strcmp(collect_files[i], stat_file))
+                        return i;
+        }
+
+        return -1;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_seq_begin                                                *
+ *                                                                            *
+ * Purpose: wait until no writer is rewriting a shared slot                   *
+ *                                                                            *
+ * Parameters: seq   - [IN] sequence counter of the slot                      *
+ *             value - [OUT] the even counter the read started at             *
+ *             spins - [IN/OUT] reads of the counter so far, shared by the    *
+ *                     retries of one slot read                               *
+ *                                                                            *
+ * Return value: SUCCEED - the slot can be read                               *
+ *               FAIL - the slot stayed odd for ZBX_LXD_SEQ_SPINS reads, e.g. *
+ *                      the writer was preempted in the middle of the update  *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_seq_begin(const zbx_uint32_t *seq, zbx_uint32_t *value, int *spins)
+{
+        while (0 != ((*value = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1))
+        {
+                if (ZBX_LXD_SEQ_SPINS < ++*spins)
+                        return FAIL;
+        }
+
+        return (ZBX_LXD_SEQ_SPINS < ++*spins ? FAIL : SUCCEED);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_slot_read                                                *
+ *                                                                            *
+ * Purpose: copy a stat file sampled by the collector into the snapshot       *
+ *                                                                            *
+ * Return value: SUCCEED - the snapshot holds the collected copy              *
+ *               FAIL - the container or the file is not collected, or the    *
+ *                      copy is too old, the file must be read directly       *
+ *                                                                            *
+ * Comment: lock-free, the read is retried while the collector rewrites slot, *
+ *          a slot still being rewritten after ZBX_LXD_SEQ_SPINS reads is     *
+ *          left to the direct read. With StaleTTL a copy is served up to     *
+ *          StaleTTL seconds old instead of reading the file while the        *
+ *          collector catches up                                              *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_slot_read(const char *name, int file, zbx_lxd_snapshot_t *snapshot, double now)
+{
+        zbx_lxd_slot_t          *slot;
+        zbx_lxd_slot_file_t     *slot_file;
+        zbx_uint32_t            seq;
+        double                  sampled = 0;
+        int                     i, index, state, found = 0, truncated = 0, nstats = 0, spins;
+
+        if (snapshot->stats_alloc < ZBX_LXD_SLOT_STATS)
+        {
+                snapshot->stats_alloc = ZBX_LXD_SLOT_STATS;
+                snapshot->stats = zbx_realloc(snapshot->stats, snapshot->stats_alloc * sizeof(zbx_lxd_stat_t));
+        }
+
+        index = zbx_lxd_hash(name) % collector_slots;
+
+        for (i = 0; i < collector_slots && 0 == found; i++, index = (index + 1) % collector_slots)
+        {
+                slot = &slots[index];
+                slot_file = &slot->files[file];
+                spins = 0;
+
+                do
+                {
+                        if (SUCCEED != zbx_lxd_seq_begin(&slot->seq, &seq, &spins))
+                        {
+                                zabbix_log(LOG_LEVEL_DEBUG, "Collector slot of container %s is busy", name);
+                                return FAIL;
+                        }
+
+                        state = slot->state;
+                        if (ZBX_LXD_SLOT_USED == state && 0 == strcmp(slot->name, name))
+                        {
+                                found = 1;
+                                sampled = slot_file->sampled;
+                                truncated = slot_file->truncated;
+                                if (ZBX_LXD_SLOT_STATS < (nstats = slot_file->nstats))
+                                        nstats = ZBX_LXD_SLOT_STATS;
+                                memcpy(snapshot->stats, slot_file->stats, nstats * sizeof(zbx_lxd_stat_t));
+                        }
+                        else
+                                found = 0;
+
+                        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                }
+                while (seq != __atomic_load_n(&slot->seq, __ATOMIC_RELAXED));
+
+                if (ZBX_LXD_SLOT_EMPTY == state)
+                        break;
+        }
+
+        // fall back to direct read if the collector is behind or the file did not fit into the slot
+        if (0 == found || 0 != truncated || sampled + MAX(3 * collector_interval, stale_ttl) < now)
+                return FAIL;
+
+        snapshot->nstats = nstats;
+        snapshot->sampled = sampled;
+        zbx_lxd_snapshot_index(snapshot);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_get                                             *
+ *                                                                            *
+ * Purpose: return parsed content of a container cgroup stat file, the file   *
+ *          is read again only when the cached copy is older than             *
+ *          SnapshotTTL seconds                                               *
+ *                                                                            *
+ * Return value: the snapshot or NULL if the stat file cannot be read         *
+ *                                                                            *
+ * Comment: the snapshot is owned by the cache, it is valid until the next    *
+ *          call                                                              *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_snapshot_t       *zbx_lxd_snapshot_get(const char *name, const char *cgroup, const char *stat_file)
+{
+        zbx_lxd_container_t     *container;
+        zbx_lxd_snapshot_t      *snapshot, **prev;
+        double                  now;
+        int                     file;
+
+        // the template passes container names as "/{#HCONTAINERID}"
+        while ('/' == *name)
+                name++;
+
+        // the hierarchy is not mounted
+        if (NULL == cgroup)
+                return NULL;
+
+        now = zbx_time();
+        container = zbx_lxd_container_get(name, now);
+
+        for (prev = &container->snapshots; NULL != (snapshot = *prev); prev = &snapshot->next)
+        {
+                if (0 == strcmp(snapshot->stat_file, stat_file) && 0 == strcmp(snapshot->cgroup, cgroup))
+                        break;
+        }
+
+        if (NULL != snapshot && snapshot->sampled + snapshot_ttl > now)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Using cached %s%s of container %s", cgroup, stat_file, name);
+                return snapshot;
+        }
+
+        if (NULL == snapshot)
+        {
+                snapshot = zbx_malloc(NULL, sizeof(zbx_lxd_snapshot_t));
+                snapshot->cgroup = zbx_strdup(NULL, cgroup);
+                snapshot->stat_file = zbx_strdup(NULL, stat_file);
+                snapshot->nstats = 0;
+                snapshot->stats_alloc = 0;
+                snapshot->stats = NULL;
+                snapshot->next = NULL;
+                *prev = snapshot;
+        }
+
+        if (NULL != slots && 0 <= (file = zbx_lxd_file_index(stat_file)) &&
+                        SUCCEED == zbx_lxd_slot_read(name, file, snapshot, now))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Using collected %s%s of container %s", cgroup, stat_file, name);
+                return snapshot;
+        }
+
+        zabbix_log(LOG_LEVEL_DEBUG, "Reading %s%s of container %s", cgroup, stat_file, name);
+
+        if (SUCCEED != zbx_lxd_snapshot_load(snapshot, &reader, cgroup, name, stat_file))
+        {
+                *prev = snapshot->next;
+                zbx_lxd_snapshot_free(snapshot);
+                snapshot = NULL;
+        }
+        else
+                snapshot->sampled = now;
+
+        return snapshot;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_slot_claim                                               *
+ *                                                                            *
+ * Purpose: find the collector slot of a container, take a free one for a     *
+ *          new container                                                     *
+ *                                                                            *
+ * Return value: the slot or NULL if the table is full                        *
+ *                                                                            *
+ * Comment: called from the collector thread only, it is the single writer    *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_slot_t   *zbx_lxd_slot_claim(const char *name)
+{
+        zbx_lxd_slot_t  *slot, *free_slot = NULL;
+        int             i, index, file;
+
+        index = zbx_lxd_hash(name) % collector_slots;
+
+        for (i = 0; i < collector_slots; i++, index = (index + 1) % collector_slots)
+        {
+                slot = &slots[index];
+
+                if (ZBX_LXD_SLOT_USED == slot->state)
+                {
+                        if (0 == strcmp(slot->name, name))
+                                return slot;
+                        continue;
+                }
+
+                if (NULL == free_slot)
+                        free_slot = slot;
+
+                if (ZBX_LXD_SLOT_EMPTY == slot->state)
+                        break;
+        }
+
+        if (NULL == (slot = free_slot))
+                return NULL;
+
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        slot->state = ZBX_LXD_SLOT_USED;
+        zbx_strlcpy(slot->name, name, sizeof(slot->name));
+        for (file = 0; file < ZBX_LXD_FILE_COUNT; file++)
+        {
+                slot->files[file].sampled = 0;
+                slot->files[file].nstats = 0;
+        }
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+
+        return slot;
+}
+
+/* private state of a background thread reading containers, the collector or the push thread */
+typedef struct
+{
+        zbx_uint64_t            tick;
+        double                  now;
+        int                     full;
+        zbx_lxd_reader_t        reader;
+        zbx_lxd_snapshot_t      files[ZBX_LXD_FILE_COUNT];
+}
+zbx_lxd_collect_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_collect_container                                        *
+ *                                                                            *
+ * Purpose: read collected stat files of a container and publish them in the  *
+ *          shared table                                                      *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_collect_container(const char *name, const char *driver, void *arg)
+{
+        zbx_lxd_collect_t       *collect = (zbx_lxd_collect_t *)arg;
+        zbx_lxd_slot_t          *slot;
+        zbx_lxd_slot_file_t     *slot_file;
+        int                     file, ok[ZBX_LXD_FILE_COUNT];
+
+        if (ZBX_LXD_NAME_LEN <= strlen(name))
+                return;
+
+        if (NULL == (slot = zbx_lxd_slot_claim(name)))
+        {
+                if (0 == collect->full)
+                        zabbix_log(LOG_LEVEL_WARNING, "LXD collector table is full, increase CollectorSlots");
+                collect->full = 1;
+                return;
+        }
+
+        // read files before taking the slot, so readers never wait for cgroupfs
+        for (file = 0; file < ZBX_LXD_FILE_COUNT; file++)
+        {
+                ok[file] = zbx_lxd_snapshot_load(&collect->files[file], &collect->reader, zbx_lxd_file_cgroup(file),
+                                name, collect_files[file]);
+        }
+
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        slot->tick = collect->tick;
+        for (file = 0; file < ZBX_LXD_FILE_COUNT; file++)
+        {
+                slot_file = &slot->files[file];
+
+                if (SUCCEED != ok[file])
+                {
+                        slot_file->sampled = 0;
+                        slot_file->nstats = 0;
+                        continue;
+                }
+
+                slot_file->sampled = collect->now;
+                slot_file->truncated = (ZBX_LXD_SLOT_STATS < collect->files[file].nstats);
+                slot_file->nstats = (0 == slot_file->truncated ? collect->files[file].nstats : ZBX_LXD_SLOT_STATS);
+                memcpy(slot_file->stats, collect->files[file].stats, slot_file->nstats * sizeof(zbx_lxd_stat_t));
+        }
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_collector_thread                                         *
+ *                                                                            *
+ * Purpose: sample stat files of all containers every CollectorInterval       *
+ *          seconds into the shared table                                     *
+ *                                                                            *
+ ******************************************************************************/
+static void     *zbx_lxd_collector_thread(void *arg)
+{
+        zbx_lxd_collect_t       collect;
+        zbx_lxd_slot_t          *slot;
+        struct timespec         deadline;
+        int                     i;
+
+        memset(&collect, 0, sizeof(collect));
+        collect.reader.generation = layout->generation;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        pthread_mutex_lock(&collector_lock);
+        while (0 == collector_stop)
+        {
+                pthread_mutex_unlock(&collector_lock);
+                pthread_mutex_lock(&walk_lock);
+
+                if (SYSINFO_RET_OK == zbx_lxd_layout_check())
+                {
+                        collect.tick++;
+                        collect.now = zbx_time();
+                        collect.full = 0;
+
+                        if (SUCCEED == zbx_lxd_containers_walk(zbx_lxd_collect_container, &collect, 0))
+                        {
+                                // containers that were not seen in this walk are gone
+                                for (i = 0; i < collector_slots; i++)
+                                {
+                                        slot = &slots[i];
+                                        if (ZBX_LXD_SLOT_USED != slot->state || collect.tick == slot->tick)
+                                                continue;
+
+                                        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+                                        __atomic_thread_fence(__ATOMIC_RELEASE);
+                                        slot->state = ZBX_LXD_SLOT_REMOVED;
+                                        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+                                }
+                        }
+                }
+
+                pthread_mutex_unlock(&walk_lock);
+                deadline.tv_sec += collector_interval;
+
+                pthread_mutex_lock(&collector_lock);
+                while (0 == collector_stop &&
+                                ETIMEDOUT != pthread_cond_timedwait(&collector_cond, &collector_lock, &deadline))
+                        ;
+        }
+        pthread_mutex_unlock(&collector_lock);
+
+        for (i = 0; i < ZBX_LXD_FILE_COUNT; i++)
+                free(collect.files[i].stats);
+        zbx_lxd_reader_flush(&collect.reader);
+
+        return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_thread_start                                             *
+ *                                                                            *
+ * Purpose: start a background thread of the main agent process              *
+ *                                                                            *
+ * Parameters: thread  - [OUT] the thread                                     *
+ *             routine - [IN] thread function                                 *
+ *             what    - [IN] thread name for the log, e.g. "collector"       *
+ *                                                                            *
+ * Return value: SUCCEED - the thread is running                              *
+ *               FAIL - the thread could not be created                       *
+ *                                                                            *
+ * Comment: the thread blocks all signals, agent signals must be handled by   *
+ *          the main thread                                                   *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_thread_start(pthread_t *thread, void *(*routine)(void *), const char *what)
+{
+        sigset_t        mask, orig_mask;
+        int             err;
+
+        sigfillset(&mask);
+        pthread_sigmask(SIG_SETMASK, &mask, &orig_mask);
+        err = pthread_create(thread, NULL, routine, NULL);
+        pthread_sigmask(SIG_SETMASK, &orig_mask, NULL);
+
+        if (0 != err)
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "Cannot start LXD %s thread: %s", what, zbx_strerror(err));
+                return FAIL;
+        }
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_collector_start                                          *
+ *                                                                            *
+ * Purpose: map the shared table and start the collector thread               *
+ *                                                                            *
+ * Comment: called from zbx_module_init(), before the agent forks its         *
+ *          processes, so all of them see the same table while the thread     *
+ *          keeps running in the main agent process                           *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_collector_start()
+{
+        size_t  size = collector_slots * sizeof(zbx_lxd_slot_t);
+
+        if (MAP_FAILED == (slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)))
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "Cannot map LXD collector table: %s", zbx_strerror(errno));
+                slots = NULL;
+                return FAIL;
+        }
+
+        if (SUCCEED != zbx_lxd_thread_start(&collector, zbx_lxd_collector_thread, "collector"))
+        {
+                munmap(slots, size);
+                slots = NULL;
+                return FAIL;
+        }
+
+        collector_pid = getpid();
+        zabbix_log(LOG_LEVEL_DEBUG, "LXD collector started, interval: %d, slots: %d", collector_interval,
+                        collector_slots);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_collector_stop                                           *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_collector_stop()
+{
+        if (NULL == slots || getpid() != collector_pid)
+                return;
+
+        pthread_mutex_lock(&collector_lock);
+        collector_stop = 1;
+        pthread_cond_signal(&collector_cond);
+        pthread_mutex_unlock(&collector_lock);
+
+        pthread_join(collector, NULL);
+
+        munmap(slots, collector_slots * sizeof(zbx_lxd_slot_t));
+        slots = NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_sampler_claim                                            *
+ *                                                                            *
+ * Purpose: find the sampler slot of a container, take a free one for a new   *
+ *          container                                                         *
+ *                                                                            *
+ * Return value: the slot or NULL if the table is full                        *
+ *                                                                            *
+ * Comment: called from the sampler thread only, it is the single writer      *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_sampler_slot_t   *zbx_lxd_sampler_claim(const char *name)
+{
+        zbx_lxd_sampler_slot_t  *slot, *free_slot = NULL;
+        int                     i, index;
+
+        index = zbx_lxd_hash(name) % collector_slots;
+
+        for (i = 0; i < collector_slots; i++, index = (index + 1) % collector_slots)
+        {
+                slot = &sampler_slots[index];
+
+                if (ZBX_LXD_SLOT_USED == slot->state)
+                {
+                        if (0 == strcmp(slot->name, name))
+                                return slot;
+                        continue;
+                }
+
+                if (NULL == free_slot)
+                        free_slot = slot;
+
+                if (ZBX_LXD_SLOT_EMPTY == slot->state)
+                        break;
+        }
+
+        if (NULL == (slot = free_slot))
+                return NULL;
+
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        slot->state = ZBX_LXD_SLOT_USED;
+        zbx_strlcpy(slot->name, name, sizeof(slot->name));
+        slot->count = 0;
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+
+        return slot;
+}
+
+typedef struct
+{
+        zbx_uint64_t            tick;
+        int                     full;
+        zbx_lxd_reader_t        reader;
+        zbx_lxd_snapshot_t      snapshot;
+}
+zbx_lxd_sampler_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_sample_container                                         *
+ *                                                                            *
+ * Purpose: append the current CPU and memory usage of a container to its     *
+ *          sample ring                                                       *
+ *                                                                            *
+ * Comment: runs every SamplerInterval seconds for every container, the files *
+ *          are opened relative to the cached cgroup directories and parsed   *
+ *          into buffers kept by the sampler                                  *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_sample_container(const char *name, const char *driver, void *arg)
+{
+        zbx_lxd_sampler_t       *state = (zbx_lxd_sampler_t *)arg;
+        zbx_lxd_sampler_slot_t  *slot;
+        zbx_lxd_sample_t        *sample;
+        zbx_uint64_t            cpu = 0, memory = 0;
+        int                     ok;
+
+        if (ZBX_LXD_NAME_LEN <= strlen(name))
+                return;
+
+        if (NULL == (slot = zbx_lxd_sampler_claim(name)))
+        {
+                if (0 == state->full)
+                        zabbix_log(LOG_LEVEL_WARNING, "LXD sampler table is full, increase CollectorSlots");
+                state->full = 1;
+                return;
+        }
+
+        if (2 == layout->version)
+        {
+                ok = (SUCCEED == zbx_lxd_snapshot_read(&state->snapshot, &state->reader, "", name, "cpu.stat") &&
+                                SUCCEED == zbx_lxd_snapshot_value(&state->snapshot, "usage_usec", &cpu) &&
+                                SUCCEED == zbx_lxd_file_value(&state->reader, "", name, "memory.current", &memory));
+        }
+        else
+        {
+                ok = (SUCCEED == zbx_lxd_file_value(&state->reader, layout->cpuacct, name, "cpuacct.usage", &cpu) &&
+                                SUCCEED == zbx_lxd_file_value(&state->reader, layout->memory, name,
+                                "memory.usage_in_bytes", &memory));
+                cpu /= 1000;
+        }
+
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        slot->tick = state->tick;
+        sample = &slot->samples[slot->count % ZBX_LXD_SAMPLES];
+        sample->sampled = (0 != ok ? zbx_time() : 0);
+        sample->cpu = cpu;
+        sample->memory = memory;
+        slot->count++;
+        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_sampler_thread                                           *
+ *                                                                            *
+ * Purpose: sample CPU and memory usage of all containers every               *
+ *          SamplerInterval seconds into the shared table                     *
+ *                                                                            *
+ ******************************************************************************/
+static void     *zbx_lxd_sampler_thread(void *arg)
+{
+        zbx_lxd_sampler_t       state;
+        zbx_lxd_sampler_slot_t  *slot;
+        struct timespec         deadline;
+        int                     i;
+
+        memset(&state, 0, sizeof(state));
+        state.reader.generation = layout->generation;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        pthread_mutex_lock(&sampler_lock);
+        while (0 == sampler_stop)
+        {
+                pthread_mutex_unlock(&sampler_lock);
+                pthread_mutex_lock(&walk_lock);
+
+                if (SYSINFO_RET_OK == zbx_lxd_layout_check() && NULL != layout->cpuacct)
+                {
+                        state.tick++;
+                        state.full = 0;
+
+                        if (SUCCEED == zbx_lxd_containers_walk(zbx_lxd_sample_container, &state, 0))
+                        {
+                                // containers that were not seen in this walk are gone
+                                for (i = 0; i < collector_slots; i++)
+                                {
+                                        slot = &sampler_slots[i];
+                                        if (ZBX_LXD_SLOT_USED != slot->state || state.tick == slot->tick)
+                                                continue;
+
+                                        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+                                        __atomic_thread_fence(__ATOMIC_RELEASE);
+                                        slot->state = ZBX_LXD_SLOT_REMOVED;
+                                        __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+                                }
+                        }
+                }
+
+                pthread_mutex_unlock(&walk_lock);
+                deadline.tv_sec += sampler_interval;
+
+                pthread_mutex_lock(&sampler_lock);
+                while (0 == sampler_stop &&
+                                ETIMEDOUT != pthread_cond_timedwait(&sampler_cond, &sampler_lock, &deadline))
+                        ;
+        }
+        pthread_mutex_unlock(&sampler_lock);
+
+        free(state.snapshot.stats);
+        zbx_lxd_reader_flush(&state.reader);
+
+        return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_sampler_start                                            *
+ *                                                                            *
+ * Purpose: map the shared sample table and start the sampler thread          *
+ *                                                                            *
+ * Comment: called from zbx_module_init(), before the agent forks             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_sampler_start()
+{
+        size_t  size = collector_slots * sizeof(zbx_lxd_sampler_slot_t);
+
+        if (MAP_FAILED == (sampler_slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0)))
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "Cannot map LXD sampler table: %s", zbx_strerror(errno));
+                sampler_slots = NULL;
+                return FAIL;
+        }
+
+        if (SUCCEED != zbx_lxd_thread_start(&sampler, zbx_lxd_sampler_thread, "sampler"))
+        {
+                munmap(sampler_slots, size);
+                sampler_slots = NULL;
+                return FAIL;
+        }
+
+        sampler_pid = getpid();
+        zabbix_log(LOG_LEVEL_DEBUG, "LXD sampler started, interval: %d", sampler_interval);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_sampler_stop                                             *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_sampler_stop()
+{
+        if (NULL == sampler_slots || getpid() != sampler_pid)
+                return;
+
+        pthread_mutex_lock(&sampler_lock);
+        sampler_stop = 1;
+        pthread_cond_signal(&sampler_cond);
+        pthread_mutex_unlock(&sampler_lock);
+
+        pthread_join(sampler, NULL);
+
+        munmap(sampler_slots, collector_slots * sizeof(zbx_lxd_sampler_slot_t));
+        sampler_slots = NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_deadline                                                 *
+ *                                                                            *
+ * Purpose: time by which a handler should stop collecting and answer with    *
+ *          what it has                                                       *
+ *                                                                            *
+ * Comment: a fifth of the agent Timeout is left to format and send the value *
+ *                                                                            *
+ ******************************************************************************/
+static double   zbx_lxd_deadline(double started)
+{
+        return started + (0 < item_timeout ? item_timeout : 1) * 0.8;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_reset                                                *
+ *                                                                            *
+ * Purpose: close the LXD API connection and drop the cached response         *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_api_reset()
+{
+        if (-1 != socket_api)
+        {
+                close(socket_api);
+                socket_api = -1;
+        }
+
+        zbx_free(api.containers);
+        api.ncontainers = 0;
+        api.fetched = 0;
+        api.requested = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_connect                                              *
+ *                                                                            *
+ * Purpose: connect to the LXD unix socket, ApiSocket or the snap and the     *
+ *          deb package locations                                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_api_connect()
+{
+        const char              *paths[] = {
+            "/var/snap/lxd/common/lxd/unix.socket",   // snap
+            "/var/lib/lxd/unix.socket",               // deb
+            NULL
+        }, *configured[] = {api_socket, NULL}, **path;
+        struct sockaddr_un      addr;
+        struct timeval          tv;
+        int                     fd;
+
+        for (path = (NULL != api_socket ? configured : paths); NULL != *path; path++)
+        {
+                if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)))
+                        break;
+
+                memset(&addr, 0, sizeof(addr));
+                addr.sun_family = AF_UNIX;
+                zbx_strlcpy(addr.sun_path, *path, sizeof(addr.sun_path));
+
+                if (0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+                {
+                        tv.tv_sec = (0 < item_timeout ? item_timeout : 1);
+                        tv.tv_usec = 0;
+                        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+                        zabbix_log(LOG_LEVEL_DEBUG, "Connected to LXD API at %s", *path);
+                        socket_api = fd;
+                        return SUCCEED;
+                }
+
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot connect to LXD API at %s: %s", *path, zbx_strerror(errno));
+                close(fd);
+        }
+
+        return FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_fill                                                 *
+ *                                                                            *
+ * Purpose: receive until the response buffer holds at least need bytes      *
+ *                                                                            *
+ * Parameters: len  - [IN/OUT] bytes in the buffer                            *
+ *             need - [IN] bytes wanted, 0 reads until the server closes the  *
+ *                         connection                                         *
+ *                                                                            *
+ * Comment: the buffer is kept terminated for header parsing, nothing is      *
+ *          received past api.deadline                                        *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_api_fill(size_t *len, size_t need)
+{
+        struct pollfd   pfd;
+        ssize_t         n;
+        int             timeout;
+
+        while (0 == need || *len < need)
+        {
+                if (*len + 1 >= api.buf_alloc)
+                {
+                        if (ZBX_LXD_API_MAX <= api.buf_alloc)
+                        {
+                                zabbix_log(LOG_LEVEL_WARNING, "LXD API response is larger than %d bytes",
+                                                ZBX_LXD_API_MAX);
+                                return FAIL;
+                        }
+
+                        api.buf_alloc = (0 == api.buf_alloc ? (size_t)buffer_size * 64 : api.buf_alloc * 2);
+                        api.buf = zbx_realloc(api.buf, api.buf_alloc);
+                }
+
+                pfd.fd = socket_api;
+                pfd.events = POLLIN;
+
+                if (0 >= (timeout = (int)((api.deadline - zbx_time()) * 1000)) || 0 >= poll(&pfd, 1, timeout))
+                {
+                        zabbix_log(LOG_LEVEL_DEBUG, "LXD API response was not received in time");
+                        api.buf[*len] = '\0';
+                        errno = ETIMEDOUT;
+                        ZBX_LXD_STATS_ADD(deadlines, 1);
+                        return FAIL;
+                }
+
+                if (0 >= (n = recv(socket_api, api.buf + *len, api.buf_alloc - *len - 1, 0)))
+                {
+                        api.buf[*len] = '\0';
+                        return (0 == n && 0 == need ? SUCCEED : FAIL);
+                }
+
+                *len += n;
+                api.buf[*len] = '\0';
+        }
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_response                                             *
+ *                                                                            *
+ * Purpose: read an HTTP response from the LXD API connection                 *
+ *                                                                            *
+ * Parameters: body_len - [OUT] length of the body, it is decoded to the      *
+ *                              start of api.buf and terminated               *
+ *                                                                            *
+ * Return value: SUCCEED - 200 response was read                              *
+ *               FAIL - otherwise, the connection must be closed              *
+ *                                                                            *
+ * Comment: supports Content-Length, chunked and close-delimited bodies       *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_api_response(size_t *body_len)
+{
+        const char      *header, *eol, *value;
+        char            *end;
+        size_t          len = 0, pos, out, chunk, content_length = 0;
+        int             status = 0, chunked = 0, close_after = 0, has_length = 0;
+
+        if (NULL != api.buf)
+                *api.buf = '\0';
+
+        while (NULL == api.buf || NULL == strstr(api.buf, "\r\n\r\n"))
+        {
+                if (SUCCEED != zbx_lxd_api_fill(&len, len + 1))
+                        return FAIL;
+        }
+
+        if (1 != sscanf(api.buf, "HTTP/1.%*d %d", &status))
+                return FAIL;
+
+        pos = strstr(api.buf, "\r\n\r\n") + 4 - api.buf;
+
+        for (header = strstr(api.buf, "\r\n") + 2; header < api.buf + pos - 2; header = eol + 2)
+        {
+                eol = strstr(header, "\r\n");
+
+                if (NULL == (value = memchr(header, ':', eol - header)))
+                        continue;
+
+                for (value++; ' ' == *value; value++)
+                        ;
+
+                if (0 == strncasecmp(header, "Content-Length:", 15))
+                {
+                        content_length = strtoul(value, NULL, 10);
+                        has_length = 1;
+                }
+                else if (0 == strncasecmp(header, "Transfer-Encoding:", 18) && 0 == strncasecmp(value, "chunked", 7))
+                        chunked = 1;
+                else if (0 == strncasecmp(header, "Connection:", 11) && 0 == strncasecmp(value, "close", 5))
+                        close_after = 1;
+        }
+
+        if (0 != chunked)
+        {
+                // decode chunks in place, the decoded body never overtakes the chunk being read
+                for (out = 0;; pos += chunk + 2)
+                {
+                        while (NULL == memchr(api.buf + pos, '\n', len - pos))
+                        {
+                                if (SUCCEED != zbx_lxd_api_fill(&len, len + 1))
+                                        return FAIL;
+                        }
+
+                        chunk = strtoul(api.buf + pos, &end, 16);
+                        if (end == api.buf + pos || ZBX_LXD_API_MAX < chunk)
+                                return FAIL;
+
+                        pos = (char *)memchr(api.buf + pos, '\n', len - pos) + 1 - api.buf;
+
+                        if (0 == chunk)
+                                break;
+
+                        if (SUCCEED != zbx_lxd_api_fill(&len, pos + chunk + 2))
+                                return FAIL;
+
+                        memmove(api.buf + out, api.buf + pos, chunk);
+                        out += chunk;
+                }
+
+                // no trailers are sent by LXD, only the final CRLF
+                if (SUCCEED != zbx_lxd_api_fill(&len, pos + 2))
+                        return FAIL;
+
+                *body_len = out;
+        }
+        else if (0 != has_length)
+        {
+                if (SUCCEED != zbx_lxd_api_fill(&len, pos + content_length))
+                        return FAIL;
+
+                memmove(api.buf, api.buf + pos, content_length);
+                *body_len = content_length;
+        }
+        else
+        {
+                if (SUCCEED != zbx_lxd_api_fill(&len, 0))
+                        return FAIL;
+
+                memmove(api.buf, api.buf + pos, len - pos);
+                *body_len = len - pos;
+                close_after = 1;
+        }
+
+        api.buf[*body_len] = '\0';
+
+        if (0 != close_after)
+        {
+                close(socket_api);
+                socket_api = -1;
+        }
+
+        if (200 != status)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "LXD API returned HTTP status %d", status);
+                return FAIL;
+        }
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_send                                                 *
+ *                                                                            *
+ * Purpose: send a GET request of an LXD API path, connecting when there is   *
+ *          no connection to reuse                                            *
+ *                                                                            *
+ * Parameters: path   - [IN] the API path                                     *
+ *             reused - [OUT] 1 if a kept-alive connection was used           *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_api_send(const char *path, int *reused)
+{
+        char    request[256];
+        size_t  len, sent;
+        ssize_t n;
+
+        len = zbx_snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: lxd\r\n"
+                        "User-Agent: zabbix_module_lxd\r\nAccept: application/json\r\n\r\n", path);
+
+        if (0 != (*reused = (-1 != socket_api)))
+                zabbix_log(LOG_LEVEL_DEBUG, "Reusing LXD API connection");
+        else if (SUCCEED != zbx_lxd_api_connect())
+                return FAIL;
+
+        for (sent = 0; sent < len; sent += n)
+        {
+                if (0 >= (n = send(socket_api, request + sent, len - sent, MSG_NOSIGNAL)))
+                        return FAIL;
+        }
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_close                                                *
+ *                                                                            *
+ * Purpose: close the LXD API connection after a failed request               *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_api_close(const char *path)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "LXD API request %s failed: %s", path, zbx_strerror(errno));
+
+        if (-1 != socket_api)
+        {
+                close(socket_api);
+                socket_api = -1;
+        }
+
+        api.requested = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_get                                                  *
+ *                                                                            *
+ * Purpose: GET an LXD API path over the persistent connection                *
+ *                                                                            *
+ * Return value: SUCCEED - the body is in api.buf                             *
+ *               FAIL - otherwise                                             *
+ *                                                                            *
+ * Comment: a kept-alive connection closed by LXD is reopened once, the       *
+ *          response must arrive before the item deadline                     *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_api_get(const char *path, size_t *body_len)
+{
+        int     attempt, reused;
+
+        api.deadline = zbx_lxd_deadline(zbx_time());
+
+        for (attempt = 0; attempt < 2; attempt++)
+        {
+                if (SUCCEED == zbx_lxd_api_send(path, &reused) && SUCCEED == zbx_lxd_api_response(body_len))
+                        return SUCCEED;
+
+                zbx_lxd_api_close(path);
+
+                if (0 == reused || zbx_time() >= api.deadline)
+                        break;
+        }
+
+        return FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_parse                                                *
+ *                                                                            *
+ * Purpose: replace the cached response with the one received into api.buf    *
+ *                                                                            *
+ * Return value: SUCCEED - the response was parsed into container objects     *
+ *               FAIL - otherwise, the cached response is kept                *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_api_parse(double fetched)
+{
+        struct zbx_json_parse   jp, jp_metadata, jp_container;
+        const char              *p = NULL;
+        char                    *buf;
+        size_t                  buf_alloc;
+        int                     alloc = 0;
+
+        if (SUCCEED != zbx_json_open(api.buf, &jp) ||
+                        SUCCEED != zbx_json_brackets_by_name(&jp, "metadata", &jp_metadata))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot parse LXD API response: %s", api.buf);
+                return FAIL;
+        }
+
+        // container objects point into the body, the previous body receives the next response
+        buf = api.body;
+        buf_alloc = api.body_alloc;
+        api.body = api.buf;
+        api.body_alloc = api.buf_alloc;
+        api.buf = buf;
+        api.buf_alloc = buf_alloc;
+
+        zbx_free(api.containers);
+        api.ncontainers = 0;
+
+        while (NULL != (p = zbx_json_next(&jp_metadata, p)))
+        {
+                if (SUCCEED != zbx_json_brackets_open(p, &jp_container))
+                        continue;
+
+                if (api.ncontainers == alloc)
+                {
+                        alloc += 16;
+                        api.containers = zbx_realloc(api.containers, alloc * sizeof(zbx_lxd_api_container_t));
+                }
+
+                if (SUCCEED != zbx_json_value_by_name(&jp_container, "name", api.containers[api.ncontainers].name,
+                                ZBX_LXD_NAME_LEN))
+                {
+                        continue;
+                }
+
+                // LXD without projects does not report them
+                if (SUCCEED != zbx_json_value_by_name(&jp_container, "project",
+                                api.containers[api.ncontainers].project, ZBX_LXD_NAME_LEN) ||
+                                '\0' == api.containers[api.ncontainers].project[0])
+                {
+                        zbx_strlcpy(api.containers[api.ncontainers].project, "default", ZBX_LXD_NAME_LEN);
+                }
+
+                api.containers[api.ncontainers++].jp = jp_container;
+        }
+
+        api.fetched = fetched;
+        zabbix_log(LOG_LEVEL_DEBUG, "Fetched %d containers from LXD API", api.ncontainers);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_revalidate                                           *
+ *                                                                            *
+ * Purpose: refresh the cached response without waiting for LXD               *
+ *                                                                            *
+ * Comment: the first call sends the request, later calls receive the         *
+ *          response once it is readable, meanwhile the cached response is    *
+ *          served. zbx_lxd_api_refresh() drops a request still unanswered    *
+ *          when the cached response gets older than StaleTTL.                *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_api_revalidate(double now)
+{
+        struct pollfd   pfd;
+        size_t          body_len;
+        int             reused;
+
+        if (0 == api.requested)
+        {
+                if (SUCCEED == zbx_lxd_api_send(ZBX_LXD_API_CONTAINERS, &reused))
+                        api.requested = now;
+                else
+                        zbx_lxd_api_close(ZBX_LXD_API_CONTAINERS);
+
+                return;
+        }
+
+        pfd.fd = socket_api;
+        pfd.events = POLLIN;
+
+        if (0 < poll(&pfd, 1, 0))
+        {
+                api.deadline = zbx_lxd_deadline(now);
+
+                if (SUCCEED != zbx_lxd_api_response(&body_len))
+                        zbx_lxd_api_close(ZBX_LXD_API_CONTAINERS);
+                else if (SUCCEED == zbx_lxd_api_parse(now))
+                        api.requested = 0;
+        }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_refresh                                              *
+ *                                                                            *
+ * Purpose: fetch state of all containers in one request when the cached     *
+ *          response is older than ApiTTL seconds                             *
+ *                                                                            *
+ * Comment: the response is parsed once into a list of container objects     *
+ *          shared by all lxd.api keys. With StaleTTL a response younger than *
+ *          StaleTTL seconds is served while it is refreshed in background.   *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_api_refresh()
+{
+        double  now = zbx_time();
+        size_t  body_len;
+
+        // connection and cache inherited over fork() belong to the parent
+        if (api.pid != getpid())
+        {
+                zbx_lxd_api_reset();
+                api.pid = getpid();
+        }
+
+        if (0 != api.fetched && api.fetched + api_ttl > now)
+                return SUCCEED;
+
+        if (0 != api.fetched && api.fetched + stale_ttl > now)
+        {
+                zbx_lxd_api_revalidate(now);
+                return SUCCEED;
+        }
+
+        // a response still awaited would be taken for the reply to the new request
+        if (0 != api.requested)
+        {
+                ZBX_LXD_STATS_ADD(deadlines, 1);
+                zbx_lxd_api_close(ZBX_LXD_API_CONTAINERS);
+        }
+
+        if (SUCCEED != zbx_lxd_api_get(ZBX_LXD_API_CONTAINERS, &body_len) || SUCCEED != zbx_lxd_api_parse(now))
+        {
+                // a stale response is served for StaleTTL seconds only
+                zbx_free(api.containers);
+                api.ncontainers = 0;
+                api.fetched = 0;
+
+                return FAIL;
+        }
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_container_project                                        *
+ *                                                                            *
+ * Purpose: split a container cgroup name into its LXD project and name       *
+ *                                                                            *
+ * Return value: the instance name within the project                         *
+ *                                                                            *
+ * Comment: LXD names the cgroup of an instance of a project other than the   *
+ *          default one <project>_<name>, instance names cannot contain '_'   *
+ *                                                                            *
+ ******************************************************************************/
+static const char       *zbx_lxd_container_project(const char *container, char *project, size_t size)
+{
+        const char      *p;
+
+        if (NULL == (p = strchr(container, '_')))
+        {
+                zbx_strlcpy(project, "default", size);
+                return container;
+        }
+
+        zbx_strlcpy(project, container, MIN(size, (size_t)(p - container + 1)));
+
+        return p + 1;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_api_find                                                 *
+ *                                                                            *
+ * Purpose: find a container in the cached LXD API response                   *
+ *                                                                            *
+ * Return value: the container object or NULL if LXD does not know it         *
+ *                                                                            *
+ ******************************************************************************/
+static const zbx_lxd_api_container_t    *zbx_lxd_api_find(const char *container)
+{
+        char            project[ZBX_LXD_NAME_LEN];
+        const char      *name;
+        int             i;
+
+        name = zbx_lxd_container_project(container, project, sizeof(project));
+
+        for (i = 0; i < api.ncontainers; i++)
+        {
+                if (0 == strcmp(api.containers[i].name, name) && 0 == strcmp(api.containers[i].project, project))
+                        return &api.containers[i];
+        }
+
+        return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_api                                               *
+ *                                                                            *
+ * Purpose: value of a container from the LXD API                             *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: path is a '/' separated list of object members and array indexes *
+ *          under the container object of /1.0/containers?recursion=2, e.g.   *
+ *          "state/network/eth0/counters/bytes_received". Objects and arrays  *
+ *          are returned as JSON, an empty path returns the whole container.  *
+ *                                                                            *
+ * Notes: https://github.com/lxc/lxd/blob/master/doc/rest-api.md              *
+ ******************************************************************************/
+int     zbx_module_lxd_api(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_api()");
+        char                    *container, *path, *component, *next, *value = NULL;
+        const char              *p = NULL;
+        const zbx_lxd_api_container_t   *object;
+        struct zbx_json_parse   jp;
+        zbx_uint64_t            ui64;
+        size_t                  value_alloc = 0;
+        int                     index, is_null;
+
+        if (1 > request->nparam || 2 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        path = get_rparam(request, 1);
+
+        if (SUCCEED != zbx_lxd_api_refresh())
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot get containers from LXD API"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        while ('/' == *container)
+                container++;
+
+        if (NULL == (object = zbx_lxd_api_find(container)))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Container %s is not known to LXD", container));
+                return SYSINFO_RET_FAIL;
+        }
+
+        jp = object->jp;
+        p = jp.start;
+        path = zbx_strdup(NULL, ZBX_NULL2STR(path));
+
+        for (component = path; '\0' != *component; component = next)
+        {
+                if (NULL != (next = strchr(component, '/')))
+                        *next++ = '\0';
+                else
+                        next = component + strlen(component);
+
+                if (SUCCEED != zbx_json_brackets_open(p, &jp))
+                        break;
+
+                if ('[' == *jp.start && SUCCEED == is_uint64(component, &ui64))
+                {
+                        for (index = 0, p = NULL; NULL != (p = zbx_json_next(&jp, p)) && index < (int)ui64; index++)
+                                ;
+                }
+                else
+                        p = zbx_json_pair_by_name(&jp, component);
+
+                if (NULL == p)
+                        break;
+        }
+
+        if ('\0' != *component || NULL == p)
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot find \"%s\" in LXD container %s",
+                                ZBX_NULL2STR(get_rparam(request, 1)), container));
+                zbx_free(path);
+                return SYSINFO_RET_FAIL;
+        }
+        zbx_free(path);
+
+        if ('{' == *p || '[' == *p)
+        {
+                zbx_json_brackets_open(p, &jp);
+                SET_TEXT_RESULT(result, zbx_dsprintf(NULL, "%.*s", (int)(jp.end - jp.start + 1), jp.start));
+                return SYSINFO_RET_OK;
+        }
+
+        if (NULL == zbx_json_decodevalue_dyn(p, &value, &value_alloc, &is_null))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot decode LXD API value"));
+                zbx_free(value);
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (0 != is_null)
+                *value = '\0';
+
+        if (SUCCEED == is_uint64(value, &ui64))
+        {
+                SET_UI64_RESULT(result, ui64);
+                zbx_free(value);
+        }
+        else
+                SET_STR_RESULT(result, value);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_up                                                *
+ *                                                                            *
+ * Purpose: check if container is running                                     *
+ *                                                                            *
+ * Return value: 1 - is running, 0 - is not running                           *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_up(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_up()");
+        char                    *container, *name;
+        zbx_lxd_member_t        *member;
+
+        if (1 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "up check is not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "up check is not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == layout->cpuacct)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "up check is not available at the moment - no cpuacct hierarchy");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "up check is not available at the moment - no cpuacct hierarchy"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+
+        // the container set kept by inotify answers without touching cgroupfs
+        if (SUCCEED == zbx_lxd_members_sync())
+        {
+                for (name = container; '/' == *name; name++)
+                        ;
+
+                member = zbx_lxd_member_get(name, 0);
+                SET_UI64_RESULT(result, (NULL != member && 0 == member->stopped ? 1 : 0));
+                return SYSINFO_RET_OK;
+        }
+
+        if (NULL == zbx_lxd_snapshot_get(container, layout->cpuacct, "cpuacct.stat"))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot read cpuacct.stat of '%s', container doesn't run", container);
+                SET_UI64_RESULT(result, 0);
+                return SYSINFO_RET_OK;
+        }
+        zabbix_log(LOG_LEVEL_DEBUG, "Can read cpuacct.stat of '%s', container is running", container);
+        SET_UI64_RESULT(result, 1);
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_lifecycle                                         *
+ *                                                                            *
+ * Purpose: start or stop time of a container                                 *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: unix timestamps, stop time is 0 while the container runs.         *
+ *          Stopped containers are known for ZBX_LXD_EXPIRE seconds.          *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_lifecycle(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_lifecycle()");
+        char                    *container, *mode;
+        zbx_lxd_member_t        *member;
+
+        if (1 > request->nparam || 2 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        mode = get_rparam(request, 1);
+
+        if (NULL != mode && '\0' != *mode && 0 != strcmp(mode, "started") && 0 != strcmp(mode, "stopped"))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid second parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SUCCEED != zbx_lxd_members_sync())
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Container lifecycle is not tracked, cannot watch the driver directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        while ('/' == *container)
+                container++;
+
+        if (NULL == (member = zbx_lxd_member_get(container, 0)))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Container %s is not known", container));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL != mode && 0 == strcmp(mode, "stopped"))
+                SET_UI64_RESULT(result, member->stopped);
+        else
+                SET_UI64_RESULT(result, member->started);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_events_reclaim                                           *
+ *                                                                            *
+ * Purpose: release an events table entry left claimed by a process that      *
+ *          died while filling it in                                          *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_events_reclaim(zbx_lxd_events_t *entry)
+{
+        zbx_uint32_t    state = ZBX_LXD_SLOT_CLAIMED;
+        pid_t           owner;
+
+        // the owner is not stored yet or is still running
+        if (0 == (owner = __atomic_load_n(&entry->owner, __ATOMIC_ACQUIRE)) || 0 == kill(owner, 0) ||
+                        ESRCH != errno)
+        {
+                return;
+        }
+
+        zabbix_log(LOG_LEVEL_WARNING, "Releasing LXD events entry claimed by terminated process %d", (int)owner);
+        __atomic_store_n(&entry->owner, 0, __ATOMIC_RELAXED);
+        __atomic_compare_exchange_n(&entry->state, &state, ZBX_LXD_SLOT_EMPTY, 0, __ATOMIC_RELEASE,
+                        __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_events_get                                               *
+ *                                                                            *
+ * Purpose: find or claim the entry of a container in the shared events table *
+ *                                                                            *
+ * Return value: the entry or NULL if the table is full                       *
+ *                                                                            *
+ * Comment: entries of containers whose cgroup is gone are released when the  *
+ *          table runs full, unless another process holds their rates lock.   *
+ *          An entry another process keeps claimed for ZBX_LXD_CLAIM_WAIT     *
+ *          yields is skipped, and released if that process has died.         *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_events_t *zbx_lxd_events_get(const char *name)
+{
+        zbx_lxd_events_t        *entry;
+        zbx_uint32_t            state;
+        pid_t                   owner;
+        int                     i, n, pass, wait;
+
+        if (NULL == events || ZBX_LXD_NAME_LEN <= strlen(name))
+                return NULL;
+
+        // look up, claim a free entry, release entries of removed containers and claim again
+        for (pass = 0; pass < 3; pass++)
+        {
+                for (i = zbx_lxd_hash(name) % collector_slots, n = 0; n < collector_slots;
+                                i = (i + 1) % collector_slots, n++)
+                {
+                        entry = &events[i];
+                        state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+
+                        if (0 != pass && ZBX_LXD_SLOT_EMPTY == state && 0 != __atomic_compare_exchange_n(
+                                        &entry->state, &state, ZBX_LXD_SLOT_CLAIMED, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_ACQUIRE))
+                        {
+                                __atomic_store_n(&entry->owner, getpid(), __ATOMIC_RELEASE);
+                                zbx_strlcpy(entry->name, name, sizeof(entry->name));
+                                memset(entry->last, 0, sizeof(entry->last));
+                                memset(&entry->rates, 0, sizeof(entry->rates));
+                                __atomic_store_n(&entry->lock, 0, __ATOMIC_RELAXED);
+                                __atomic_store_n(&entry->updated, 0, __ATOMIC_RELAXED);
+                                __atomic_store_n(&entry->owner, 0, __ATOMIC_RELAXED);
+                                __atomic_store_n(&entry->state, ZBX_LXD_SLOT_USED, __ATOMIC_RELEASE);
+                                return entry;
+                        }
+
+                        // another process is claiming it, do not wait for it forever
+                        for (wait = 0; ZBX_LXD_SLOT_CLAIMED == state; wait++)
+                        {
+                                if (ZBX_LXD_CLAIM_WAIT == wait)
+                                {
+                                        zbx_lxd_events_reclaim(entry);
+                                        break;
+                                }
+
+                                sched_yield();
+                                state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+                        }
+
+                        if (ZBX_LXD_SLOT_USED == state && 0 == strcmp(entry->name, name))
+                                return entry;
+                }
+
+                if (1 != pass)
+                        continue;
+
+                for (i = 0; i < collector_slots; i++)
+                {
+                        entry = &events[i];
+                        state = ZBX_LXD_SLOT_USED;
+                        owner = 0;
+
+                        if (ZBX_LXD_SLOT_USED != __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE))
+                                continue;
+
+                        if (SUCCEED == zbx_lxd_container_exists(entry->name))
+                                continue;
+
+                        // rates of the entry being updated by another process, it is released next time
+                        if (0 == __atomic_compare_exchange_n(&entry->lock, &owner, getpid(), 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+                        {
+                                continue;
+                        }
+
+                        // the lock is left taken on release, the next claim clears it
+                        if (0 == __atomic_compare_exchange_n(&entry->state, &state, ZBX_LXD_SLOT_EMPTY, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                        {
+                                __atomic_store_n(&entry->lock, 0, __ATOMIC_RELEASE);
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+static void     zbx_lxd_rates_release(zbx_lxd_events_t *shared)
+{
+        if (NULL != shared)
+                __atomic_store_n(&shared->lock, 0, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_rates_get                                                *
+ *                                                                            *
+ * Purpose: get the previous samples of the rate keys of a container, shared  *
+ *          by the agent processes, and lock them for an update               *
+ *                                                                            *
+ * Parameters: container - [IN] the container                                 *
+ *             shared    - [OUT] the locked shared entry, release it with     *
+ *                         zbx_lxd_rates_release()                            *
+ *                                                                            *
+ * Return value: the samples                                                  *
+ *                                                                            *
+ * Comment: whichever listener a poll lands on computes the rate since the    *
+ *          previous poll. When the events table has no room for the          *
+ *          container or another process holds the lock for                   *
+ *          ZBX_LXD_CLAIM_WAIT yields, the samples of this process are used.  *
+ *          A lock left by a terminated process is taken over.                *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_rates_t  *zbx_lxd_rates_get(zbx_lxd_container_t *container, zbx_lxd_events_t **shared)
+{
+        zbx_lxd_events_t        *entry;
+        pid_t                   owner = 0, pid = getpid();
+        int                     wait;
+
+        *shared = NULL;
+
+        if (NULL == (entry = zbx_lxd_events_get(container->name)))
+                return &container->rates;
+
+        for (wait = 0; 0 == __atomic_compare_exchange_n(&entry->lock, &owner, pid, 0, __ATOMIC_ACQUIRE,
+                        __ATOMIC_RELAXED); wait++, owner = 0)
+        {
+                if (ZBX_LXD_CLAIM_WAIT != wait)
+                {
+                        sched_yield();
+                        continue;
+                }
+
+                if (0 == kill(owner, 0) || ESRCH != errno || 0 == __atomic_compare_exchange_n(&entry->lock, &owner,
+                                pid, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                {
+                        return &container->rates;
+                }
+
+                zabbix_log(LOG_LEVEL_WARNING, "Taking over LXD rates of container %s locked by terminated"
+                                " process %d", container->name, (int)owner);
+                break;
+        }
+
+        // released and claimed for another container since it was looked up
+        if (ZBX_LXD_SLOT_USED != __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE) ||
+                        0 != strcmp(entry->name, container->name))
+        {
+                zbx_lxd_rates_release(entry);
+                return &container->rates;
+        }
+
+        *shared = entry;
+
+        return &entry->rates;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_events_store                                             *
+ *                                                                            *
+ * Purpose: publish the counters of a parsed memory.events                    *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_events_store(zbx_lxd_events_t *entry, const zbx_lxd_snapshot_t *snapshot, double now)
+{
+        zbx_uint64_t    value;
+        int             i;
+
+        for (i = 0; i < ZBX_LXD_EVENT_COUNT; i++)
+        {
+                if (SUCCEED == zbx_lxd_snapshot_value(snapshot, event_names[i], &value))
+                        __atomic_store_n(&entry->current[i], value, __ATOMIC_RELAXED);
+        }
+
+        __atomic_store_n(&entry->updated, (int)now, __ATOMIC_RELEASE);
+}
+
+/* memory.events file watched by the events thread */
+typedef struct
+{
+        zbx_lxd_events_t        *entry;
+        int                     seen;
+}
+zbx_lxd_event_watch_t;
+
+typedef struct
+{
+        zbx_lxd_reader_t        reader;
+        zbx_lxd_snapshot_t      snapshot;
+        struct pollfd           *fds;
+        zbx_lxd_event_watch_t   *watches;
+        int                     count;
+        int                     alloc;
+        int                     tick;
+}
+zbx_lxd_event_watcher_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_events_read                                              *
+ *                                                                            *
+ * Purpose: read a watched memory.events again and publish it                 *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_events_read(zbx_lxd_event_watcher_t *watcher, int i)
+{
+        ssize_t n;
+        size_t  len = 0;
+
+        if (0 == watcher->reader.buf_alloc)
+        {
+                watcher->reader.buf_alloc = ZBX_KIBIBYTE;
+                watcher->reader.buf = zbx_malloc(NULL, watcher->reader.buf_alloc);
+        }
+
+        // kernfs files must be read from the start to be reported again
+        while (0 < (n = pread(watcher->fds[i].fd, watcher->reader.buf + len, watcher->reader.buf_alloc - len, len)))
+                len += n;
+
+        if (-1 == n)
+                return FAIL;
+
+        zbx_lxd_snapshot_parse(&watcher->snapshot, watcher->reader.buf, len);
+        zbx_lxd_events_store(watcher->watches[i].entry, &watcher->snapshot, zbx_time());
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_events_watch                                             *
+ *                                                                            *
+ * Purpose: open memory.events of a container not watched yet                 *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_events_watch(const char *name, const char *driver, void *arg)
+{
+        zbx_lxd_event_watcher_t *watcher = (zbx_lxd_event_watcher_t *)arg;
+        zbx_lxd_events_t        *entry;
+        zbx_lxd_dirfd_t         *dirfd;
+        int                     i, fd;
+
+        if (NULL == (entry = zbx_lxd_events_get(name)))
+                return;
+
+        for (i = 0; i < watcher->count; i++)
+        {
+                if (watcher->watches[i].entry == entry)
+                {
+                        // still watched, the counters stay current without a read
+                        watcher->watches[i].seen = watcher->tick;
+                        __atomic_store_n(&entry->updated, (int)time(NULL), __ATOMIC_RELEASE);
+                        return;
+                }
+        }
+
+        if (NULL == (dirfd = zbx_lxd_dirfd_get(&watcher->reader, "", name)) ||
+                        -1 == (fd = openat(dirfd->fd, "memory.events", O_RDONLY | O_CLOEXEC)))
+        {
+                return;
+        }
+
+        if (watcher->count == watcher->alloc)
+        {
+                watcher->alloc += 64;
+                watcher->fds = zbx_realloc(watcher->fds, watcher->alloc * sizeof(struct pollfd));
+                watcher->watches = zbx_realloc(watcher->watches, watcher->alloc * sizeof(zbx_lxd_event_watch_t));
+        }
+
+        watcher->fds[watcher->count].fd = fd;
+        watcher->fds[watcher->count].events = POLLPRI;
+        watcher->watches[watcher->count].entry = entry;
+        watcher->watches[watcher->count].seen = watcher->tick;
+
+        if (SUCCEED != zbx_lxd_events_read(watcher, watcher->count))
+        {
+                close(fd);
+                return;
+        }
+
+        watcher->count++;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_events_thread                                            *
+ *                                                                            *
+ * Purpose: keep memory.events counters of all containers current in the      *
+ *          shared table, reading a file only when the kernel reports a       *
+ *          change of it                                                      *
+ *                                                                            *
+ ******************************************************************************/
+static void     *zbx_lxd_events_thread(void *arg)
+{
+        zbx_lxd_event_watcher_t watcher;
+        double                  rescan = 0, now;
+        int                     i, n;
+
+        memset(&watcher, 0, sizeof(watcher));
+        watcher.reader.generation = layout->generation;
+
+        while (0 == __atomic_load_n(&events_stop, __ATOMIC_ACQUIRE))
+        {
+                if ((now = zbx_time()) >= rescan)
+                {
+                        watcher.tick++;
+
+                        pthread_mutex_lock(&walk_lock);
+                        if (SYSINFO_RET_OK == zbx_lxd_layout_check())
+                                zbx_lxd_containers_walk(zbx_lxd_events_watch, &watcher, 0);
+                        pthread_mutex_unlock(&walk_lock);
+
+                        // stopped containers
+                        for (i = 0; i < watcher.count; i++)
+                        {
+                                if (watcher.watches[i].seen == watcher.tick)
+                                        continue;
+
+                                close(watcher.fds[i].fd);
+                                watcher.count--;
+                                watcher.fds[i] = watcher.fds[watcher.count];
+                                watcher.watches[i--] = watcher.watches[watcher.count];
+                        }
+
+                        rescan = now + ZBX_LXD_EVENTS_RESCAN;
+                }
+
+                // a short timeout keeps zbx_lxd_events_stop() responsive
+                if (0 >= (n = poll(watcher.fds, watcher.count, 1000)))
+                        continue;
+
+                for (i = 0; i < watcher.count; i++)
+                {
+                        if (0 != (watcher.fds[i].revents & (POLLPRI | POLLERR)))
+                                zbx_lxd_events_read(&watcher, i);
+                }
+        }
+
+        for (i = 0; i < watcher.count; i++)
+                close(watcher.fds[i].fd);
+
+        zbx_free(watcher.fds);
+        zbx_free(watcher.watches);
+        zbx_free(watcher.snapshot.stats);
+        zbx_lxd_reader_flush(&watcher.reader);
+
+        return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_events_start                                             *
+ *                                                                            *
+ * Purpose: map the shared events table and start the watcher thread when    *
+ *          EventsWatch is enabled on a cgroup2 host                          *
+ *                                                                            *
+ * Comment: called from zbx_module_init(), before the agent forks             *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_events_start()
+{
+        size_t  size = collector_slots * sizeof(zbx_lxd_events_t);
+
+        if (MAP_FAILED == (events = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)))
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "Cannot map LXD events table: %s", zbx_strerror(errno));
+                events = NULL;
+                return;
+        }
+
+        if (0 == events_watch)
+                return;
+
+        // v1 memory.oom_control notifies through cgroup.event_control only
+        if (2 != layout->version)
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "EventsWatch needs a cgroup2 host, memory events are read on request");
+                return;
+        }
+
+        if (SUCCEED != zbx_lxd_thread_start(&events_watcher, zbx_lxd_events_thread, "events"))
+                return;
+
+        events_pid = getpid();
+        zabbix_log(LOG_LEVEL_DEBUG, "LXD events watcher started");
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_events_stop                                              *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_events_stop()
+{
+        if (0 != events_pid && getpid() == events_pid)
+        {
+                __atomic_store_n(&events_stop, 1, __ATOMIC_RELEASE);
+                pthread_join(events_watcher, NULL);
+                events_pid = 0;
+        }
+
+        if (NULL != events)
+        {
+                munmap(events, collector_slots * sizeof(zbx_lxd_events_t));
+                events = NULL;
+        }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_memory_derived                                           *
+ *                                                                            *
+ * Purpose: compute a lxd.mem metric that is not a memory.stat key           *
+ *                                                                            *
+ * Parameters: snapshot - [IN] memory.stat snapshot with usage                *
+ *             metric   - [IN] working_set, rss_swap, cache_ratio or          *
+ *                             usage_ratio                                    *
+ *             result   - [OUT] the value                                     *
+ *                                                                            *
+ * Return value: SUCCEED - the metric was computed                            *
+ *               FAIL - unknown metric or the values it needs are missing     *
+ *                                                                            *
+ * Comment: working set is usage without inactive page cache, the way         *
+ *          cAdvisor and kubelet count it; swap is 0 without swap accounting  *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_memory_derived(const zbx_lxd_snapshot_t *snapshot, const char *metric, AGENT_RESULT *result)
+{
+        zbx_uint64_t    usage, value, swap;
+
+        if (0 == strcmp(metric, "rss_swap"))
+        {
+                if (SUCCEED != zbx_lxd_snapshot_value(snapshot, "total_rss", &value))
+                        return FAIL;
+
+                if (SUCCEED != zbx_lxd_snapshot_value(snapshot, "total_swap", &swap))
+                        swap = 0;
+
+                SET_UI64_RESULT(result, value + swap);
+                return SUCCEED;
+        }
+
+        if (SUCCEED != zbx_lxd_snapshot_value(snapshot, "usage", &usage))
+                return FAIL;
+
+        if (0 == strcmp(metric, "working_set"))
+        {
+                if (SUCCEED != zbx_lxd_snapshot_value(snapshot, "total_inactive_file", &value))
+                        return FAIL;
+
+                SET_UI64_RESULT(result, (usage > value ? usage - value : 0));
+                return SUCCEED;
+        }
+
+        if (0 == strcmp(metric, "cache_ratio"))
+        {
+                if (SUCCEED != zbx_lxd_snapshot_value(snapshot, "total_cache", &value))
+                        return FAIL;
+
+                SET_DBL_RESULT(result, (0 != usage ? MIN((double)value / usage * 100, 100) : 0));
+                return SUCCEED;
+        }
+
+        if (0 == strcmp(metric, "usage_ratio"))
+        {
+                if (SUCCEED != zbx_lxd_snapshot_value(snapshot, "hierarchical_memory_limit", &value) || 0 == value)
+                        return FAIL;
+
+                SET_DBL_RESULT(result, (double)usage / value * 100);
+                return SUCCEED;
+        }
+
+        return FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_mem                                               *
+ *                                                                            *
+ * Purpose: container memory metrics                                          *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Notes: https://www.kernel.org/doc/Documentation/cgroup-v1/memory.txt       *
+ ******************************************************************************/
+int     zbx_module_lxd_mem(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_mem()");
+        char                    *container, *metric;
+        int                     ret = SYSINFO_RET_FAIL;
+        zbx_lxd_snapshot_t      *snapshot;
+        zbx_uint64_t            value;
+
+        if (2 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "mem metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "mem metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        metric = get_rparam(request, 1);
+        if (NULL == (snapshot = zbx_lxd_snapshot_get(container, layout->memory, "memory.stat")))
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Cannot read memory.stat of '%s'", container);
+                SET_MSG_RESULT(result, strdup("Cannot open memory.stat file"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        zabbix_log(LOG_LEVEL_DEBUG, "Looking metric %s in memory.stat file", metric);
+        if (SUCCEED == zbx_lxd_snapshot_value(snapshot, metric, &value))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Id: %s; metric: %s; value: " ZBX_FS_UI64, container, metric, value);
+                SET_UI64_RESULT(result, value);
+                ret = SYSINFO_RET_OK;
+        }
+        else if (SUCCEED == zbx_lxd_memory_derived(snapshot, metric, result))
+                ret = SYSINFO_RET_OK;
+
+        if (SYSINFO_RET_FAIL == ret)
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot find a line with requested metric in memory.stat file"));
+
+        return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_mem_events                                        *
+ *                                                                            *
+ * Purpose: container memory events, oom, oom_kill, high or max               *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: delta mode returns the increase since the previous delta request  *
+ *          of the container in any agent process, 0 on the first one. The    *
+ *          counters come from the events watcher when it runs, otherwise    *
+ *          memory.events is read.                                            *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_mem_events(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_mem_events()");
+        char                    *container, *event, *mode;
+        zbx_lxd_events_t        *entry;
+        zbx_lxd_snapshot_t      *snapshot;
+        zbx_uint64_t            value, last;
+        int                     ev, updated;
+
+        if (2 > request->nparam || 3 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "mem metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "mem metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        event = get_rparam(request, 1);
+        mode = get_rparam(request, 2);
+
+        for (ev = 0; ev < ZBX_LXD_EVENT_COUNT && 0 != strcmp(event, event_names[ev]); ev++)
+                ;
+
+        if (ZBX_LXD_EVENT_COUNT == ev)
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid second parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == mode || '\0' == *mode)
+                mode = "delta";
+
+        if (0 != strcmp(mode, "delta") && 0 != strcmp(mode, "total"))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid third parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        while ('/' == *container)
+                container++;
+
+        entry = zbx_lxd_events_get(container);
+
+        if (NULL != entry && 0 != (updated = __atomic_load_n(&entry->updated, __ATOMIC_ACQUIRE)) &&
+                        updated + ZBX_LXD_EVENTS_RESCAN * 3 > time(NULL))
+        {
+                value = __atomic_load_n(&entry->current[ev], __ATOMIC_RELAXED);
+        }
+        else if (NULL == (snapshot = zbx_lxd_snapshot_get(container, layout->memory, "memory.events")) ||
+                        SUCCEED != zbx_lxd_snapshot_value(snapshot, event, &value))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot read %s memory event of '%s'", event, container);
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot read %s memory event", event));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (0 == strcmp(mode, "total"))
+        {
+                SET_UI64_RESULT(result, value);
+                return SYSINFO_RET_OK;
+        }
+
+        if (NULL == entry)
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "LXD events table is full, increase CollectorSlots"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        // the exchange hands every increase to exactly one request across the agent processes
+        last = __atomic_exchange_n(&entry->last[ev], value + 1, __ATOMIC_ACQ_REL);
+
+        if (0 == last)
+                SET_UI64_RESULT(result, 0);
+        else if (value + 1 >= last)
+                SET_UI64_RESULT(result, value + 1 - last);
+        else
+                SET_UI64_RESULT(result, value);         // restarted container, counters were reset
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_cpu                                               *
+ *                                                                            *
+ * Purpose: container CPU metrics                                             *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Notes: https://www.kernel.org/doc/Documentation/cgroup-v1/cpuacct.txt      *
+ ******************************************************************************/
+int     zbx_module_lxd_cpu(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_cpu()");
+
+        char                    *container, *metric;
+        int                     ret = SYSINFO_RET_FAIL;
+        zbx_lxd_snapshot_t      *snapshot;
+        zbx_uint64_t            value;
+
+        if (2 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "cpu metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "cpu metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == layout->cpuacct)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "cpu check is not available at the moment - no cpuacct hierarchy");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "cpu check is not available at the moment - no cpuacct hierarchy"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        metric = get_rparam(request, 1);
+        const char      *cgroup = NULL, *stat_file = NULL;
+        if(strcmp(metric, "user") == 0 || strcmp(metric, "system") == 0) {
+            stat_file = "cpuacct.stat";
+            cgroup = layout->cpuacct;
+        } else {
+            stat_file = "cpu.stat";
+            cgroup = zbx_lxd_file_cgroup(ZBX_LXD_FILE_CPU);
+        }
+
+        zabbix_log(LOG_LEVEL_DEBUG, "cpuacct: %s, cgroup: %s, stat_file: %s, metric: %s, container: %s", layout->cpuacct, cgroup, stat_file, metric, container);
+        if (NULL == (snapshot = zbx_lxd_snapshot_get(container, cgroup, stat_file)))
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Cannot read %s of '%s'", stat_file, container);
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot open %s file", stat_file));
+                return SYSINFO_RET_FAIL;
+        }
+
+        zbx_uint64_t cpu_num;
+        zabbix_log(LOG_LEVEL_DEBUG, "Looking metric %s in %s file", metric, stat_file);
+        if (SUCCEED == zbx_lxd_snapshot_value(snapshot, metric, &value))
+        {
+                // normalize CPU usage by using number of online CPUs
+                if (1 < (cpu_num = sysconf(_SC_NPROCESSORS_ONLN)))
+                {
+                    value /= cpu_num;
+                }
+                zabbix_log(LOG_LEVEL_DEBUG, "Id: %s; metric: %s; value: " ZBX_FS_UI64, container, metric, value);
+                SET_UI64_RESULT(result, value);
+                ret = SYSINFO_RET_OK;
+        }
+
+        if (SYSINFO_RET_FAIL == ret)
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot find a line with requested metric in %s file", stat_file));
+
+        return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_cpus_parse                                               *
+ *                                                                            *
+ * Purpose: count CPUs in a cpuset list like "0-3,8,10-11"                    *
+ *                                                                            *
+ * Return value: number of CPUs, 0 if the list is empty or invalid           *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_cpus_parse(const char *p, const char *end)
+{
+        const char      *range, *dash;
+        zbx_uint64_t    first, last;
+        int             cpus = 0;
+
+        while (p < end && ('\n' == end[-1] || ' ' == end[-1]))
+                end--;
+
+        for (; p < end; p = range + 1)
+        {
+                if (NULL == (range = memchr(p, ',', end - p)))
+                        range = end;
+
+                if (NULL == (dash = memchr(p, '-', range - p)))
+                        dash = range;
+
+                if (SUCCEED != zbx_lxd_uint64(p, dash, &first))
+                        return 0;
+
+                if (dash == range)
+                        last = first;
+                else if (SUCCEED != zbx_lxd_uint64(dash + 1, range, &last) || last < first)
+                        return 0;
+
+                cpus += (int)(last - first + 1);
+        }
+
+        return cpus;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_container_cpus                                           *
+ *                                                                            *
+ * Purpose: number of CPUs the container may run on                           *
+ *                                                                            *
+ * Comment: read from the effective cpuset every ZBX_LXD_CPUS_TTL seconds,    *
+ *          effective cpus follow CPU hotplug and limits.cpu changes. Host    *
+ *          online CPUs are used when there is no cpuset.                      *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_container_cpus(zbx_lxd_container_t *container, double now)
+{
+        const char      *cgroup, *files[3];
+        size_t          len;
+        long            online;
+        int             i, cpus = 0;
+
+        if (0 != container->cpus && container->cpus_checked + ZBX_LXD_CPUS_TTL > now)
+                return container->cpus;
+
+        cgroup = layout->cpuset;
+
+        if (2 == layout->version)
+        {
+                files[0] = "cpuset.cpus.effective";
+                files[1] = NULL;
+        }
+        else
+        {
+                files[0] = "cpuset.effective_cpus";
+                files[1] = "cpuset.cpus";
+                files[2] = NULL;
+        }
+
+        for (i = 0; NULL != files[i] && 0 == cpus; i++)
+        {
+                if (SUCCEED == zbx_lxd_file_read(&reader, cgroup, container->name, files[i], &len))
+                        cpus = zbx_lxd_cpus_parse(reader.buf, reader.buf + len);
+        }
+
+        if (0 == cpus)
+                cpus = (0 < (online = sysconf(_SC_NPROCESSORS_ONLN)) ? online : 1);
+
+        if (container->cpus != cpus)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Container %s runs on %d CPUs", container->name, cpus);
+                container->cpus = cpus;
+        }
+        container->cpus_checked = now;
+
+        return cpus;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_cpu_util                                          *
+ *                                                                            *
+ * Purpose: container CPU utilisation in percent of its effective cpuset      *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: utilisation is computed between the two last cpuacct.stat samples *
+ *          taken at least a second apart by any agent process, see           *
+ *          zbx_lxd_rates_get(). The first request of a container fails as    *
+ *          there is no previous sample yet.                                  *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_cpu_util(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_cpu_util()");
+
+        char                    *container, *mode;
+        zbx_lxd_container_t     *entry;
+        zbx_lxd_snapshot_t      *snapshot;
+        zbx_lxd_rates_t         *rates;
+        zbx_lxd_events_t        *shared;
+        zbx_uint64_t            ticks[2];
+        double                  elapsed, capacity, value;
+        long                    hz;
+        int                     cpu_mode, cpus, i;
+
+        if (1 > request->nparam || 2 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check() || NULL == layout->cpuacct)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "cpu metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "cpu metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        mode = get_rparam(request, 1);
+
+        if (NULL == mode || '\0' == *mode || 0 == strcmp(mode, "total"))
+                cpu_mode = ZBX_LXD_CPU_TOTAL;
+        else if (0 == strcmp(mode, "user"))
+                cpu_mode = ZBX_LXD_CPU_USER;
+        else if (0 == strcmp(mode, "system"))
+                cpu_mode = ZBX_LXD_CPU_SYSTEM;
+        else
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid second parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == (snapshot = zbx_lxd_snapshot_get(container, layout->cpuacct, "cpuacct.stat")) ||
+                        SUCCEED != zbx_lxd_snapshot_value(snapshot, "user", &ticks[ZBX_LXD_CPU_USER]) ||
+                        SUCCEED != zbx_lxd_snapshot_value(snapshot, "system", &ticks[ZBX_LXD_CPU_SYSTEM]))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot read cpuacct.stat of '%s'", container);
+                SET_MSG_RESULT(result, strdup("Cannot open cpuacct.stat file"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        while ('/' == *container)
+                container++;
+
+        entry = zbx_lxd_container_get(container, zbx_time());
+        cpus = zbx_lxd_container_cpus(entry, snapshot->sampled);
+        rates = zbx_lxd_rates_get(entry, &shared);
+
+        // samples closer than a second apart keep the last result, tick deltas would be too coarse
+        if (snapshot->sampled >= rates->cpu_sampled + 1)
+        {
+                if (0 >= (hz = sysconf(_SC_CLK_TCK)))
+                        hz = 100;
+
+                elapsed = snapshot->sampled - rates->cpu_sampled;
+                capacity = elapsed * hz * cpus / 100;
+
+                for (i = 0; i < 2; i++)
+                {
+                        // the first sample has no rate, a restarted container with reset counters has 0
+                        if (0 == rates->cpu_sampled)
+                                rates->cpu_util[i] = -1;
+                        else if (ticks[i] < rates->cpu_ticks[i])
+                                rates->cpu_util[i] = 0;
+                        else
+                                rates->cpu_util[i] = MIN((ticks[i] - rates->cpu_ticks[i]) / capacity, 100);
+
+                        rates->cpu_ticks[i] = ticks[i];
+                }
+
+                rates->cpu_util[ZBX_LXD_CPU_TOTAL] = (0 == rates->cpu_sampled ? -1 :
+                                MIN(rates->cpu_util[ZBX_LXD_CPU_USER] + rates->cpu_util[ZBX_LXD_CPU_SYSTEM], 100));
+                rates->cpu_sampled = snapshot->sampled;
+        }
+
+        value = rates->cpu_util[cpu_mode];
+        zbx_lxd_rates_release(shared);
+
+        if (0 > value)
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Not enough data, the first sample was just taken"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        zabbix_log(LOG_LEVEL_DEBUG, "Id: %s; mode: %d; value: %.2f", container, cpu_mode, value);
+        SET_DBL_RESULT(result, value);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_cpu_throttling                                    *
+ *                                                                            *
+ * Purpose: container CFS throttling and quota saturation                     *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: throttled_ratio - percent of enforcement periods throttled,       *
+ *          throttled_time - seconds throttled per second,                    *
+ *          quota_util - CPU usage in percent of the quota,                   *
+ *          quota - the quota in CPUs.                                        *
+ *          Rates are computed between the two last cpu.stat samples taken at *
+ *          least a second apart by any agent process, see                    *
+ *          zbx_lxd_rates_get(). The first request of a container fails like  *
+ *          lxd.cpu.util as there is no previous sample yet.                  *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_cpu_throttling(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_cpu_throttling()");
+
+        static const char       *counters[ZBX_LXD_THR_COUNT] =
+                        {"nr_periods", "nr_throttled", "throttled_time", "usage_usec"};
+        char                    *container, *metric;
+        zbx_lxd_container_t     *entry;
+        zbx_lxd_snapshot_t      *snapshot;
+        zbx_lxd_rates_t         *rates;
+        zbx_lxd_events_t        *shared;
+        zbx_uint64_t            values[ZBX_LXD_THR_COUNT], quota, period;
+        double                  elapsed, value;
+        int                     i;
+
+        if (1 > request->nparam || 2 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check() || NULL == layout->cpuacct)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "cpu metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "cpu metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        metric = get_rparam(request, 1);
+
+        if (NULL == metric || '\0' == *metric)
+                metric = "throttled_ratio";
+
+        if (0 != strcmp(metric, "throttled_ratio") && 0 != strcmp(metric, "throttled_time") &&
+                        0 != strcmp(metric, "quota_util") && 0 != strcmp(metric, "quota"))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid second parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == (snapshot = zbx_lxd_snapshot_get(container, zbx_lxd_file_cgroup(ZBX_LXD_FILE_CPU), "cpu.stat")))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot read cpu.stat of '%s'", container);
+                SET_MSG_RESULT(result, strdup("Cannot open cpu.stat file"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if ((0 == strcmp(metric, "quota") || 0 == strcmp(metric, "quota_util")) &&
+                        (SUCCEED != zbx_lxd_snapshot_value(snapshot, "quota_us", &quota) ||
+                        SUCCEED != zbx_lxd_snapshot_value(snapshot, "period_us", &period) || 0 == period))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Container has no CPU quota"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (0 == strcmp(metric, "quota"))
+        {
+                SET_DBL_RESULT(result, (double)quota / period);
+                return SYSINFO_RET_OK;
+        }
+
+        for (i = 0; i < ZBX_LXD_THR_COUNT; i++)
+        {
+                if (SUCCEED != zbx_lxd_snapshot_value(snapshot, counters[i], &values[i]))
+                {
+                        SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot find %s in cpu.stat", counters[i]));
+                        return SYSINFO_RET_FAIL;
+                }
+        }
+
+        while ('/' == *container)
+                container++;
+
+        entry = zbx_lxd_container_get(container, zbx_time());
+        rates = zbx_lxd_rates_get(entry, &shared);
+
+        // samples closer than a second apart keep the last result
+        if (snapshot->sampled >= rates->thr_sampled + 1)
+        {
+                elapsed = snapshot->sampled - rates->thr_sampled;
+
+                // the first sample has no rate, a restarted container with reset counters has 0
+                if (0 == rates->thr_sampled)
+                {
+                        rates->thr_ratio = -1;
+                        rates->thr_time = 0;
+                        rates->thr_cores = 0;
+                }
+                else if (values[ZBX_LXD_THR_PERIODS] < rates->thr_counters[ZBX_LXD_THR_PERIODS] ||
+                                values[ZBX_LXD_THR_USAGE] < rates->thr_counters[ZBX_LXD_THR_USAGE])
+                {
+                        rates->thr_ratio = 0;
+                        rates->thr_time = 0;
+                        rates->thr_cores = 0;
+                }
+                else
+                {
+                        if (values[ZBX_LXD_THR_PERIODS] == rates->thr_counters[ZBX_LXD_THR_PERIODS])
+                                rates->thr_ratio = 0;
+                        else
+                        {
+                                rates->thr_ratio = (double)(values[ZBX_LXD_THR_THROTTLED] -
+                                                rates->thr_counters[ZBX_LXD_THR_THROTTLED]) * 100 /
+                                                (values[ZBX_LXD_THR_PERIODS] - rates->thr_counters[ZBX_LXD_THR_PERIODS]);
+                        }
+
+                        // throttled_time is in nanoseconds
+                        rates->thr_time = (double)(values[ZBX_LXD_THR_TIME] - rates->thr_counters[ZBX_LXD_THR_TIME]) /
+                                        1000000000 / elapsed;
+                        rates->thr_cores = (double)(values[ZBX_LXD_THR_USAGE] - rates->thr_counters[ZBX_LXD_THR_USAGE]) /
+                                        1000000 / elapsed;
+                }
+
+                memcpy(rates->thr_counters, values, sizeof(values));
+                rates->thr_sampled = snapshot->sampled;
+        }
+
+        if (0 > rates->thr_ratio)
+                value = -1;
+        else if (0 == strcmp(metric, "throttled_ratio"))
+                value = rates->thr_ratio;
+        else if (0 == strcmp(metric, "throttled_time"))
+                value = rates->thr_time;
+        else
+                value = rates->thr_cores * period / quota * 100;
+
+        zbx_lxd_rates_release(shared);
+
+        if (0 > value)
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Not enough data, the first sample was just taken"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        SET_DBL_RESULT(result, value);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_sampler_copy                                             *
+ *                                                                            *
+ * Purpose: copy the sample ring of a container, oldest sample first          *
+ *                                                                            *
+ * Return value: number of samples copied, -1 if the container is not sampled *
+ *               or -2 if the slot was still being written after              *
+ *               ZBX_LXD_SEQ_SPINS reads                                      *
+ *                                                                            *
+ * Comment: lock-free, the copy is retried while the sampler writes the slot  *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_sampler_copy(const char *name, zbx_lxd_sample_t *samples)
+{
+        zbx_lxd_sampler_slot_t  *slot;
+        zbx_uint32_t            seq;
+        zbx_uint64_t            count = 0, first;
+        int                     i, index, state, found = 0, n = -1, spins;
+
+        index = zbx_lxd_hash(name) % collector_slots;
+
+        for (i = 0; i < collector_slots && 0 == found; i++, index = (index + 1) % collector_slots)
+        {
+                slot = &sampler_slots[index];
+                spins = 0;
+
+                do
+                {
+                        if (SUCCEED != zbx_lxd_seq_begin(&slot->seq, &seq, &spins))
+                                return -2;
+
+                        state = slot->state;
+                        if (ZBX_LXD_SLOT_USED == state && 0 == strcmp(slot->name, name))
+                        {
+                                found = 1;
+                                count = slot->count;
+                                first = (ZBX_LXD_SAMPLES < count ? count - ZBX_LXD_SAMPLES : 0);
+
+                                for (n = 0; first + n < count; n++)
+                                        samples[n] = slot->samples[(first + n) % ZBX_LXD_SAMPLES];
+                        }
+                        else
+                                found = 0;
+
+                        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                }
+                while (seq != __atomic_load_n(&slot->seq, __ATOMIC_RELAXED));
+
+                if (ZBX_LXD_SLOT_EMPTY == state)
+                        break;
+        }
+
+        return (0 != found ? n : -1);
+}
+
+static int      zbx_lxd_double_compare(const void *d1, const void *d2)
+{
+        double  v1 = *(const double *)d1, v2 = *(const double *)d2;
+
+        return (v1 < v2 ? -1 : (v1 > v2 ? 1 : 0));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_sampled                                                  *
+ *                                                                            *
+ * Purpose: max, p95 or mean of the samples of a container over a window      *
+ *                                                                            *
+ * Parameters: request - [IN] container, statistic and window in seconds      *
+ *             result  - [OUT] the value                                      *
+ *             cpu     - [IN] 1 - CPU utilisation between samples, 0 - memory *
+ *                            usage                                           *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_sampled(AGENT_REQUEST *request, AGENT_RESULT *result, int cpu)
+{
+        zbx_lxd_sample_t        samples[ZBX_LXD_SAMPLES];
+        double                  values[ZBX_LXD_SAMPLES], now, since, value, capacity = 1, sum = 0;
+        char                    *container, *stat, *param;
+        int                     window = 60, count, i, n = 0;
+
+        if (1 > request->nparam || 3 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == sampler_slots)
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Sampler is not running, set SamplerInterval"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        stat = get_rparam(request, 1);
+        param = get_rparam(request, 2);
+
+        if (NULL == stat || '\0' == *stat)
+                stat = "max";
+
+        if (0 != strcmp(stat, "max") && 0 != strcmp(stat, "p95") && 0 != strcmp(stat, "mean"))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid second parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL != param && '\0' != *param && (0 >= (window = atoi(param)) || SEC_PER_DAY < window))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid third parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        while ('/' == *container)
+                container++;
+
+        if (-1 == (count = zbx_lxd_sampler_copy(container, samples)))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Container %s is not sampled", container));
+                return SYSINFO_RET_FAIL;
+        }
+
+        // there is no other source of the samples, unlike for the collector slots
+        if (-2 == count)
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Sampler slot of container %s is busy", container));
+                return SYSINFO_RET_FAIL;
+        }
+
+        now = zbx_time();
+        since = now - window;
+
+        if (0 != cpu)
+                capacity = zbx_lxd_container_cpus(zbx_lxd_container_get(container, now), now) * 1000000.0 / 100;
+
+        for (i = 0; i < count; i++)
+        {
+                if (samples[i].sampled <= since)
+                        continue;
+
+                if (0 == cpu)
+                {
+                        values[n++] = (double)samples[i].memory;
+                        continue;
+                }
+
+                // a failed read or a restarted container breaks the rate
+                if (0 == i || 0 == samples[i - 1].sampled || samples[i].cpu < samples[i - 1].cpu ||
+                                samples[i].sampled <= samples[i - 1].sampled)
+                {
+                        continue;
+                }
+
+                values[n++] = MIN((samples[i].cpu - samples[i - 1].cpu) /
+                                (samples[i].sampled - samples[i - 1].sampled) / capacity, 100);
+        }
+
+        if (0 == n)
+        {
+                // the first CPU sample has no rate yet
+                if (0 != cpu && 0 < count && samples[count - 1].sampled > since)
+                {
+                        SET_DBL_RESULT(result, 0);
+                        return SYSINFO_RET_OK;
+                }
+
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "No samples in the last %d seconds", window));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (0 == strcmp(stat, "mean"))
+        {
+                for (i = 0; i < n; i++)
+                        sum += values[i];
+
+                value = sum / n;
+        }
+        else
+        {
+                qsort(values, n, sizeof(double), zbx_lxd_double_compare);
+
+                // nearest rank
+                value = values[0 == strcmp(stat, "p95") ? (n * 95 + 99) / 100 - 1 : n - 1];
+        }
+
+        if (0 != cpu)
+                SET_DBL_RESULT(result, value);
+        else
+                SET_UI64_RESULT(result, (zbx_uint64_t)(value + 0.5));
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_cpu_sampled                                       *
+ *                                                                            *
+ * Purpose: container CPU utilisation in percent of its effective cpuset      *
+ *          between the sampler samples of the window                         *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_cpu_sampled(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_cpu_sampled()");
+
+        return zbx_lxd_sampled(request, result, 1);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_mem_sampled                                       *
+ *                                                                            *
+ * Purpose: container memory usage in bytes of the sampler samples of the     *
+ *          window                                                            *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_mem_sampled(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_mem_sampled()");
+
+        return zbx_lxd_sampled(request, result, 0);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_cgroup_pids                                              *
+ *                                                                            *
+ * Purpose: append the processes of a cgroup and of its sub-cgroups to        *
+ *          top_pids                                                          *
+ *                                                                            *
+ * Parameters: dir   - [IN] descriptor of the cgroup directory                *
+ *             depth - [IN] sub-cgroup levels still read                      *
+ *             npids - [IN/OUT] processes in top_pids                         *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_cgroup_pids(int dir, int depth, int *npids)
+{
+        struct dirent   *d;
+        DIR             *sub;
+        const char      *p, *end;
+        size_t          len;
+        long            pid;
+        int             fd;
+
+        if (-1 != (fd = openat(dir, "cgroup.procs", O_RDONLY | O_CLOEXEC)) &&
+                        SUCCEED == zbx_lxd_fd_read(&reader, fd, &len))
+        {
+                for (p = reader.buf, end = reader.buf + len; p < end; p++)
+                {
+                        for (pid = 0; p < end && '0' <= *p && '9' >= *p; p++)
+                                pid = pid * 10 + *p - '0';
+
+                        if (0 == pid)
+                                continue;
+
+                        if (*npids == top_pids_alloc)
+                        {
+                                top_pids_alloc = MAX(256, top_pids_alloc * 2);
+                                top_pids = zbx_realloc(top_pids, top_pids_alloc * sizeof(pid_t));
+                        }
+
+                        top_pids[(*npids)++] = (pid_t)pid;
+                }
+        }
+
+        if (0 == depth)
+                return;
+
+        if (-1 == (fd = openat(dir, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) || NULL == (sub = fdopendir(fd)))
+        {
+                if (-1 != fd)
+                        close(fd);
+                return;
+        }
+
+        while (NULL != (d = readdir(sub)))
+        {
+                if (DT_DIR != d->d_type || '.' == d->d_name[0])
+                        continue;
+
+                if (-1 == (fd = openat(dirfd(sub), d->d_name, O_PATH | O_DIRECTORY | O_CLOEXEC)))
+                        continue;
+
+                zbx_lxd_cgroup_pids(fd, depth - 1, npids);
+                close(fd);
+        }
+        closedir(sub);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_proc_parse                                               *
+ *                                                                            *
+ * Purpose: read command, cpu ticks, start time and rss of a process from     *
+ *          /proc/<pid>/stat                                                  *
+ *                                                                            *
+ * Return value: SUCCEED - the process was read                               *
+ *               FAIL - the process is gone                                   *
+ *                                                                            *
+ * Comment: rss of stat is the resident size of statm, reading statm as well  *
+ *          would only double the opens                                       *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_proc_parse(pid_t pid, zbx_lxd_proc_t *proc)
+{
+        char            path[32], buf[1024], *comm, *p;
+        zbx_uint64_t    values[21];     /* fields 4 (ppid) to 24 (rss) */
+        ssize_t         n;
+        int             fd, i;
+
+        zbx_snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+        if (-1 == (fd = open(path, O_RDONLY | O_CLOEXEC)))
+                return FAIL;
+
+        n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+
+        ZBX_LXD_STATS_ADD(file_opens, 1);
+
+        if (0 >= n)
+                return FAIL;
+
+        ZBX_LXD_STATS_ADD(file_reads, 1);
+        ZBX_LXD_STATS_ADD(bytes_parsed, n);
+        buf[n] = '\0';
+
+        // the command may contain spaces and parentheses, it ends at the last ')'
+        if (NULL == (comm = strchr(buf, '(')) || NULL == (p = strrchr(comm, ')')) || NULL == (p = strchr(p + 2, ' ')))
+                return FAIL;
+
+        zbx_strlcpy(proc->comm, comm + 1, MIN(sizeof(proc->comm), (size_t)(strrchr(comm, ')') - comm)));
+
+        for (i = 0; i < (int)(sizeof(values) / sizeof(*values)); i++)
+        {
+                while (' ' == *p)
+                        p++;
+
+                if ('\0' == *p || '\n' == *p)
+                        return FAIL;
+
+                values[i] = strtoull(p, &p, 10);
+        }
+
+        proc->pid = pid;
+        proc->ticks = values[14 - 4] + values[15 - 4];
+        proc->start = values[22 - 4];
+        proc->rss = values[24 - 4];
+        proc->cpu = 0;
+
+        return SUCCEED;
+}
+
+static int      zbx_lxd_proc_compare_pid(const void *p1, const void *p2)
+{
+        pid_t   pid1 = ((const zbx_lxd_proc_t *)p1)->pid, pid2 = ((const zbx_lxd_proc_t *)p2)->pid;
+
+        return (pid1 < pid2 ? -1 : (pid1 > pid2 ? 1 : 0));
+}
+
+static int      zbx_lxd_pid_compare(const void *p1, const void *p2)
+{
+        pid_t   pid1 = *(const pid_t *)p1, pid2 = *(const pid_t *)p2;
+
+        return (pid1 < pid2 ? -1 : (pid1 > pid2 ? 1 : 0));
+}
+
+static int      zbx_lxd_proc_compare_cpu(const void *p1, const void *p2)
+{
+        double  cpu1 = ((const zbx_lxd_proc_t *)p1)->cpu, cpu2 = ((const zbx_lxd_proc_t *)p2)->cpu;
+
+        return (cpu1 > cpu2 ? -1 : (cpu1 < cpu2 ? 1 : zbx_lxd_proc_compare_pid(p1, p2)));
+}
+
+static int      zbx_lxd_proc_compare_rss(const void *p1, const void *p2)
+{
+        zbx_uint64_t    rss1 = ((const zbx_lxd_proc_t *)p1)->rss, rss2 = ((const zbx_lxd_proc_t *)p2)->rss;
+
+        return (rss1 > rss2 ? -1 : (rss1 < rss2 ? 1 : zbx_lxd_proc_compare_pid(p1, p2)));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_top                                               *
+ *                                                                            *
+ * Purpose: processes of a container using most CPU or memory                 *
+ *                                                                            *
+ * Parameters: container - [IN] container name                                *
+ *             metric    - [IN] cpu (default) or rss                          *
+ *             count     - [IN] processes returned, 10 by default             *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: cpu is percent of one CPU since the previous complete call served *
+ *          by this agent process, or since the process started for processes *
+ *          not seen before. The previous processes are kept per agent        *
+ *          process, not in shared memory, as a container may have more of    *
+ *          them than a fixed slot holds. Processes are parsed in batches     *
+ *          until the deadline, the result is then marked partial and is not  *
+ *          kept as the previous sample.                                      *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_top(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_top()");
+        char                    *container, *metric, *count, value[32];
+        zbx_lxd_container_t     *entry;
+        zbx_lxd_dirfd_t         *dirfd;
+        zbx_lxd_proc_t          *proc, *prev;
+        struct zbx_json         j;
+        struct timespec         ts;
+        zbx_uint64_t            top = 10;
+        double                  now = zbx_time(), deadline = zbx_lxd_deadline(now), uptime, age;
+        long                    hz, page_size;
+        int                     npids = 0, nprocs = 0, partial = 0, rss, resample, i;
+
+        if (1 > request->nparam || 3 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        metric = get_rparam(request, 1);
+        count = get_rparam(request, 2);
+
+        if (NULL == metric || '\0' == *metric || 0 == strcmp(metric, "cpu"))
+                rss = 0;
+        else if (0 == strcmp(metric, "rss"))
+                rss = 1;
+        else
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Invalid second parameter: %s", metric));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL != count && '\0' != *count && (SUCCEED != is_uint64(count, &top) || 0 == top ||
+                        ZBX_LXD_TOP_MAX < top))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Invalid third parameter: %s", count));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "lxd.top is not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "lxd.top is not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        while ('/' == *container)
+                container++;
+
+        if (ZBX_LXD_NAME_LEN <= strlen(container) ||
+                        NULL == (dirfd = zbx_lxd_dirfd_get(&reader, layout->cpuset, container)))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Container %s is not running", container));
+                return SYSINFO_RET_FAIL;
+        }
+
+        entry = zbx_lxd_container_get(container, now);
+        resample = (now >= entry->procs_sampled + 1);
+
+        zbx_lxd_cgroup_pids(dirfd->fd, ZBX_LXD_PID_DEPTH, &npids);
+        qsort(top_pids, npids, sizeof(pid_t), zbx_lxd_pid_compare);
+
+        if (top_procs_alloc < npids)
+        {
+                top_procs_alloc = MAX(npids, top_procs_alloc * 2);
+                top_procs = zbx_realloc(top_procs, top_procs_alloc * sizeof(zbx_lxd_proc_t));
+        }
+
+        if (0 >= (hz = sysconf(_SC_CLK_TCK)))
+                hz = 100;
+
+        if (0 >= (page_size = sysconf(_SC_PAGESIZE)))
+                page_size = 4096;
+
+        uptime = (0 == clock_gettime(CLOCK_BOOTTIME, &ts) ? ts.tv_sec + ts.tv_nsec / 1e9 : 0);
+
+        for (i = 0; i < npids; i++)
+        {
+                if (0 != i && 0 == i % ZBX_LXD_TOP_BATCH && zbx_time() > deadline)
+                {
+                        zabbix_log(LOG_LEVEL_DEBUG, "lxd.top of %s parsed %d of %d processes before the deadline",
+                                        container, nprocs, npids);
+                        partial = 1;
+                        break;
+                }
+
+                proc = &top_procs[nprocs];
+
+                // exited since cgroup.procs was read
+                if (SUCCEED != zbx_lxd_proc_parse(top_pids[i], proc))
+                        continue;
+
+                prev = (0 != entry->nprocs ? bsearch(proc, entry->procs, entry->nprocs, sizeof(zbx_lxd_proc_t),
+                                zbx_lxd_proc_compare_pid) : NULL);
+
+                // calls closer than a second apart keep the rates of the last sample
+                if (NULL != prev && prev->start == proc->start && 0 == resample)
+                        proc->cpu = prev->cpu;
+                else if (NULL != prev && prev->start == proc->start && proc->ticks >= prev->ticks)
+                        proc->cpu = (double)(proc->ticks - prev->ticks) / hz / (now - entry->procs_sampled) * 100;
+                else if (0 < (age = uptime - (double)proc->start / hz))
+                        proc->cpu = (double)proc->ticks / hz / age * 100;
+
+                nprocs++;
+        }
+
+        // ticks of this call are the previous sample of the next one, still ordered by pid; a partial
+        // sample would lose the processes not reached, the next call is compared with the last full one
+        if (0 != resample && 0 == partial)
+        {
+                entry->procs = zbx_realloc(entry->procs, MAX(nprocs, 1) * sizeof(zbx_lxd_proc_t));
+                memcpy(entry->procs, top_procs, nprocs * sizeof(zbx_lxd_proc_t));
+                entry->nprocs = nprocs;
+                entry->procs_sampled = now;
+        }
+
+        qsort(top_procs, nprocs, sizeof(zbx_lxd_proc_t), (0 != rss ? zbx_lxd_proc_compare_rss :
+                        zbx_lxd_proc_compare_cpu));
+
+        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+        zbx_json_adduint64(&j, "processes", npids);
+        zbx_json_addstring(&j, "partial", (0 != partial ? "true" : "false"), ZBX_JSON_TYPE_INT);
+        zbx_json_addarray(&j, "top");
+
+        for (i = 0; i < nprocs && i < (int)top; i++)
+        {
+                proc = &top_procs[i];
+
+                zbx_json_addobject(&j, NULL);
+                zbx_json_adduint64(&j, "pid", proc->pid);
+                zbx_json_addstring(&j, "name", proc->comm, ZBX_JSON_TYPE_STRING);
+                zbx_snprintf(value, sizeof(value), "%.2f", proc->cpu);
+                zbx_json_addstring(&j, "cpu", value, ZBX_JSON_TYPE_INT);
+                zbx_json_adduint64(&j, "rss", proc->rss * page_size);
+                zbx_json_close(&j);
+        }
+
+        zbx_json_close(&j);
+        SET_TEXT_RESULT(result, zbx_strdup(NULL, j.buffer));
+        zbx_json_free(&j);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_dev                                               *
+ *                                                                            *
+ * Purpose: container device blkio metrics                                    *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Notes: https://www.kernel.org/doc/Documentation/cgroup-v1/blkio-controller.txt
+ ******************************************************************************/
+int     zbx_module_lxd_dev(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_dev()");
+        char                    *container, *metric, *stat_file;
+        int                     ret = SYSINFO_RET_FAIL;
+        zbx_lxd_snapshot_t      *snapshot;
+        zbx_uint64_t            value;
+
+        if (3 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "dev metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "dev metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        stat_file = get_rparam(request, 1);
+        metric = get_rparam(request, 2);
+
+        if (NULL == (snapshot = zbx_lxd_snapshot_get(container, layout->blkio, stat_file)))
+        {
+                SET_MSG_RESULT(result, strdup("Cannot open stat file, maybe CONFIG_DEBUG_BLK_CGROUP is not enabled"));
+                zabbix_log(LOG_LEVEL_ERR, "Cannot open stat file, maybe CONFIG_DEBUG_BLK_CGROUP is not enabled");
+                return SYSINFO_RET_FAIL;
+        }
+
+        zabbix_log(LOG_LEVEL_DEBUG, "Looking metric %s in blkio file", metric);
+        if (SUCCEED == zbx_lxd_snapshot_value(snapshot, metric, &value))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Id: %s; stat file: %s, metric: %s; value: " ZBX_FS_UI64, container, stat_file, metric, value);
+                SET_UI64_RESULT(result, value);
+                ret = SYSINFO_RET_OK;
+        }
+
+        if (SYSINFO_RET_FAIL == ret){
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot find a line with requested metric in blkio file"));
+                zabbix_log(LOG_LEVEL_ERR, "Cannot find a line with requested metric in blkio file");
+        }
+
+        return ret;
+}
+
+/* metric names of lxd.dev.rate */
+static const char       *io_metrics[ZBX_LXD_IO_COUNT] = {"read_bytes", "write_bytes", "read_ops", "write_ops"};
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_devices_update                                           *
+ *                                                                            *
+ * Purpose: rebuild the device table of a container from its blkio throttle   *
+ *          files                                                             *
+ *                                                                            *
+ * Parameters: entry   - [IN/OUT] the container                               *
+ *             io      - [IN] io_service_bytes and io_serviced snapshots,     *
+ *                            the latter may be NULL                          *
+ *             sampled - [IN] time of the snapshots                           *
+ *                                                                            *
+ * Comment: every file is walked once, "M:m Read" and "M:m Write" lines go    *
+ *          into the (device, operation) table, other lines are skipped.      *
+ *          Rates are not known yet, see zbx_lxd_devices_rates().             *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_devices_update(zbx_lxd_container_t *entry, zbx_lxd_snapshot_t * const *io, double sampled)
+{
+        zbx_lxd_device_t        *devices = NULL;
+        const zbx_lxd_stat_t    *stat;
+        const char              *space;
+        int                     ndevices = 0, i, j, k, op;
+
+        for (j = 0; j < 2; j++)
+        {
+                if (NULL == io[j])
+                        continue;
+
+                for (i = 0; i < io[j]->nstats; i++)
+                {
+                        stat = &io[j]->stats[i];
+
+                        if (NULL == (space = strchr(stat->key, ' ')) || ZBX_LXD_DEV_LEN <= space - stat->key)
+                                continue;
+
+                        if (0 == strcmp(space + 1, "Read"))
+                                op = (0 == j ? ZBX_LXD_IO_READ_BYTES : ZBX_LXD_IO_READ_OPS);
+                        else if (0 == strcmp(space + 1, "Write"))
+                                op = (0 == j ? ZBX_LXD_IO_WRITE_BYTES : ZBX_LXD_IO_WRITE_OPS);
+                        else
+                                continue;
+
+                        for (k = 0; k < ndevices; k++)
+                        {
+                                if (0 == strncmp(devices[k].dev, stat->key, space - stat->key) &&
+                                                '\0' == devices[k].dev[space - stat->key])
+                                {
+                                        break;
+                                }
+                        }
+
+                        if (k == ndevices)
+                        {
+                                devices = zbx_realloc(devices, ++ndevices * sizeof(zbx_lxd_device_t));
+                                memset(&devices[k], 0, sizeof(zbx_lxd_device_t));
+                                memcpy(devices[k].dev, stat->key, space - stat->key);
+                        }
+
+                        devices[k].counters[op] = stat->value;
+                }
+        }
+
+        free(entry->devices);
+        entry->devices = devices;
+        entry->ndevices = ndevices;
+        entry->io_sampled = sampled;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_devices_rates                                            *
+ *                                                                            *
+ * Purpose: compute per-second rates of the device table against the previous *
+ *          sample shared by the agent processes                              *
+ *                                                                            *
+ * Comment: samples closer than a second apart keep the previous rates, the   *
+ *          rates of the last sample are copied into the device table. New    *
+ *          devices have no rate yet, counters that went back have 0. Only    *
+ *          the first ZBX_LXD_IO_DEVICES devices of a container are sampled.  *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_devices_rates(zbx_lxd_container_t *entry)
+{
+        zbx_lxd_rates_t         *rates;
+        zbx_lxd_events_t        *shared;
+        zbx_lxd_device_t        *device, *old;
+        double                  elapsed;
+        int                     i, k, op;
+
+        rates = zbx_lxd_rates_get(entry, &shared);
+
+        if (entry->io_sampled >= rates->io_sampled + 1)
+        {
+                elapsed = entry->io_sampled - rates->io_sampled;
+
+                for (k = 0; k < entry->ndevices; k++)
+                {
+                        device = &entry->devices[k];
+
+                        for (old = NULL, i = 0; i < rates->ndevices && NULL == old; i++)
+                        {
+                                if (0 == strcmp(rates->devices[i].dev, device->dev))
+                                        old = &rates->devices[i];
+                        }
+
+                        for (op = 0; op < ZBX_LXD_IO_COUNT; op++)
+                        {
+                                if (NULL == old || 0 == rates->io_sampled)
+                                        device->rates[op] = -1;
+                                else if (device->counters[op] < old->counters[op])
+                                        device->rates[op] = 0;
+                                else
+                                        device->rates[op] = (device->counters[op] - old->counters[op]) / elapsed;
+                        }
+                }
+
+                if (ZBX_LXD_IO_DEVICES < entry->ndevices)
+                {
+                        zabbix_log(LOG_LEVEL_DEBUG, "Container %s has %d devices, rates of the first %d are kept",
+                                        entry->name, entry->ndevices, ZBX_LXD_IO_DEVICES);
+                }
+
+                rates->ndevices = MIN(entry->ndevices, ZBX_LXD_IO_DEVICES);
+                memcpy(rates->devices, entry->devices, rates->ndevices * sizeof(zbx_lxd_device_t));
+                rates->io_sampled = entry->io_sampled;
+        }
+
+        for (k = 0; k < entry->ndevices; k++)
+        {
+                device = &entry->devices[k];
+
+                for (old = NULL, i = 0; i < rates->ndevices && NULL == old; i++)
+                {
+                        if (0 == strcmp(rates->devices[i].dev, device->dev))
+                                old = &rates->devices[i];
+                }
+
+                for (op = 0; op < ZBX_LXD_IO_COUNT; op++)
+                        device->rates[op] = (NULL != old ? old->rates[op] : -1);
+        }
+
+        zbx_lxd_rates_release(shared);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_devices_get                                              *
+ *                                                                            *
+ * Purpose: return the container with up to date device table                 *
+ *                                                                            *
+ * Parameters: container - [IN] container name                                *
+ *             rates     - [IN] 1 - compute the rates of the devices too      *
+ *                                                                            *
+ * Return value: the container or NULL if io_service_bytes cannot be read     *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_container_t      *zbx_lxd_devices_get(const char *container, int rates)
+{
+        zbx_lxd_container_t     *entry;
+        zbx_lxd_snapshot_t      *io[2];
+
+        if (NULL == (io[0] = zbx_lxd_snapshot_get(container, zbx_lxd_file_cgroup(ZBX_LXD_FILE_IO_BYTES),
+                        collect_files[ZBX_LXD_FILE_IO_BYTES])))
+        {
+                return NULL;
+        }
+
+        io[1] = zbx_lxd_snapshot_get(container, zbx_lxd_file_cgroup(ZBX_LXD_FILE_IO_OPS),
+                        collect_files[ZBX_LXD_FILE_IO_OPS]);
+
+        while ('/' == *container)
+                container++;
+
+        entry = zbx_lxd_container_get(container, zbx_time());
+
+        if (io[0]->sampled != entry->io_sampled)
+                zbx_lxd_devices_update(entry, io, io[0]->sampled);
+
+        if (0 != rates)
+                zbx_lxd_devices_rates(entry);
+
+        return entry;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_dev_discovery                                     *
+ *                                                                            *
+ * Purpose: block device discovery of a container                             *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: {#DEVNAME} is the kernel name of the device from /sys/dev/block,  *
+ *          the "major:minor" id when the device is not there                 *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_dev_discovery(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_dev_discovery()");
+        char                    *container, link[MAX_STRING_LEN], path[64];
+        const char              *devname;
+        zbx_lxd_container_t     *entry;
+        struct zbx_json         j;
+        ssize_t                 len;
+        int                     i;
+
+        if (1 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "dev metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "dev metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+
+        if (NULL == (entry = zbx_lxd_devices_get(container, 0)))
+        {
+                SET_MSG_RESULT(result, strdup("Cannot open blkio.throttle.io_service_bytes file"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+        zbx_json_addarray(&j, ZBX_PROTO_TAG_DATA);
+
+        for (i = 0; i < entry->ndevices; i++)
+        {
+                zbx_snprintf(path, sizeof(path), "/sys/dev/block/%s", entry->devices[i].dev);
+
+                if (0 < (len = readlink(path, link, sizeof(link) - 1)))
+                {
+                        link[len] = '\0';
+                        devname = (NULL != strrchr(link, '/') ? strrchr(link, '/') + 1 : link);
+                }
+                else
+                        devname = entry->devices[i].dev;
+
+                zbx_json_addobject(&j, NULL);
+                zbx_json_addstring(&j, "{#DEVICE}", entry->devices[i].dev, ZBX_JSON_TYPE_STRING);
+                zbx_json_addstring(&j, "{#DEVNAME}", devname, ZBX_JSON_TYPE_STRING);
+                zbx_json_close(&j);
+        }
+
+        zbx_json_close(&j);
+
+        SET_STR_RESULT(result, zbx_strdup(NULL, j.buffer));
+        zbx_json_free(&j);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_dev_rate                                          *
+ *                                                                            *
+ * Purpose: per-second read/write bytes and operations of container devices  *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: lxd.dev.rate[container] returns all devices as JSON for dependent *
+ *          items, lxd.dev.rate[container,device,metric] a single rate. Rates *
+ *          are computed between the two last samples taken at least a second *
+ *          apart by any agent process, see zbx_lxd_rates_get(). Devices      *
+ *          without a previous sample are left out of the JSON, the request   *
+ *          fails when no device has one.                                     *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_dev_rate(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_dev_rate()");
+        char                    *container, *dev, *metric, value[32];
+        zbx_lxd_container_t     *entry;
+        struct zbx_json         j;
+        int                     i, op, nrates = 0;
+
+        if (1 != request->nparam && 3 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "dev metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "dev metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        dev = get_rparam(request, 1);
+        metric = get_rparam(request, 2);
+
+        for (op = 0; NULL != metric && op < ZBX_LXD_IO_COUNT && 0 != strcmp(io_metrics[op], metric); op++)
+                ;
+
+        if (op == ZBX_LXD_IO_COUNT)
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid third parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == (entry = zbx_lxd_devices_get(container, 1)))
+        {
+                SET_MSG_RESULT(result, strdup("Cannot open blkio.throttle.io_service_bytes file"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL != dev)
+        {
+                for (i = 0; i < entry->ndevices; i++)
+                {
+                        if (0 != strcmp(entry->devices[i].dev, dev))
+                                continue;
+
+                        if (0 > entry->devices[i].rates[op])
+                        {
+                                SET_MSG_RESULT(result, zbx_strdup(NULL, "Not enough data, the first sample was"
+                                                " just taken"));
+                                return SYSINFO_RET_FAIL;
+                        }
+
+                        SET_DBL_RESULT(result, entry->devices[i].rates[op]);
+                        return SYSINFO_RET_OK;
+                }
+
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot find device %s of the container", dev));
+                return SYSINFO_RET_FAIL;
+        }
+
+        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+
+        for (i = 0; i < entry->ndevices; i++)
+        {
+                if (0 > entry->devices[i].rates[ZBX_LXD_IO_READ_BYTES])
+                        continue;
+
+                zbx_json_addobject(&j, entry->devices[i].dev);
+                for (op = 0; op < ZBX_LXD_IO_COUNT; op++)
+                {
+                        zbx_snprintf(value, sizeof(value), "%.2f", entry->devices[i].rates[op]);
+                        zbx_json_addstring(&j, io_metrics[op], value, ZBX_JSON_TYPE_INT);
+                }
+                zbx_json_close(&j);
+                nrates++;
+        }
+
+        if (0 == nrates && 0 != entry->ndevices)
+        {
+                zbx_json_free(&j);
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Not enough data, the first sample was just taken"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        SET_STR_RESULT(result, zbx_strdup(NULL, j.buffer));
+        zbx_json_free(&j);
+
+        return SYSINFO_RET_OK;
+}
+
+/* /proc/<pid>/net/dev columns */
+static const char       *net_metrics[] =
+{
+        "rx_bytes", "rx_packets", "rx_errors", "rx_dropped", "rx_fifo", "rx_frame", "rx_compressed", "rx_multicast",
+        "tx_bytes", "tx_packets", "tx_errors", "tx_dropped", "tx_fifo", "tx_collisions", "tx_carrier",
+        "tx_compressed"
+};
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_cgroup_pid                                               *
+ *                                                                            *
+ * Purpose: find a process of a cgroup or of its sub-cgroups                  *
+ *                                                                            *
+ * Parameters: dir   - [IN] descriptor of the cgroup directory                *
+ *             depth - [IN] sub-cgroup levels still searched                  *
+ *                                                                            *
+ * Return value: the pid or 0 if the cgroup tree has no process               *
+ *                                                                            *
+ * Comment: on cgroup2 and with systemd inside the container, processes live  *
+ *          in sub-cgroups only, e.g. init.scope                              *
+ *                                                                            *
+ ******************************************************************************/
+static pid_t    zbx_lxd_cgroup_pid(int dir, int depth)
+{
+        struct dirent   *d;
+        DIR             *sub;
+        char            buf[32];
+        ssize_t         n;
+        pid_t           pid = 0;
+        int             fd;
+
+        if (-1 != (fd = openat(dir, "cgroup.procs", O_RDONLY | O_CLOEXEC)))
+        {
+                if (0 < (n = read(fd, buf, sizeof(buf) - 1)))
+                {
+                        buf[n] = '\0';
+                        pid = (pid_t)atoi(buf);
+                }
+                close(fd);
+        }
+
+        if (0 != pid || 0 == depth)
+                return pid;
+
+        if (-1 == (fd = openat(dir, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) || NULL == (sub = fdopendir(fd)))
+        {
+                if (-1 != fd)
+                        close(fd);
+                return 0;
+        }
+
+        while (0 == pid && NULL != (d = readdir(sub)))
+        {
+                if (DT_DIR != d->d_type || '.' == d->d_name[0])
+                        continue;
+
+                if (-1 == (fd = openat(dirfd(sub), d->d_name, O_PATH | O_DIRECTORY | O_CLOEXEC)))
+                        continue;
+
+                pid = zbx_lxd_cgroup_pid(fd, depth - 1);
+                close(fd);
+        }
+        closedir(sub);
+
+        return pid;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_net_parse                                                *
+ *                                                                            *
+ * Purpose: parse /proc/net/dev into "<iface> <metric>" values                *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_net_parse(zbx_lxd_snapshot_t *snapshot, const char *buf, size_t len)
+{
+        const char      *p, *end = buf + len, *eol, *iface, *colon, *value;
+        zbx_uint64_t    ui64;
+        char            key[ZBX_LXD_KEY_LEN];
+        size_t          key_len;
+        int             i, line;
+
+        snapshot->nstats = 0;
+
+        for (p = buf, line = 0; p < end; p = eol + 1, line++)
+        {
+                if (NULL == (eol = memchr(p, '\n', end - p)))
+                        eol = end;
+
+                // two header lines
+                if (2 > line || NULL == (colon = memchr(p, ':', eol - p)))
+                        continue;
+
+                for (iface = p; ' ' == *iface; iface++)
+                        ;
+
+                for (i = 0, value = colon + 1; i < (int)(sizeof(net_metrics) / sizeof(*net_metrics)); i++)
+                {
+                        for (; value < eol && ' ' == *value; value++)
+                                ;
+
+                        for (p = value; p < eol && ' ' != *p; p++)
+                                ;
+
+                        if (SUCCEED != zbx_lxd_uint64(value, p, &ui64))
+                                break;
+
+                        key_len = zbx_snprintf(key, sizeof(key), "%.*s %s", (int)(colon - iface), iface,
+                                        net_metrics[i]);
+                        zbx_lxd_snapshot_add(snapshot, key, key_len, ui64);
+                        value = p;
+                }
+        }
+
+        zbx_lxd_snapshot_index(snapshot);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_net_get                                                  *
+ *                                                                            *
+ * Purpose: return parsed /proc/<pid>/net/dev of a container, read again only *
+ *          when older than SnapshotTTL seconds                               *
+ *                                                                            *
+ * Return value: the snapshot or NULL if the container has no process         *
+ *                                                                            *
+ * Comment: the pid is taken from cgroup.procs once and kept while its        *
+ *          network namespace stays the same, no namespace is entered         *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_snapshot_t       *zbx_lxd_net_get(const char *name)
+{
+        zbx_lxd_container_t     *entry;
+        zbx_lxd_dirfd_t         *dirfd;
+        struct stat             sb;
+        char                    path[64];
+        double                  now = zbx_time();
+        size_t                  len;
+        int                     attempt, fd;
+
+        while ('/' == *name)
+                name++;
+
+        entry = zbx_lxd_container_get(name, now);
+
+        if (NULL != entry->net && entry->net->sampled + snapshot_ttl > now)
+                return entry->net;
+
+        for (attempt = 0; attempt < 2; attempt++)
+        {
+                if (0 == entry->net_pid)
+                {
+                        if (NULL == (dirfd = zbx_lxd_dirfd_get(&reader, layout->cpuset, name)) ||
+                                        0 == (entry->net_pid = zbx_lxd_cgroup_pid(dirfd->fd, ZBX_LXD_PID_DEPTH)))
+                        {
+                                zabbix_log(LOG_LEVEL_DEBUG, "Cannot find a process of container %s", name);
+                                return NULL;
+                        }
+
+                        zbx_snprintf(path, sizeof(path), "/proc/%d/ns/net", (int)entry->net_pid);
+                        entry->net_ns = (0 == stat(path, &sb) ? sb.st_ino : 0);
+                        zabbix_log(LOG_LEVEL_DEBUG, "Using process %d for network of container %s",
+                                        (int)entry->net_pid, name);
+                }
+                else
+                {
+                        // the process exited or its pid was reused outside of the container
+                        zbx_snprintf(path, sizeof(path), "/proc/%d/ns/net", (int)entry->net_pid);
+                        if (0 != stat(path, &sb) || sb.st_ino != entry->net_ns)
+                        {
+                                entry->net_pid = 0;
+                                continue;
+                        }
+                }
+
+                zbx_snprintf(path, sizeof(path), "/proc/%d/net/dev", (int)entry->net_pid);
+
+                if (-1 == (fd = open(path, O_RDONLY | O_CLOEXEC)) || SUCCEED != zbx_lxd_fd_read(&reader, fd, &len))
+                {
+                        zabbix_log(LOG_LEVEL_DEBUG, "Cannot read %s: %s", path, zbx_strerror(errno));
+                        entry->net_pid = 0;
+                        continue;
+                }
+
+                if (NULL == entry->net)
+                {
+                        entry->net = zbx_malloc(NULL, sizeof(zbx_lxd_snapshot_t));
+                        memset(entry->net, 0, sizeof(zbx_lxd_snapshot_t));
+                        entry->net->cgroup = zbx_strdup(NULL, "");
+                        entry->net->stat_file = zbx_strdup(NULL, "net/dev");
+                }
+
+                zbx_lxd_net_parse(entry->net, reader.buf, len);
+                entry->net->sampled = now;
+
+                return entry->net;
+        }
+
+        return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_net                                               *
+ *                                                                            *
+ * Purpose: container network interface counters                             *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: metric is a /proc/net/dev column, rx_bytes, tx_packets, ...       *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_net(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_net()");
+        char                    *container, *iface, *metric, key[ZBX_LXD_KEY_LEN];
+        zbx_lxd_snapshot_t      *snapshot;
+        zbx_uint64_t            value;
+
+        if (3 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "net metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "net metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        iface = get_rparam(request, 1);
+        metric = get_rparam(request, 2);
+
+        if (NULL == (snapshot = zbx_lxd_net_get(container)))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot read network statistics of %s", container));
+                return SYSINFO_RET_FAIL;
+        }
+
+        zbx_snprintf(key, sizeof(key), "%s %s", iface, metric);
+
+        if (SUCCEED != zbx_lxd_snapshot_value(snapshot, key, &value))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot find the interface or metric in net/dev"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        SET_UI64_RESULT(result, value);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_net_discovery                                     *
+ *                                                                            *
+ * Purpose: network interface discovery of a container                       *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_net_discovery(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_net_discovery()");
+        char                    *container, *space;
+        zbx_lxd_snapshot_t      *snapshot;
+        struct zbx_json         j;
+        int                     i;
+
+        if (1 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "net metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "net metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+
+        if (NULL == (snapshot = zbx_lxd_net_get(container)))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot read network statistics of %s", container));
+                return SYSINFO_RET_FAIL;
+        }
+
+        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+        zbx_json_addarray(&j, ZBX_PROTO_TAG_DATA);
+
+        // every interface starts with its rx_bytes line
+        for (i = 0; i < snapshot->nstats; i++)
+        {
+                if (NULL == (space = strchr(snapshot->stats[i].key, ' ')) || 0 != strcmp(space + 1, net_metrics[0]))
+                        continue;
+
+                *space = '\0';
+                zbx_json_addobject(&j, NULL);
+                zbx_json_addstring(&j, "{#IFNAME}", snapshot->stats[i].key, ZBX_JSON_TYPE_STRING);
+                zbx_json_close(&j);
+                *space = ' ';
+        }
+
+        zbx_json_close(&j);
+
+        SET_STR_RESULT(result, zbx_strdup(NULL, j.buffer));
+        zbx_json_free(&j);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_pressure                                          *
+ *                                                                            *
+ * Purpose: container pressure stall information                              *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: rate is the percent of time stalled between the two last samples  *
+ *          taken at least a second apart by any agent process, computed from *
+ *          the total counter, see zbx_lxd_rates_get(). The first request of  *
+ *          a container fails as there is no previous sample yet.             *
+ *                                                                            *
+ * Notes: https://www.kernel.org/doc/Documentation/accounting/psi.rst         *
+ ******************************************************************************/
+int     zbx_module_lxd_pressure(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_pressure()");
+
+        static const char       *resources[] = {"cpu", "memory", "io"};
+        char                    *container, *resource, *type, *metric, stat_file[32], key[ZBX_LXD_KEY_LEN];
+        zbx_lxd_container_t     *entry;
+        zbx_lxd_snapshot_t      *snapshot;
+        zbx_lxd_rates_t         *rates;
+        zbx_lxd_events_t        *shared;
+        zbx_uint64_t            value, total;
+        double                  elapsed, rate;
+        int                     psi, full, i;
+
+        if (2 > request->nparam || 4 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "pressure metrics are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "pressure metrics are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        resource = get_rparam(request, 1);
+        type = get_rparam(request, 2);
+        metric = get_rparam(request, 3);
+
+        for (psi = 0; psi < ZBX_LXD_PSI_COUNT && 0 != strcmp(resource, resources[psi]); psi++)
+                ;
+
+        if (ZBX_LXD_PSI_COUNT == psi)
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid second parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == type || '\0' == *type)
+                type = "some";
+
+        if (0 != strcmp(type, "some") && 0 != strcmp(type, "full"))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid third parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == metric || '\0' == *metric)
+                metric = "avg10";
+
+        if (0 != strcmp(metric, "avg10") && 0 != strcmp(metric, "avg60") && 0 != strcmp(metric, "avg300") &&
+                        0 != strcmp(metric, "total") && 0 != strcmp(metric, "rate"))
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid fourth parameter"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        // pressure files of v1 hosts are in the hybrid unified hierarchy
+        zbx_snprintf(stat_file, sizeof(stat_file), "%s.pressure", resources[psi]);
+
+        if (NULL == (snapshot = zbx_lxd_snapshot_get(container, layout->unified, stat_file)))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot read %s of '%s'", stat_file, container);
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot open %s file", stat_file));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (0 != strcmp(metric, "rate"))
+        {
+                zbx_snprintf(key, sizeof(key), "%s %s", type, metric);
+
+                if (SUCCEED != zbx_lxd_snapshot_value(snapshot, key, &value))
+                {
+                        SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot find '%s' in %s", key, stat_file));
+                        return SYSINFO_RET_FAIL;
+                }
+
+                if (0 == strcmp(metric, "total"))
+                        SET_UI64_RESULT(result, value);
+                else
+                        SET_DBL_RESULT(result, value / 100.0);
+
+                return SYSINFO_RET_OK;
+        }
+
+        while ('/' == *container)
+                container++;
+
+        entry = zbx_lxd_container_get(container, zbx_time());
+        full = (0 == strcmp(type, "full"));
+        rates = zbx_lxd_rates_get(entry, &shared);
+
+        // samples closer than a second apart keep the last result
+        if (snapshot->sampled >= rates->psi_sampled[psi] + 1)
+        {
+                elapsed = (snapshot->sampled - rates->psi_sampled[psi]) * 1000000;
+
+                for (i = 0; i < 2; i++)
+                {
+                        // cpu has no full line before Linux 5.13
+                        if (SUCCEED != zbx_lxd_snapshot_value(snapshot, (0 == i ? "some total" : "full total"), &total))
+                                total = 0;
+
+                        // the first sample has no rate, a restarted container with reset counters has 0
+                        if (0 == rates->psi_sampled[psi])
+                                rates->psi_rate[psi][i] = -1;
+                        else if (total < rates->psi_total[psi][i])
+                                rates->psi_rate[psi][i] = 0;
+                        else
+                                rates->psi_rate[psi][i] = MIN((total - rates->psi_total[psi][i]) * 100 / elapsed, 100);
+
+                        rates->psi_total[psi][i] = total;
+                }
+
+                rates->psi_sampled[psi] = snapshot->sampled;
+        }
+
+        rate = rates->psi_rate[psi][full];
+        zbx_lxd_rates_release(shared);
+
+        if (0 > rate)
+        {
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Not enough data, the first sample was just taken"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        zabbix_log(LOG_LEVEL_DEBUG, "Id: %s; %s %s rate: %.2f", container, stat_file, type, rate);
+        SET_DBL_RESULT(result, rate);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_snapshot_json                                            *
+ *                                                                            *
+ * Purpose: add all values of a snapshot as a JSON object                     *
+ *                                                                            *
+ * Parameters: j        - [OUT] the JSON being built                          *
+ *             name     - [IN] object name                                    *
+ *             snapshot - [IN] the snapshot, NULL adds nothing                *
+ *             divisor  - [IN] every value is divided by it                   *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_snapshot_json(struct zbx_json *j, const char *name, const zbx_lxd_snapshot_t *snapshot,
+                zbx_uint64_t divisor)
+{
+        int     i;
+
+        if (NULL == snapshot)
+                return;
+
+        zbx_json_addobject(j, name);
+        for (i = 0; i < snapshot->nstats; i++)
+                zbx_json_adduint64(j, snapshot->stats[i].key, snapshot->stats[i].value / divisor);
+        zbx_json_close(j);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_stats_snapshot                                           *
+ *                                                                            *
+ * Purpose: get a collected file of a container for zbx_lxd_stats_json()      *
+ *                                                                            *
+ * Comment: with collect set, the file is read with the reader and into the   *
+ *          snapshots of that thread, or copied from the collector table, so  *
+ *          the caches of the agent process are not touched. They are not     *
+ *          safe to use from threads of the main agent process, which forks   *
+ *          the agent processes while the threads run.                        *
+ *                                                                            *
+ ******************************************************************************/
+static zbx_lxd_snapshot_t       *zbx_lxd_stats_snapshot(const char *container, int file, zbx_lxd_collect_t *collect)
+{
+        zbx_lxd_snapshot_t      *snapshot;
+
+        if (NULL == collect)
+                return zbx_lxd_snapshot_get(container, zbx_lxd_file_cgroup(file), collect_files[file]);
+
+        snapshot = &collect->files[file];
+
+        if (NULL != slots && SUCCEED == zbx_lxd_slot_read(container, file, snapshot, collect->now))
+                return snapshot;
+
+        if (SUCCEED != zbx_lxd_snapshot_load(snapshot, &collect->reader, zbx_lxd_file_cgroup(file), container,
+                        collect_files[file]))
+        {
+                return NULL;
+        }
+
+        snapshot->sampled = collect->now;
+
+        return snapshot;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_stats_json                                               *
+ *                                                                            *
+ * Purpose: add memory, cpu and blkio stats of a container as JSON objects    *
+ *          and the age of the oldest of them                                 *
+ *                                                                            *
+ * Return value: SUCCEED - stats were added                                   *
+ *               FAIL - the container doesn't run                             *
+ *                                                                            *
+ * Parameters: j         - [OUT] the JSON                                     *
+ *             container - [IN] container name                                *
+ *             collect   - [IN/OUT] state of a background thread to read the  *
+ *                         files with, NULL - the cache of the agent process  *
+ *             deadline  - [IN] no further files are read after this time     *
+ *             partial   - [OUT] 1 if files were left out at the deadline     *
+ *                                                                            *
+ * Comment: cpuacct user/system are normalized by the number of online CPUs   *
+ *          the same way as lxd.cpu does, other values are raw counters.      *
+ *          cpuacct.stat tells whether the container runs and is always read, *
+ *          the objects of files left out are missing and "partial" is true.  *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_stats_json(struct zbx_json *j, const char *container, zbx_lxd_collect_t *collect,
+                double deadline, int *partial)
+{
+        zbx_lxd_snapshot_t      *snapshots[ZBX_LXD_FILE_COUNT];
+        char                    age[32];
+        double                  now = zbx_time(), sampled = now;
+        long                    cpu_num;
+        int                     file;
+
+        *partial = 0;
+
+        if (NULL == (snapshots[ZBX_LXD_FILE_CPUACCT] = zbx_lxd_stats_snapshot(container, ZBX_LXD_FILE_CPUACCT,
+                        collect)))
+        {
+                return FAIL;
+        }
+
+        for (file = 0; file < ZBX_LXD_FILE_COUNT; file++)
+        {
+                if (ZBX_LXD_FILE_CPUACCT != file)
+                {
+                        if (0 == *partial && zbx_time() < deadline)
+                                snapshots[file] = zbx_lxd_stats_snapshot(container, file, collect);
+                        else
+                        {
+                                snapshots[file] = NULL;
+                                *partial = 1;
+                        }
+                }
+
+                if (NULL != snapshots[file] && snapshots[file]->sampled < sampled)
+                        sampled = snapshots[file]->sampled;
+        }
+
+        if (0 != *partial)
+                zabbix_log(LOG_LEVEL_DEBUG, "Stats of '%s' are partial, the deadline was reached", container);
+
+        if (1 > (cpu_num = sysconf(_SC_NPROCESSORS_ONLN)))
+                cpu_num = 1;
+
+        zbx_lxd_snapshot_json(j, "memory", snapshots[ZBX_LXD_FILE_MEMORY], 1);
+        zbx_lxd_snapshot_json(j, "cpuacct", snapshots[ZBX_LXD_FILE_CPUACCT], cpu_num);
+        zbx_lxd_snapshot_json(j, "cpu", snapshots[ZBX_LXD_FILE_CPU], 1);
+
+        zbx_json_addobject(j, "blkio");
+        zbx_lxd_snapshot_json(j, "io_service_bytes", snapshots[ZBX_LXD_FILE_IO_BYTES], 1);
+        zbx_lxd_snapshot_json(j, "io_serviced", snapshots[ZBX_LXD_FILE_IO_OPS], 1);
+        zbx_json_close(j);
+
+        zbx_snprintf(age, sizeof(age), "%.3f", now - sampled);
+        zbx_json_addstring(j, "age", age, ZBX_JSON_TYPE_INT);
+        zbx_json_addstring(j, "partial", (0 != *partial ? "true" : "false"), ZBX_JSON_TYPE_INT);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_stats                                             *
+ *                                                                            *
+ * Purpose: all memory, cpu and blkio metrics of a container as one JSON      *
+ *          document, meant to be split by dependent items                    *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_stats(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_stats()");
+        char            *container;
+        struct zbx_json j;
+        int             partial;
+
+        if (1 != request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check() || NULL == layout->cpuacct)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "stats are not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "stats are not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+
+        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+        if (SUCCEED != zbx_lxd_stats_json(&j, container, NULL, zbx_lxd_deadline(zbx_time()), &partial))
+        {
+                zbx_json_free(&j);
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot read cpuacct.stat of '%s', container doesn't run", container);
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot read stats of container %s", container));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (0 != partial)
+                ZBX_LXD_STATS_ADD(deadlines, 1);
+
+        SET_STR_RESULT(result, zbx_strdup(NULL, j.buffer));
+        zbx_json_free(&j);
+
+        return SYSINFO_RET_OK;
+}
+
+/* one push pass, see zbx_lxd_push_add() */
+typedef struct
+{
+        struct zbx_json         *j;
+        const char              *host;
+        int                     clock;
+        int                     values;
+        zbx_lxd_collect_t       *collect;       /* reader and snapshots of the push thread */
+        double                  deadline;       /* containers are left out of the pass after it */
+        int                     skipped;
+}
+zbx_lxd_push_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_push_add                                                 *
+ *                                                                            *
+ * Purpose: add lxd.up and lxd.stats values of a container to the sender data *
+ *                                                                            *
+ * Comment: past the deadline of the pass containers are left out, their      *
+ *          values are sent by the next pass                                  *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_push_add(const char *container, const char *driver, void *arg)
+{
+        zbx_lxd_push_t  *push = (zbx_lxd_push_t *)arg;
+        struct zbx_json stats;
+        char            key[MAX_STRING_LEN];
+        int             up, partial;
+
+        if (0 != push->skipped || zbx_time() >= push->deadline)
+        {
+                push->skipped++;
+                return;
+        }
+
+        zbx_json_init(&stats, ZBX_JSON_STAT_BUF_LEN);
+        up = (SUCCEED == zbx_lxd_stats_json(&stats, container, push->collect, push->deadline, &partial));
+
+        zbx_json_addobject(push->j, NULL);
+        zbx_json_addstring(push->j, ZBX_PROTO_TAG_HOST, push->host, ZBX_JSON_TYPE_STRING);
+        zbx_snprintf(key, sizeof(key), "lxd.up[%s]", container);
+        zbx_json_addstring(push->j, ZBX_PROTO_TAG_KEY, key, ZBX_JSON_TYPE_STRING);
+        zbx_json_addstring(push->j, ZBX_PROTO_TAG_VALUE, (0 != up ? "1" : "0"), ZBX_JSON_TYPE_STRING);
+        zbx_json_adduint64(push->j, ZBX_PROTO_TAG_CLOCK, push->clock);
+        zbx_json_close(push->j);
+        push->values++;
+
+        if (0 != up)
+        {
+                zbx_json_addobject(push->j, NULL);
+                zbx_json_addstring(push->j, ZBX_PROTO_TAG_HOST, push->host, ZBX_JSON_TYPE_STRING);
+                zbx_snprintf(key, sizeof(key), "lxd.stats[%s]", container);
+                zbx_json_addstring(push->j, ZBX_PROTO_TAG_KEY, key, ZBX_JSON_TYPE_STRING);
+                zbx_json_addstring(push->j, ZBX_PROTO_TAG_VALUE, stats.buffer, ZBX_JSON_TYPE_STRING);
+                zbx_json_adduint64(push->j, ZBX_PROTO_TAG_CLOCK, push->clock);
+                zbx_json_close(push->j);
+                push->values++;
+        }
+
+        zbx_json_free(&stats);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_push_send                                                *
+ *                                                                            *
+ * Purpose: send the sender data to PushServer and check its response         *
+ *                                                                            *
+ * Return value: SUCCEED - the server accepted the data                       *
+ *               FAIL - otherwise                                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_push_send(const char *data)
+{
+        zbx_socket_t            s;
+        struct zbx_json_parse   jp;
+        char                    response[MAX_STRING_LEN], info[MAX_STRING_LEN];
+        int                     ret = FAIL;
+
+        if (SUCCEED != zbx_tcp_connect(&s, NULL, push_server, (unsigned short)push_port, MAX(item_timeout, 3),
+                        ZBX_TCP_SEC_UNENCRYPTED, NULL, NULL))
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "Cannot connect to push server %s:%d: %s", push_server, push_port,
+                                zbx_socket_strerror());
+                return FAIL;
+        }
+
+        if (SUCCEED != zbx_tcp_send(&s, data) || SUCCEED != zbx_tcp_recv(&s))
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "Cannot send data to push server %s:%d: %s", push_server, push_port,
+                                zbx_socket_strerror());
+        }
+        else if (SUCCEED != zbx_json_open(s.buffer, &jp) || SUCCEED != zbx_json_value_by_name(&jp,
+                        ZBX_PROTO_TAG_RESPONSE, response, sizeof(response)) ||
+                        0 != strcmp(response, ZBX_PROTO_VALUE_SUCCESS))
+        {
+                zabbix_log(LOG_LEVEL_WARNING, "Push server %s:%d rejected data: %s", push_server, push_port, s.buffer);
+        }
+        else
+        {
+                if (SUCCEED == zbx_json_value_by_name(&jp, ZBX_PROTO_TAG_INFO, info, sizeof(info)))
+                        zabbix_log(LOG_LEVEL_DEBUG, "Push server %s:%d: %s", push_server, push_port, info);
+
+                ret = SUCCEED;
+        }
+
+        zbx_tcp_close(&s);
+
+        return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_push_thread                                              *
+ *                                                                            *
+ * Purpose: send lxd.up and lxd.stats of all containers to PushServer every   *
+ *          PushInterval seconds in one sender request                        *
+ *                                                                            *
+ * Comment: files are read with the own reader and snapshots of the thread,   *
+ *          see zbx_lxd_stats_snapshot()                                      *
+ *                                                                            *
+ ******************************************************************************/
+static void     *zbx_lxd_push_thread(void *arg)
+{
+        zbx_lxd_push_t          push;
+        zbx_lxd_collect_t       collect;
+        struct zbx_json         j;
+        struct timespec         deadline;
+        char                    host[MAX_STRING_LEN];
+        int                     i;
+
+        if (NULL != push_hostname)
+                zbx_strlcpy(host, push_hostname, sizeof(host));
+        else if (0 != gethostname(host, sizeof(host)))
+                zbx_strlcpy(host, "localhost", sizeof(host));
+        host[sizeof(host) - 1] = '\0';
+
+        memset(&collect, 0, sizeof(collect));
+        collect.reader.generation = layout->generation;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        pthread_mutex_lock(&push_lock);
+        while (0 == push_stop)
+        {
+                pthread_mutex_unlock(&push_lock);
+
+                zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+                zbx_json_addstring(&j, ZBX_PROTO_TAG_REQUEST, ZBX_PROTO_VALUE_SENDER_DATA, ZBX_JSON_TYPE_STRING);
+                zbx_json_addarray(&j, ZBX_PROTO_TAG_DATA);
+
+                push.j = &j;
+                push.host = host;
+                push.clock = (int)time(NULL);
+                push.values = 0;
+                push.collect = &collect;
+                collect.now = zbx_time();
+                // like zbx_lxd_deadline(), a fifth of the interval is left to send the data
+                push.deadline = collect.now + push_interval * 0.8;
+                push.skipped = 0;
+
+                pthread_mutex_lock(&walk_lock);
+                if (SYSINFO_RET_OK == zbx_lxd_layout_check())
+                        zbx_lxd_containers_walk(zbx_lxd_push_add, &push, 1);
+                pthread_mutex_unlock(&walk_lock);
+
+                zbx_json_close(&j);
+                zbx_json_adduint64(&j, ZBX_PROTO_TAG_CLOCK, push.clock);
+
+                if (0 != push.skipped)
+                {
+                        zabbix_log(LOG_LEVEL_WARNING, "Push deadline reached, %d containers left out, PushInterval"
+                                        " may be too short", push.skipped);
+                }
+
+                if (0 != push.values && SUCCEED == zbx_lxd_push_send(j.buffer))
+                        zabbix_log(LOG_LEVEL_DEBUG, "Pushed %d LXD values as host %s", push.values, host);
+
+                zbx_json_free(&j);
+                deadline.tv_sec += push_interval;
+
+                pthread_mutex_lock(&push_lock);
+                while (0 == push_stop && ETIMEDOUT != pthread_cond_timedwait(&push_cond, &push_lock, &deadline))
+                        ;
+        }
+        pthread_mutex_unlock(&push_lock);
+
+        for (i = 0; i < ZBX_LXD_FILE_COUNT; i++)
+                free(collect.files[i].stats);
+        zbx_lxd_reader_flush(&collect.reader);
+
+        return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_push_start                                               *
+ *                                                                            *
+ * Purpose: start the push thread                                             *
+ *                                                                            *
+ * Comment: called from zbx_module_init(), the thread keeps running in the    *
+ *          main agent process only, like the collector                       *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_push_start()
+{
+        if (SUCCEED != zbx_lxd_thread_start(&pusher, zbx_lxd_push_thread, "push"))
+                return FAIL;
+
+        push_pid = getpid();
+        zabbix_log(LOG_LEVEL_DEBUG, "LXD push started, server: %s:%d, interval: %d", push_server, push_port,
+                        push_interval);
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_push_stop                                                *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_push_stop()
+{
+        if (0 == push_pid || getpid() != push_pid)
+                return;
+
+        pthread_mutex_lock(&push_lock);
+        push_stop = 1;
+        pthread_cond_signal(&push_cond);
+        pthread_mutex_unlock(&push_lock);
+
+        pthread_join(pusher, NULL);
+        push_pid = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_module_stats                                      *
+ *                                                                            *
+ * Purpose: counters of the module itself in all agent processes              *
+ *                                                                            *
+ * Return value: SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: latency_us buckets count calls faster than their bound in         *
+ *          microseconds, "inf" the slower ones                               *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_module_stats(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_module_stats()");
+        zbx_lxd_key_stats_t     *key_stats;
+        struct zbx_json         j;
+        char                    bound[16];
+        int                     i, b;
+
+        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+        zbx_json_addobject(&j, "keys");
+
+        for (i = 0; NULL != keys[i].key && i < ZBX_LXD_MAX_KEYS; i++)
+        {
+                key_stats = &module_stats->keys[i];
+
+                zbx_json_addobject(&j, keys[i].key);
+                zbx_json_adduint64(&j, "calls", __atomic_load_n(&key_stats->calls, __ATOMIC_RELAXED));
+                zbx_json_adduint64(&j, "errors", __atomic_load_n(&key_stats->errors, __ATOMIC_RELAXED));
+                zbx_json_addobject(&j, "latency_us");
+
+                for (b = 0; b < ZBX_LXD_LATENCY_BUCKETS; b++)
+                {
+                        if (ZBX_LXD_LATENCY_BUCKETS - 1 == b)
+                                zbx_strlcpy(bound, "inf", sizeof(bound));
+                        else
+                                zbx_snprintf(bound, sizeof(bound), "%d", 1 << b);
+
+                        zbx_json_adduint64(&j, bound, __atomic_load_n(&key_stats->latency[b], __ATOMIC_RELAXED));
+                }
+
+                zbx_json_close(&j);
+                zbx_json_close(&j);
+        }
+
+        zbx_json_close(&j);
+        zbx_json_adduint64(&j, "file_opens", __atomic_load_n(&module_stats->file_opens, __ATOMIC_RELAXED));
+        zbx_json_adduint64(&j, "file_reads", __atomic_load_n(&module_stats->file_reads, __ATOMIC_RELAXED));
+        zbx_json_adduint64(&j, "bytes_parsed", __atomic_load_n(&module_stats->bytes_parsed, __ATOMIC_RELAXED));
+        zbx_json_adduint64(&j, "walks", __atomic_load_n(&module_stats->walks, __ATOMIC_RELAXED));
+        zbx_json_adduint64(&j, "walk_usec", __atomic_load_n(&module_stats->walk_usec, __ATOMIC_RELAXED));
+        zbx_json_adduint64(&j, "detects", __atomic_load_n(&module_stats->detects, __ATOMIC_RELAXED));
+        zbx_json_adduint64(&j, "deadlines", __atomic_load_n(&module_stats->deadlines, __ATOMIC_RELAXED));
+        zbx_json_close(&j);
+
+        SET_TEXT_RESULT(result, zbx_strdup(NULL, j.buffer));
+        zbx_json_free(&j);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_filter_free                                              *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_filter_free(zbx_lxd_filter_t *filter)
+{
+        if (NULL != filter->include)
+        {
+                regfree(&filter->include_re);
+                free(filter->include);
+        }
+
+        if (NULL != filter->exclude)
+        {
+                regfree(&filter->exclude_re);
+                free(filter->exclude);
+        }
+
+        free(filter);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_filter_get                                               *
+ *                                                                            *
+ * Purpose: return the compiled filter of a pair of patterns, compile and     *
+ *          cache it if needed                                                *
+ *                                                                            *
+ * Parameters: include - [IN] extended regular expression container names     *
+ *                            must match, NULL or empty for all               *
+ *             exclude - [IN] extended regular expression of container names  *
+ *                            to leave out, NULL or empty for none            *
+ *             error   - [OUT] allocated message when a pattern is invalid    *
+ *                                                                            *
+ * Return value: the cached filter or NULL if a pattern cannot be compiled    *
+ *                                                                            *
+ * Comment: the least recently used filter is dropped when there are          *
+ *          ZBX_LXD_FILTERS of them                                           *
+ *                                                                            *
+ ******************************************************************************/
+static const zbx_lxd_filter_t   *zbx_lxd_filter_get(const char *include, const char *exclude, char **error)
+{
+        zbx_lxd_filter_t        *filter, **prev, **oldest = NULL;
+        char                    buf[MAX_STRING_LEN];
+        int                     count = 0, rc;
+
+        if (NULL != include && '\0' == *include)
+                include = NULL;
+
+        if (NULL != exclude && '\0' == *exclude)
+                exclude = NULL;
+
+        for (prev = &filters; NULL != (filter = *prev); prev = &filter->next)
+        {
+                if (0 == zbx_strcmp_null(filter->include, include) && 0 == zbx_strcmp_null(filter->exclude, exclude))
+                {
+                        filter->lastuse = zbx_time();
+                        return filter;
+                }
+
+                if (NULL == oldest || filter->lastuse < (*oldest)->lastuse)
+                        oldest = prev;
+                count++;
+        }
+
+        filter = zbx_malloc(NULL, sizeof(zbx_lxd_filter_t));
+        filter->include = NULL;
+        filter->exclude = NULL;
+
+        if (NULL != include && 0 != (rc = regcomp(&filter->include_re, include, REG_EXTENDED | REG_NOSUB)))
+        {
+                regerror(rc, &filter->include_re, buf, sizeof(buf));
+                *error = zbx_dsprintf(*error, "Invalid include pattern \"%s\": %s", include, buf);
+                zbx_lxd_filter_free(filter);
+                return NULL;
+        }
+
+        if (NULL != include)
+                filter->include = zbx_strdup(NULL, include);
+
+        if (NULL != exclude && 0 != (rc = regcomp(&filter->exclude_re, exclude, REG_EXTENDED | REG_NOSUB)))
+        {
+                regerror(rc, &filter->exclude_re, buf, sizeof(buf));
+                *error = zbx_dsprintf(*error, "Invalid exclude pattern \"%s\": %s", exclude, buf);
+                zbx_lxd_filter_free(filter);
+                return NULL;
+        }
+
+        if (NULL != exclude)
+                filter->exclude = zbx_strdup(NULL, exclude);
+
+        if (ZBX_LXD_FILTERS <= count && NULL != oldest)
+        {
+                zbx_lxd_filter_t        *drop = *oldest;
+
+                *oldest = drop->next;
+                zbx_lxd_filter_free(drop);
+        }
+
+        filter->lastuse = zbx_time();
+        filter->next = filters;
+        filters = filter;
+
+        return filter;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_filter_match                                             *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_filter_match(const zbx_lxd_filter_t *filter, const char *container)
+{
+        if (NULL != filter->include && 0 != regexec(&filter->include_re, container, 0, NULL, 0))
+                return FAIL;
+
+        if (NULL != filter->exclude && 0 == regexec(&filter->exclude_re, container, 0, NULL, 0))
+                return FAIL;
+
+        return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_uninit                                                *
+ *                                                                            *
+ * Purpose: the function is called on agent shutdown                          *
+ *          It should be used to cleanup used resources if there are any      *
+ *                                                                            *
+ * Return value: ZBX_MODULE_OK - success                                      *
+ *               ZBX_MODULE_FAIL - function failed                            *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_uninit()
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_uninit()");
+
+        const char* znetns_prefix = "zabbix_module_lxd_";
+        DIR             *dir;
+        struct dirent   *d;
+
+        char *file = NULL;
+        if (NULL == (dir = opendir("/var/run/netns")))
+        {
+            zabbix_log(LOG_LEVEL_DEBUG, "/var/run/netns: %s", zbx_strerror(errno));
+        }
+        else
+        {
+            while (NULL != (d = readdir(dir)))
+            {
+                if(0 == strcmp(d->d_name, ".") || 0 == strcmp(d->d_name, ".."))
+                    continue;
+
+                // delete zabbix netns
+                if ((strstr(d->d_name, znetns_prefix)) != NULL)
+                {
+                    file = NULL;
+                    file = zbx_dsprintf(file, "/var/run/netns/%s", d->d_name);
+                    if(unlink(file) != 0)
+                    {
+                        zabbix_log(LOG_LEVEL_WARNING, "%s: %s", d->d_name, zbx_strerror(errno));
+                    }
+                }
+            }
+            if(0 != closedir(dir))
+            {
+                zabbix_log(LOG_LEVEL_WARNING, "/var/run/netns/: %s", zbx_strerror(errno));
+            }
+        }
+
+        zbx_lxd_container_t     *container;
+        zbx_lxd_layout_t        *l;
+        int                     i;
+
+        zbx_lxd_push_stop();
+        zbx_lxd_events_stop();
+        zbx_lxd_sampler_stop();
+        zbx_lxd_collector_stop();
+
+        for (i = 0; i < ZBX_LXD_BUCKETS; i++)
+        {
+                while (NULL != (container = containers[i]))
+                {
+                        containers[i] = container->next;
+                        zbx_lxd_container_free(container);
+                }
+        }
+        zbx_lxd_reader_flush(&reader);
+        zbx_lxd_members_reset();
+        zbx_lxd_api_reset();
+        zbx_free(api.buf);
+        zbx_free(api.body);
+
+        zbx_free(top_pids);
+        top_pids_alloc = 0;
+        zbx_free(top_procs);
+        top_procs_alloc = 0;
+
+        while (NULL != filters)
+        {
+                zbx_lxd_filter_t        *filter = filters;
+
+                filters = filter->next;
+                zbx_lxd_filter_free(filter);
+        }
+
+        if (&stats_local != module_stats)
+        {
+                munmap(module_stats, sizeof(zbx_lxd_stats_t));
+                module_stats = &stats_local;
+        }
+
+        while (&layout_none != layout)
+        {
+                l = layout;
+                layout = l->prev;
+                zbx_lxd_layout_free(l);
+        }
 
-        if (SYSINFO_RET_FAIL == ret)
-                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot find a line with requested metric in cpuacct.stat file"));
+        if (-1 != mounts_fd && getpid() == mounts_pid)
+        {
+                close(mounts_fd);
+                mounts_fd = -1;
+        }
 
-        return ret;
+        return ZBX_MODULE_OK;
 }
 
 /******************************************************************************
  *                                                                            *
- * Function: zbx_module_lxd_dev                                               *
- *                                                                            *
- * Purpose: container device blkio metrics                                    *
+ * Function: zbx_module_lxd_load_config                                       *
  *                                                                            *
- * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
- *                                 as not supported by zabbix                 *
- *               SYSINFO_RET_OK - success                                     *
+ * Purpose: read optional module configuration file                           *
  *                                                                            *
- * Notes: https://www.kernel.org/doc/Documentation/cgroup-v1/blkio-controller.txt
  ******************************************************************************/
-int     zbx_module_lxd_dev(AGENT_REQUEST *request, AGENT_RESULT *result)
+static void     zbx_module_lxd_load_config()
 {
-        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_dev()");
-        char    *container, *metric;
-        int     ret = SYSINFO_RET_FAIL;
+        struct cfg_line cfg[] =
+        {
+                /* PARAMETER,           VAR,                    TYPE,           MANDATORY,      MIN,    MAX */
+                {"SnapshotTTL",         &snapshot_ttl,          TYPE_INT,       PARM_OPT,       0,      3600},
+                {"CollectorInterval",   &collector_interval,    TYPE_INT,       PARM_OPT,       0,      3600},
+                {"CollectorSlots",      &collector_slots,       TYPE_INT,       PARM_OPT,       16,     65536},
+                {"MaxDirFds",           &max_dirfds,            TYPE_INT,       PARM_OPT,       1,      65536},
+                {"ApiTTL",              &api_ttl,               TYPE_INT,       PARM_OPT,       1,      3600},
+                {"ApiSocket",           &api_socket,            TYPE_STRING,    PARM_OPT,       0,      0},
+                {"CgroupRoot",          &cgroup_root,           TYPE_STRING,    PARM_OPT,       0,      0},
+                {"PushServer",          &push_server,           TYPE_STRING,    PARM_OPT,       0,      0},
+                {"PushPort",            &push_port,             TYPE_INT,       PARM_OPT,       1,      65535},
+                {"PushInterval",        &push_interval,         TYPE_INT,       PARM_OPT,       1,      3600},
+                {"PushHostname",        &push_hostname,         TYPE_STRING,    PARM_OPT,       0,      0},
+                {"EventsWatch",         &events_watch,          TYPE_INT,       PARM_OPT,       0,      1},
+                {"SamplerInterval",     &sampler_interval,      TYPE_INT,       PARM_OPT,       0,      60},
+                {"StaleTTL",            &stale_ttl,             TYPE_INT,       PARM_OPT,       0,      86400},
+                {NULL}
+        };
 
-        if (3 != request->nparam)
+        parse_cfg_file(ZBX_MODULE_LXD_CONFIG_FILE, cfg, ZBX_CFG_FILE_OPTIONAL, ZBX_CFG_STRICT);
+        zabbix_log(LOG_LEVEL_DEBUG, "zabbix_module_lxd SnapshotTTL: %d, CollectorInterval: %d, CollectorSlots: %d,"
+                        " MaxDirFds: %d, ApiTTL: %d, ApiSocket: %s, CgroupRoot: %s, PushServer: %s, PushPort: %d,"
+                        " PushInterval: %d, PushHostname: %s, EventsWatch: %d, SamplerInterval: %d, StaleTTL: %d",
+                        snapshot_ttl, collector_interval, collector_slots, max_dirfds, api_ttl,
+                        ZBX_NULL2STR(api_socket), ZBX_NULL2STR(cgroup_root), ZBX_NULL2STR(push_server), push_port,
+                        push_interval, ZBX_NULL2STR(push_hostname), events_watch, sampler_interval, stale_ttl);
+
+        // without the collector cgroup keys read the files on every request, there is no sample to serve stale
+        if (0 != stale_ttl && 0 == collector_interval)
         {
-                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
-                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
-                return SYSINFO_RET_FAIL;
+                zabbix_log(LOG_LEVEL_WARNING, "zabbix_module_lxd StaleTTL applies to lxd.api only, cgroup keys"
+                                " serve stale samples with CollectorInterval set only");
         }
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_instrumented                                             *
+ *                                                                            *
+ * Purpose: call the handler of the requested key and count the call in       *
+ *          lxd.module.stats                                                  *
+ *                                                                            *
+ ******************************************************************************/
+static int      zbx_lxd_instrumented(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zbx_lxd_key_stats_t     *key_stats;
+        struct timespec         start, end;
+        zbx_uint64_t            usec;
+        int                     i, b, ret;
+
+        for (i = 0; NULL != keys[i].key && 0 != strcmp(keys[i].key, request->key); i++)
+                ;
 
-        if (stat_dir == NULL || driver == NULL)
+        if (NULL == keys[i].key)
         {
-                zabbix_log(LOG_LEVEL_DEBUG, "dev metrics are not available at the moment - no stat directory");
-                SET_MSG_RESULT(result, zbx_strdup(NULL, "dev metrics are not available at the moment - no stat directory"));
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Unsupported item key"));
                 return SYSINFO_RET_FAIL;
         }
 
-        container = zbx_strdup(NULL, get_rparam(request, 0));
-        char    *stat_file = malloc(strlen(get_rparam(request, 1)) + 2);
-        zbx_strlcpy(stat_file, "/", strlen(get_rparam(request, 1)) + 2);
-        zbx_strlcat(stat_file, get_rparam(request, 1), strlen(get_rparam(request, 1)) + 2);
-        metric = get_rparam(request, 2);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = handlers[i](request, result);
+        clock_gettime(CLOCK_MONOTONIC, &end);
 
-        char    *cgroup = "blkio/";
-        size_t  filename_size = strlen(cgroup) + strlen(container) + strlen(stat_dir) + strlen(driver) + strlen(stat_file) + 2;
-        char    *filename = malloc(filename_size);
-        zbx_strlcpy(filename, stat_dir, filename_size);
-        zbx_strlcat(filename, cgroup, filename_size);
-        zbx_strlcat(filename, driver, filename_size);
-        zbx_strlcat(filename, container, filename_size);
-        zbx_strlcat(filename, stat_file, filename_size);
-        zabbix_log(LOG_LEVEL_DEBUG, "Metric source file: %s", filename);
-
-        FILE    *file;
-        if (NULL == (file = fopen(filename, "r")))
-        {
-                zabbix_log(LOG_LEVEL_ERR, "Cannot open metric file: '%s'", filename);
-                free(container);
-                free(stat_file);
-                free(filename);
-                SET_MSG_RESULT(result, strdup("Cannot open stat file, maybe CONFIG_DEBUG_BLK_CGROUP is not enabled"));
-                zabbix_log(LOG_LEVEL_ERR, "Cannot open stat file, maybe CONFIG_DEBUG_BLK_CGROUP is not enabled");
-                return SYSINFO_RET_FAIL;
-        }
+        usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
 
-        char    line[MAX_STRING_LEN];
-        char    *metric2 = malloc(strlen(metric)+3);
-        memcpy(metric2, metric, strlen(metric));
-        memcpy(metric2 + strlen(metric), " ", 2);
-        zbx_uint64_t    value = 0;
-        zabbix_log(LOG_LEVEL_DEBUG, "Looking metric %s in blkio file", metric);
-        while (NULL != fgets(line, sizeof(line), file))
-        {
-                if (0 != strncmp(line, metric2, strlen(metric2)))
-                        continue;
-                if (1 != sscanf(line, "%*s " ZBX_FS_UI64, &value))
-                {
-                     // maybe per blk device metric, e.g. '8:0 Read'
-                     if (1 != sscanf(line, "%*s %*s " ZBX_FS_UI64, &value))
-                     {
-                         zabbix_log(LOG_LEVEL_ERR, "sscanf failed for matched metric line");
-                         break;
-                     }
-                }
-                zabbix_log(LOG_LEVEL_DEBUG, "Id: %s; stat file: %s, metric: %s; value: %d", container, stat_file, metric, value);
-                SET_UI64_RESULT(result, value);
-                ret = SYSINFO_RET_OK;
-                break;
-        }
-        zbx_fclose(file);
+        for (b = 0; b < ZBX_LXD_LATENCY_BUCKETS - 1 && usec >= ((zbx_uint64_t)1 << b); b++)
+                ;
 
-        free(container);
-        free(stat_file);
-        free(filename);
-        free(metric2);
+        key_stats = &module_stats->keys[i];
+        __atomic_fetch_add(&key_stats->calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&key_stats->latency[b], 1, __ATOMIC_RELAXED);
 
-        if (SYSINFO_RET_FAIL == ret){
-                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot find a line with requested metric in blkio file"));
-                zabbix_log(LOG_LEVEL_ERR, "Cannot find a line with requested metric in blkio file");
-        }
+        if (SYSINFO_RET_OK != ret)
+                __atomic_fetch_add(&key_stats->errors, 1, __ATOMIC_RELAXED);
 
         return ret;
 }
 
-
 /******************************************************************************
  *                                                                            *
- * Function: zbx_module_uninit                                                *
+ * Function: zbx_lxd_stats_init                                               *
  *                                                                            *
- * Purpose: the function is called on agent shutdown                          *
- *          It should be used to cleanup used resources if there are any      *
+ * Purpose: share module counters between the agent processes and route all  *
+ *          keys through zbx_lxd_instrumented()                               *
  *                                                                            *
- * Return value: ZBX_MODULE_OK - success                                      *
- *               ZBX_MODULE_FAIL - function failed                            *
+ * Comment: must run before the agent forks, without the shared mapping every *
+ *          process counts on its own                                         *
  *                                                                            *
  ******************************************************************************/
-int     zbx_module_uninit()
+static void     zbx_lxd_stats_init()
 {
-        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_uninit()");
-
-        const char* znetns_prefix = "zabbix_module_lxd_";
-        DIR             *dir;
-        struct dirent   *d;
+        zbx_lxd_stats_t *shared;
+        int             i;
 
-        if (NULL == (dir = opendir("/var/run/netns")))
+        if (MAP_FAILED == (shared = mmap(NULL, sizeof(zbx_lxd_stats_t), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0)))
         {
-            zabbix_log(LOG_LEVEL_DEBUG, "/var/run/netns: %s", zbx_strerror(errno));
-            return ZBX_MODULE_OK;
+                zabbix_log(LOG_LEVEL_WARNING, "Cannot map module statistics: %s", zbx_strerror(errno));
         }
-        char *file = NULL;
-        while (NULL != (d = readdir(dir)))
+        else
         {
-            if(0 == strcmp(d->d_name, ".") || 0 == strcmp(d->d_name, ".."))
-                continue;
+                memcpy(shared, module_stats, sizeof(zbx_lxd_stats_t));
+                module_stats = shared;
+        }
 
-            // delete zabbix netns
-            if ((strstr(d->d_name, znetns_prefix)) != NULL)
-            {
-                file = NULL;
-                file = zbx_dsprintf(file, "/var/run/netns/%s", d->d_name);
-                if(unlink(file) != 0)
+        for (i = 0; NULL != keys[i].key; i++)
+        {
+                if (ZBX_LXD_MAX_KEYS <= i)
                 {
-                    zabbix_log(LOG_LEVEL_WARNING, "%s: %s", d->d_name, zbx_strerror(errno));
+                        THIS_SHOULD_NEVER_HAPPEN;
+                        break;
                 }
-            }
-        }
-        if(0 != closedir(dir))
-        {
-            zabbix_log(LOG_LEVEL_WARNING, "/var/run/netns/: %s", zbx_strerror(errno));
-        }
 
-        free(stat_dir);
-
-        return ZBX_MODULE_OK;
+                handlers[i] = keys[i].function;
+                keys[i].function = zbx_lxd_instrumented;
+        }
 }
 
 /******************************************************************************
@@ -647,17 +7838,143 @@ int     zbx_module_init()
 {
         zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_init()");
         zabbix_log(LOG_LEVEL_DEBUG, "zabbix_module_lxd %s, compilation time: %s %s", m_version, __DATE__, __TIME__);
+        zbx_module_lxd_load_config();
+        zbx_lxd_stats_init();
         zbx_lxd_dir_detect();
+        if (0 != collector_interval)
+                zbx_lxd_collector_start();
+        if (NULL != push_server)
+                zbx_lxd_push_start();
+        zbx_lxd_events_start();
+        if (0 != sampler_interval)
+                zbx_lxd_sampler_start();
         return ZBX_MODULE_OK;
 }
 
 
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_discovery_metadata                                       *
+ *                                                                            *
+ * Purpose: add LLD macros of a container from its LXD configuration          *
+ *                                                                            *
+ * Comment: {#IMAGE} is image.description, {#PROFILES} the comma separated    *
+ *          profiles and every user.<key> becomes {#USER.<KEY>} with          *
+ *          characters not allowed in a macro name replaced by '_'. The       *
+ *          expanded configuration includes keys set by the profiles.         *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_discovery_metadata(struct zbx_json *j, const char *containerid)
+{
+        const zbx_lxd_api_container_t   *object;
+        struct zbx_json_parse   jp;
+        const char              *p = NULL, *k;
+        char                    key[MAX_STRING_LEN], macro[MAX_STRING_LEN], *value = NULL, *profiles = NULL;
+        size_t                  value_alloc = 0, profiles_alloc = 0, profiles_offset = 0, offset;
+        int                     is_null, image = 0;
+
+        if (NULL == (object = zbx_lxd_api_find(containerid)))
+        {
+                zbx_json_addstring(j, "{#IMAGE}", "", ZBX_JSON_TYPE_STRING);
+                zbx_json_addstring(j, "{#PROFILES}", "", ZBX_JSON_TYPE_STRING);
+                return;
+        }
+
+        if (SUCCEED == zbx_json_brackets_by_name(&object->jp, "profiles", &jp))
+        {
+                while (NULL != (p = zbx_json_next_value(&jp, p, key, sizeof(key), &is_null)))
+                {
+                        zbx_snprintf_alloc(&profiles, &profiles_alloc, &profiles_offset, "%s%s",
+                                        (0 != profiles_offset ? "," : ""), key);
+                }
+        }
+        zbx_json_addstring(j, "{#PROFILES}", (NULL != profiles ? profiles : ""), ZBX_JSON_TYPE_STRING);
+        zbx_free(profiles);
+
+        if (SUCCEED == zbx_json_brackets_by_name(&object->jp, "expanded_config", &jp) ||
+                        SUCCEED == zbx_json_brackets_by_name(&object->jp, "config", &jp))
+        {
+                for (p = NULL; NULL != (p = zbx_json_pair_next(&jp, p, key, sizeof(key)));)
+                {
+                        if (0 != strcmp(key, "image.description") && 0 != strncmp(key, "user.", 5))
+                                continue;
+
+                        if (NULL == zbx_json_decodevalue_dyn(p, &value, &value_alloc, &is_null))
+                                continue;
+
+                        if ('i' == *key)
+                        {
+                                zbx_json_addstring(j, "{#IMAGE}", value, ZBX_JSON_TYPE_STRING);
+                                image = 1;
+                                continue;
+                        }
+
+                        offset = zbx_snprintf(macro, sizeof(macro), "{#");
+
+                        for (k = key; '\0' != *k && offset < sizeof(macro) - 2; k++)
+                        {
+                                macro[offset++] = (0 != isalnum((unsigned char)*k) || '.' == *k ?
+                                                toupper((unsigned char)*k) : '_');
+                        }
+                        zbx_strlcpy(macro + offset, "}", sizeof(macro) - offset);
+
+                        zbx_json_addstring(j, macro, value, ZBX_JSON_TYPE_STRING);
+                }
+        }
+
+        if (0 == image)
+                zbx_json_addstring(j, "{#IMAGE}", "", ZBX_JSON_TYPE_STRING);
+
+        zbx_free(value);
+}
+
+/* lxd.discovery rows passing the filter, with LXD metadata when asked for */
+typedef struct
+{
+        struct zbx_json         *j;
+        const zbx_lxd_filter_t  *filter;
+        int                     metadata;
+}
+zbx_lxd_discovery_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_discovery_add                                            *
+ *                                                                            *
+ * Purpose: add LLD row of a container passing the filter                     *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_discovery_add(const char *containerid, const char *driver, void *arg)
+{
+        zbx_lxd_discovery_t     *discovery = (zbx_lxd_discovery_t *)arg;
+        struct zbx_json         *j = discovery->j;
+        char                    project[ZBX_LXD_NAME_LEN];
+
+        if (SUCCEED != zbx_lxd_filter_match(discovery->filter, containerid))
+                return;
+
+        zbx_lxd_container_project(containerid, project, sizeof(project));
+
+        zbx_json_addobject(j, NULL);
+        zbx_json_addstring(j, "{#HCONTAINERID}", containerid, ZBX_JSON_TYPE_STRING);
+        zbx_json_addstring(j, "{#SYSTEM.HOSTNAME}", hostname, ZBX_JSON_TYPE_STRING);
+        zbx_json_addstring(j, "{#PROJECT}", project, ZBX_JSON_TYPE_STRING);
+        zbx_json_addstring(j, "{#DRIVER}", ZBX_NULL2STR(driver), ZBX_JSON_TYPE_STRING);
+        if (0 != discovery->metadata)
+                zbx_lxd_discovery_metadata(j, containerid);
+        zbx_json_close(j);
+}
+
 /******************************************************************************
  *                                                                            *
  * Function: zbx_module_lxd_discovery                                         *
  *                                                                            *
  * Purpose: container discovery                                               *
  *                                                                            *
+ * Parameters: include  - [IN] regular expression container names must match *
+ *             exclude  - [IN] regular expression of containers to leave out  *
+ *             metadata - [IN] "api" to add macros from the LXD API           *
+ *                                                                            *
  * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
  *                                 as not supported by zabbix                 *
  *               SYSINFO_RET_OK - success                                     *
@@ -667,8 +7984,43 @@ int     zbx_module_lxd_discovery(AGENT_REQUEST *request, AGENT_RESULT *result)
 {
         zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_discovery()");
 
-        struct zbx_json j;
-        if(stat_dir == NULL && zbx_lxd_dir_detect() == SYSINFO_RET_FAIL)
+        struct zbx_json         j;
+        zbx_lxd_discovery_t     discovery;
+        char                    *metadata, *error = NULL;
+
+        if (3 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        metadata = get_rparam(request, 2);
+
+        if (NULL != metadata && '\0' != *metadata && 0 != strcmp(metadata, "api"))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Invalid third parameter: %s", metadata));
+                return SYSINFO_RET_FAIL;
+        }
+
+        if (NULL == (discovery.filter = zbx_lxd_filter_get(get_rparam(request, 0), get_rparam(request, 1), &error)))
+        {
+                SET_MSG_RESULT(result, error);
+                return SYSINFO_RET_FAIL;
+        }
+
+        discovery.j = &j;
+        discovery.metadata = 0;
+
+        // containers LXD does not know (yet) get empty metadata macros
+        if (NULL != metadata && '\0' != *metadata)
+        {
+                if (SUCCEED != zbx_lxd_api_refresh())
+                        zabbix_log(LOG_LEVEL_DEBUG, "Cannot get containers from LXD API for discovery metadata");
+                discovery.metadata = 1;
+        }
+
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
         {
             zabbix_log(LOG_LEVEL_DEBUG, "lxd.discovery is not available at the moment - no stat directory - empty discovery");
             zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
@@ -679,77 +8031,201 @@ int     zbx_module_lxd_discovery(AGENT_REQUEST *request, AGENT_RESULT *result)
             return SYSINFO_RET_FAIL;
         }
 
-        DIR             *dir;
-        zbx_stat_t      sb;
-        char            *file = NULL, *containerid;
-        struct dirent   *d;
-        char    *cgroup = "cpuset/";
-        size_t  ddir_size = strlen(cgroup) + strlen(stat_dir) + strlen(driver) + 2;
-        char    *ddir = malloc(ddir_size);
-        zbx_strlcpy(ddir, stat_dir, ddir_size);
-        zbx_strlcat(ddir, cgroup, ddir_size);
-        zbx_strlcat(ddir, driver, ddir_size);
-        zabbix_log(LOG_LEVEL_DEBUG, "lxd.discovery-> ddir: %s", ddir);
-
-        if (NULL == (dir = opendir(ddir)))
-        {
-            zabbix_log(LOG_LEVEL_WARNING, "%s: %s", ddir, zbx_strerror(errno));
-            free(ddir);
+        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+        zbx_json_addarray(&j, ZBX_PROTO_TAG_DATA);
+
+        // the hostname is read once per agent process
+        if ('\0' == hostname[0] && 0 != gethostname(hostname, sizeof(hostname) - 1))
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot get hostname: %s", zbx_strerror(errno));
+                hostname[0] = '\0';
+        }
+
+        if (SUCCEED != zbx_lxd_containers_walk(zbx_lxd_discovery_add, &discovery, 1))
+        {
+            zbx_json_free(&j);
             return SYSINFO_RET_FAIL;
         }
 
-        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
-        zbx_json_addarray(&j, ZBX_PROTO_TAG_DATA);
+        zbx_json_close(&j);
 
-        size_t hostname_len = 128;
-        while (1) {
-            char* realloc_hostname = realloc(hostname, hostname_len);
-            if (realloc_hostname == 0) {
-                free(hostname);
-            }
-            hostname = realloc_hostname;
-            hostname[hostname_len-1] = 0;
-            if (gethostname(hostname, hostname_len-1) == 0) {
-                size_t count = strlen(hostname);
-                if (count < hostname_len-2) {
-                    break;
+        SET_STR_RESULT(result, zbx_strdup(NULL, j.buffer));
+
+        zbx_json_free(&j);
+
+        return SYSINFO_RET_OK;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_age                                               *
+ *                                                                            *
+ * Purpose: seconds since the value a key would serve now was sampled         *
+ *                                                                            *
+ * Parameters: request - [IN] container name and a collected stat file        *
+ *                            (memory.stat by default) or api                 *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ * Comment: meant for triggers on stale values served with StaleTTL           *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_age(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_age()");
+        char                    *container, *source;
+        zbx_lxd_snapshot_t      *snapshot;
+        int                     file;
+
+        if (1 > request->nparam || 2 < request->nparam)
+        {
+                zabbix_log(LOG_LEVEL_ERR, "Invalid number of parameters: %d",  request->nparam);
+                SET_MSG_RESULT(result, strdup("Invalid number of parameters"));
+                return SYSINFO_RET_FAIL;
+        }
+
+        container = get_rparam(request, 0);
+        source = get_rparam(request, 1);
+
+        if (NULL == source || '\0' == *source)
+                source = (char *)collect_files[ZBX_LXD_FILE_MEMORY];
+
+        if (0 == strcmp(source, "api"))
+        {
+                while ('/' == *container)
+                        container++;
+
+                if (SUCCEED != zbx_lxd_api_refresh())
+                {
+                        SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot get containers from LXD API"));
+                        return SYSINFO_RET_FAIL;
                 }
-            }
-            hostname_len *= 2;
+
+                if (NULL == zbx_lxd_api_find(container))
+                {
+                        SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Container %s is not known to LXD", container));
+                        return SYSINFO_RET_FAIL;
+                }
+
+                SET_DBL_RESULT(result, zbx_time() - api.fetched);
+                return SYSINFO_RET_OK;
         }
-        zabbix_log(LOG_LEVEL_WARNING, "hostname: %s, dir: %s", hostname, ddir);
-        while (NULL != (d = readdir(dir)))
+
+        if (0 > (file = zbx_lxd_file_index(source)))
         {
-                if(0 == strcmp(d->d_name, ".") || 0 == strcmp(d->d_name, ".."))
-                        continue;
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Unsupported source %s", source));
+                return SYSINFO_RET_FAIL;
+        }
 
-                file = zbx_dsprintf(file, "%s/%s", ddir, d->d_name);
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "lxd.age is not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "lxd.age is not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
+        }
 
-                if (0 != zbx_stat(file, &sb) || 0 == S_ISDIR(sb.st_mode))
-                        continue;
+        if (NULL == (snapshot = zbx_lxd_snapshot_get(container, zbx_lxd_file_cgroup(file), source)))
+        {
+                SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Cannot read %s of container %s", source, container));
+                return SYSINFO_RET_FAIL;
+        }
 
-                containerid = d->d_name;
+        SET_DBL_RESULT(result, zbx_time() - snapshot->sampled);
 
-                zbx_json_addobject(&j, NULL);
-                zbx_json_addstring(&j, "{#HCONTAINERID}", containerid, ZBX_JSON_TYPE_STRING);
-                zbx_json_addstring(&j, "{#SYSTEM.HOSTNAME}", hostname, ZBX_JSON_TYPE_STRING);
-                zbx_json_close(&j);
+        return SYSINFO_RET_OK;
+}
+
+/* lxd.all map being built, see zbx_lxd_all_add() */
+typedef struct
+{
+        struct zbx_json *j;
+        double          deadline;
+        int             skipped;
+}
+zbx_lxd_all_t;
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_lxd_all_add                                                  *
+ *                                                                            *
+ * Purpose: add stats of a container to the lxd.all map                       *
+ *                                                                            *
+ * Comment: past the deadline containers are added as null without reading    *
+ *          their stats, the map is complete but partial. The container being *
+ *          read at the deadline gets partial stats.                          *
+ *                                                                            *
+ ******************************************************************************/
+static void     zbx_lxd_all_add(const char *containerid, const char *driver, void *arg)
+{
+        zbx_lxd_all_t   *all = (zbx_lxd_all_t *)arg;
+        int             partial;
+
+        if (0 != all->skipped || zbx_time() >= all->deadline)
+        {
+                zbx_json_addstring(all->j, containerid, NULL, ZBX_JSON_TYPE_NULL);
+                all->skipped++;
+                return;
+        }
+
+        zbx_json_addobject(all->j, containerid);
+        if (SUCCEED != zbx_lxd_stats_json(all->j, containerid, NULL, all->deadline, &partial))
+                zabbix_log(LOG_LEVEL_DEBUG, "Cannot read stats of '%s', container doesn't run", containerid);
+        else if (0 != partial)
+                all->skipped++;
+        zbx_json_close(all->j);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: zbx_module_lxd_all                                               *
+ *                                                                            *
+ * Purpose: stats of all containers in one JSON map: container -> lxd.stats   *
+ *                                                                            *
+ * Return value: SYSINFO_RET_FAIL - function failed, item will be marked      *
+ *                                 as not supported by zabbix                 *
+ *               SYSINFO_RET_OK - success                                     *
+ *                                                                            *
+ ******************************************************************************/
+int     zbx_module_lxd_all(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+        zabbix_log(LOG_LEVEL_DEBUG, "In zbx_module_lxd_all()");
+
+        struct zbx_json j;
+        zbx_lxd_all_t   all = {&j, zbx_lxd_deadline(zbx_time()), 0};
 
+        if (SYSINFO_RET_OK != zbx_lxd_layout_check())
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "lxd.all is not available at the moment - no stat directory");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "lxd.all is not available at the moment - no stat directory"));
+                return SYSINFO_RET_FAIL;
         }
 
-        if(0 != closedir(dir))
+        if (NULL == layout->cpuacct)
         {
-            zabbix_log(LOG_LEVEL_WARNING, "%s: %s\n", ddir, zbx_strerror(errno));
+                zabbix_log(LOG_LEVEL_DEBUG, "lxd.all is not available at the moment - no cpuacct hierarchy");
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "lxd.all is not available at the moment - no cpuacct hierarchy"));
+                return SYSINFO_RET_FAIL;
         }
 
-        zbx_json_close(&j);
+        zbx_json_init(&j, ZBX_JSON_STAT_BUF_LEN);
+        if (SUCCEED != zbx_lxd_containers_walk(zbx_lxd_all_add, &all, 0))
+        {
+                zbx_json_free(&j);
+                SET_MSG_RESULT(result, zbx_strdup(NULL, "Cannot read LXD driver directory"));
+                return SYSINFO_RET_FAIL;
+        }
 
-        SET_STR_RESULT(result, zbx_strdup(NULL, j.buffer));
+        if (0 != all.skipped)
+        {
+                zabbix_log(LOG_LEVEL_DEBUG, "lxd.all deadline reached, %d containers skipped", all.skipped);
+                ZBX_LXD_STATS_ADD(deadlines, 1);
+        }
 
+        SET_STR_RESULT(result, zbx_strdup(NULL, j.buffer));
         zbx_json_free(&j);
 
-        free(ddir);
-
         return SYSINFO_RET_OK;
 }
 